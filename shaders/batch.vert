@@ -0,0 +1,24 @@
+#version 320 es
+/* Copyright Planimeter. All Rights Reserved. */
+
+precision highp float;
+
+layout(push_constant) uniform PushConstants {
+    mat4 viewprojection;
+} pc;
+
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec2 in_texcoord;
+layout(location = 2) in vec4 in_color;
+layout(location = 3) in mat4 in_transform;
+layout(location = 7) in vec4 in_instancecolor;
+
+layout(location = 0) out vec4 out_color;
+layout(location = 1) out vec2 out_texcoord;
+
+void main()
+{
+    gl_Position = pc.viewprojection * in_transform * vec4(in_position, 1.0);
+    out_color = in_color * in_instancecolor;
+    out_texcoord = in_texcoord;
+}
@@ -1,6 +1,7 @@
 /* Copyright Planimeter. All Rights Reserved. */
 
 #include "framework.h"
+#include "graphics.h"
 #include "SDL3/SDL.h"
 
 int event_poll()
@@ -42,10 +43,22 @@ int event_poll()
         case SDL_EVENT_WINDOW_EXPOSED:
         case SDL_EVENT_WINDOW_MOVED:
         case SDL_EVENT_WINDOW_RESIZED:
+            break;
         case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+            graphics_resize();
+            framework_resize(event.window.data1, event.window.data2);
+            break;
         case SDL_EVENT_WINDOW_MINIMIZED:
+            graphics_minimize();
+            framework_minimize();
+            break;
         case SDL_EVENT_WINDOW_MAXIMIZED:
+            framework_maximize();
+            break;
         case SDL_EVENT_WINDOW_RESTORED:
+            graphics_restore();
+            framework_restore();
+            break;
         case SDL_EVENT_WINDOW_MOUSE_ENTER:
         case SDL_EVENT_WINDOW_MOUSE_LEAVE:
         case SDL_EVENT_WINDOW_FOCUS_GAINED:
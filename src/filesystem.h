@@ -9,8 +9,46 @@
 extern "C" {
 #endif
 
+typedef void *FileRequest;
+
+typedef enum FileRequestStatus {
+    FILE_REQUEST_PENDING,
+    FILE_REQUEST_COMPLETE,
+    FILE_REQUEST_FAILED,
+    FILE_REQUEST_CANCELLED
+} FileRequestStatus;
+
+typedef enum FilePriority {
+    FILE_PRIORITY_LOW,
+    FILE_PRIORITY_NORMAL,
+    FILE_PRIORITY_HIGH,
+    FILE_PRIORITY_COUNT
+} FilePriority;
+
+/* A read-only view of a whole file, backed by mmap where the backend can */
+typedef struct FileMapping {
+    const void *ptr;
+    size_t      size;
+    int         mapped;   /* 0 for a heap copy, 1 for an mmap view, 2 for a view into a pack */
+} FileMapping;
+
+/* Called on the main thread from filesystem_update; the request is released afterwards */
+typedef void (*FileCallback)(FileRequest request, FileRequestStatus status, void *ptr, size_t size, void *userdata);
+
 void   filesystem_init(const char *argv0);
+int    filesystem_mount(const char *pathname);
+int    filesystem_exists(const char *pathname);
+size_t filesystem_filesize(const char *pathname);
 size_t filesystem_fileread(void **ptr, const char *pathname);
+size_t filesystem_filereadbuffer(void *ptr, size_t size, const char *pathname);
+int    filesystem_map(FileMapping *mapping, const char *pathname);
+void   filesystem_unmap(FileMapping *mapping);
+size_t filesystem_filewrite(const void *ptr, size_t size, const char *pathname);
+FileRequest filesystem_filereadasync(const char *pathname, FilePriority priority, void *buffer, size_t size, FileCallback callback, void *userdata);
+FileRequestStatus filesystem_pollrequest(FileRequest request, void **ptr, size_t *size);
+void   filesystem_cancelrequest(FileRequest request);
+void   filesystem_setmaxinflightbytes(size_t bytes);
+void   filesystem_update();
 void   filesystem_shutdown(void);
 
 #ifdef __cplusplus
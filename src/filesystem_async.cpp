@@ -0,0 +1,334 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "filesystem.h"
+#include "memory.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/* Constants */
+static const uint32_t FILE_IO_THREADS = 2;
+static const size_t DEFAULT_MAX_INFLIGHT_BYTES = 64 * 1024 * 1024;
+
+typedef struct FileRequestData {
+    char                          *pathname;
+    FilePriority                   priority;
+    /* The caller's buffer, or NULL to allocate one from MEMORY_FILESYSTEM */
+    void                          *buffer;
+    size_t                         capacity;
+    FileCallback                   callback;
+    void                          *userdata;
+    /* Written by the I/O thread, published through the completion queue */
+    void                          *ptr;
+    size_t                         size;
+    FileRequestStatus              result;
+    /* Only changed on the main thread, by filesystem_update */
+    FileRequestStatus              status;
+    std::atomic<bool>              cancelled;
+    /* Link in the completion queue */
+    struct FileRequestData        *next;
+} FileRequestData;
+
+/* One queue per priority, serviced highest first */
+static std::deque<FileRequestData *> pendingRequests[FILE_PRIORITY_COUNT];
+/* Finished requests in completion order, linked through next so that nothing allocates */
+static FileRequestData *completedHead;
+static FileRequestData *completedTail;
+static std::mutex requestMutex;
+static std::condition_variable requestCondition;
+static std::condition_variable budgetCondition;
+
+static std::thread ioThreads[FILE_IO_THREADS];
+static bool ioThreadsStarted;
+static bool ioThreadsStop;
+
+/* Bytes being read right now, held under maxInflightBytes unless a single file is larger */
+static size_t inflightBytes;
+static size_t maxInflightBytes = DEFAULT_MAX_INFLIGHT_BYTES;
+
+static void filesystem_releaserequest(FileRequestData *request)
+{
+    memory_free(request->pathname, MEMORY_FILESYSTEM);
+    delete request;
+}
+
+/* Called with requestMutex held */
+static void filesystem_pushcompleted(FileRequestData *request, FileRequestStatus result)
+{
+    request->result = result;
+    request->next   = NULL;
+    if (completedTail != NULL) {
+        completedTail->next = request;
+    } else {
+        completedHead = request;
+    }
+    completedTail = request;
+}
+
+static void filesystem_completerequest(FileRequestData *request, FileRequestStatus result)
+{
+    std::lock_guard<std::mutex> lock(requestMutex);
+    filesystem_pushcompleted(request, result);
+}
+
+static FileRequestData *filesystem_nextrequest()
+{
+    FileRequestData *request;
+    int i;
+
+    for (i = FILE_PRIORITY_COUNT - 1; i >= 0; i--)
+    {
+        if (!pendingRequests[i].empty()) {
+            request = pendingRequests[i].front();
+            pendingRequests[i].pop_front();
+            return request;
+        }
+    }
+    return NULL;
+}
+
+static void filesystem_ioworker()
+{
+    FileRequestData *request;
+    size_t size, charge;
+    bool read;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(requestMutex);
+            while (!ioThreadsStop && (request = filesystem_nextrequest()) == NULL)
+            {
+                requestCondition.wait(lock);
+            }
+            if (ioThreadsStop)
+            {
+                return;
+            }
+        }
+
+        if (request->cancelled.load())
+        {
+            filesystem_completerequest(request, FILE_REQUEST_CANCELLED);
+            continue;
+        }
+
+        PROFILER_BEGIN("filesystem_ioworker");
+        size   = filesystem_filesize(request->pathname);
+        charge = request->buffer != NULL ? request->capacity : size;
+
+        /* Wait for room under the cap; a lone file larger than the cap still goes through */
+        {
+            std::unique_lock<std::mutex> lock(requestMutex);
+            while (!ioThreadsStop && inflightBytes > 0 && inflightBytes + charge > maxInflightBytes)
+            {
+                budgetCondition.wait(lock);
+            }
+            inflightBytes += charge;
+        }
+
+        request->ptr = request->buffer;
+        if (request->ptr == NULL)
+        {
+            request->ptr = memory_alloc(size + 1, MEMORY_FILESYSTEM);
+            if (request->ptr != NULL) {
+                request->capacity = size;
+            }
+        }
+
+        /* An empty file is read successfully as zero bytes */
+        read = false;
+        if (request->ptr != NULL && !request->cancelled.load())
+        {
+            if (size > 0) {
+                request->size = filesystem_filereadbuffer(request->ptr, request->capacity, request->pathname);
+                read          = request->size > 0;
+            } else {
+                read = filesystem_exists(request->pathname) != 0;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(requestMutex);
+            inflightBytes -= charge;
+            budgetCondition.notify_all();
+        }
+        PROFILER_END();
+
+        if (read && request->buffer == NULL)
+        {
+            /* Terminated like filesystem_fileread */
+            ((char *)request->ptr)[request->size] = '\0';
+        }
+        filesystem_completerequest(request, read ? FILE_REQUEST_COMPLETE : FILE_REQUEST_FAILED);
+    }
+}
+
+static void filesystem_stopioworkers(void)
+{
+    FileRequestData *request;
+    uint32_t i;
+
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        ioThreadsStop = true;
+        requestCondition.notify_all();
+        budgetCondition.notify_all();
+    }
+
+    for (i = 0; i < FILE_IO_THREADS; i++)
+    {
+        if (ioThreads[i].joinable()) {
+            ioThreads[i].join();
+        }
+    }
+
+    /* Requests nobody will collect */
+    while ((request = filesystem_nextrequest()) != NULL)
+    {
+        filesystem_releaserequest(request);
+    }
+    while ((request = completedHead) != NULL)
+    {
+        completedHead = request->next;
+        if (request->buffer == NULL) {
+            memory_free(request->ptr, MEMORY_FILESYSTEM);
+        }
+        filesystem_releaserequest(request);
+    }
+    completedTail = NULL;
+}
+
+/* Queue a whole-file read. With a buffer, the file must fit in size bytes and the buffer must
+   outlive the request; without one, the result is allocated and freed with memory_free. */
+FileRequest filesystem_filereadasync(const char *pathname, FilePriority priority, void *buffer, size_t size, FileCallback callback, void *userdata)
+{
+    FileRequestData *request = new FileRequestData();
+    size_t length = strlen(pathname);
+    uint32_t i;
+
+    request->pathname = (char *)memory_alloc(length + 1, MEMORY_FILESYSTEM);
+    if (!request->pathname) {
+        fprintf(stderr, "Failed to allocate memory for file request\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(request->pathname, pathname, length + 1);
+
+    request->priority = priority < FILE_PRIORITY_COUNT ? priority : FILE_PRIORITY_HIGH;
+    request->buffer   = buffer;
+    request->capacity = buffer != NULL ? size : 0;
+    request->callback = callback;
+    request->userdata = userdata;
+    request->ptr      = NULL;
+    request->size     = 0;
+    request->result   = FILE_REQUEST_PENDING;
+    request->status   = FILE_REQUEST_PENDING;
+    request->cancelled.store(false);
+    request->next     = NULL;
+
+    std::lock_guard<std::mutex> lock(requestMutex);
+
+    /* The workers start with the first request, and stop before the filesystem shuts down */
+    if (!ioThreadsStarted)
+    {
+        ioThreadsStarted = true;
+        for (i = 0; i < FILE_IO_THREADS; i++)
+        {
+            ioThreads[i] = std::thread(filesystem_ioworker);
+        }
+        atexit(filesystem_stopioworkers);
+    }
+
+    pendingRequests[request->priority].push_back(request);
+    requestCondition.notify_one();
+    return request;
+}
+
+/* Once this returns anything but FILE_REQUEST_PENDING, the request is released */
+FileRequestStatus filesystem_pollrequest(FileRequest _request, void **ptr, size_t *size)
+{
+    FileRequestData *request = (FileRequestData *)_request;
+    FileRequestStatus status = request->status;
+
+    if (status == FILE_REQUEST_PENDING)
+    {
+        return status;
+    }
+
+    if (ptr != NULL) {
+        *ptr = status == FILE_REQUEST_COMPLETE ? request->ptr : NULL;
+    }
+    if (size != NULL) {
+        *size = status == FILE_REQUEST_COMPLETE ? request->size : 0;
+    }
+    filesystem_releaserequest(request);
+    return status;
+}
+
+/* The request still completes, as FILE_REQUEST_CANCELLED, and a read in progress is discarded */
+void filesystem_cancelrequest(FileRequest _request)
+{
+    FileRequestData *request = (FileRequestData *)_request;
+    std::deque<FileRequestData *>::iterator it;
+
+    std::lock_guard<std::mutex> lock(requestMutex);
+    request->cancelled.store(true);
+
+    /* Not started yet, so skip the queue */
+    std::deque<FileRequestData *> &queue = pendingRequests[request->priority];
+    for (it = queue.begin(); it != queue.end(); ++it)
+    {
+        if (*it == request) {
+            queue.erase(it);
+            filesystem_pushcompleted(request, FILE_REQUEST_CANCELLED);
+            break;
+        }
+    }
+}
+
+void filesystem_setmaxinflightbytes(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(requestMutex);
+    maxInflightBytes = bytes;
+    budgetCondition.notify_all();
+}
+
+/* Deliver finished requests on the main thread; called once per frame */
+void filesystem_update()
+{
+    FileRequestData *request;
+    FileRequestData *next;
+
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        request       = completedHead;
+        completedHead = NULL;
+        completedTail = NULL;
+    }
+
+    for (; request != NULL; request = next)
+    {
+        next = request->next;
+
+        request->status = request->cancelled.load() ? FILE_REQUEST_CANCELLED : request->result;
+        if (request->status != FILE_REQUEST_COMPLETE && request->buffer == NULL)
+        {
+            memory_free(request->ptr, MEMORY_FILESYSTEM);
+            request->ptr = NULL;
+        }
+
+        if (request->callback != NULL)
+        {
+            request->callback(request, request->status,
+                              request->status == FILE_REQUEST_COMPLETE ? request->ptr : NULL,
+                              request->status == FILE_REQUEST_COMPLETE ? request->size : 0, request->userdata);
+            filesystem_releaserequest(request);
+        }
+    }
+}
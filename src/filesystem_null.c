@@ -1,5 +1,7 @@
 /* Copyright Planimeter. All Rights Reserved. */
 
+#include "filesystem.h"
+#include "memory.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -16,6 +18,27 @@ void filesystem_init(const char *argv0)
     atexit(filesystem_shutdown);
 }
 
+int filesystem_mount(const char *pathname)
+{
+    return 0;
+}
+
+int filesystem_exists(const char *pathname)
+{
+    FILE *fp;
+
+    if ((fp = fopen(pathname, "rb")) == NULL) {
+        return 0;
+    }
+    fclose(fp);
+    return 1;
+}
+
+size_t filesystem_filesize(const char *pathname)
+{
+    return 0;
+}
+
 size_t filesystem_fileread(void **ptr, const char *pathname)
 {
     FILE *fp;
@@ -28,7 +51,7 @@ size_t filesystem_fileread(void **ptr, const char *pathname)
         return 0;
     }
     size = fsize((char *)pathname, fp);
-    p = (char *) malloc(size+1);  /* +1 for ′\0′ */
+    p = (char *) memory_alloc(size+1, MEMORY_FILESYSTEM);  /* +1 for ′\0′ */
     if (p == NULL) {
         fclose(fp);
         return 0;
@@ -36,7 +59,7 @@ size_t filesystem_fileread(void **ptr, const char *pathname)
     elements_read = fread(p, size, 1, fp);
     if (elements_read != 1) {
         fprintf(stderr, "filesystem_fileread: can't read %s\n", pathname);
-        free(p);
+        memory_free(p, MEMORY_FILESYSTEM);
         fclose(fp);
         return 0;
     }
@@ -46,6 +69,42 @@ size_t filesystem_fileread(void **ptr, const char *pathname)
     return size;
 }
 
+size_t filesystem_filereadbuffer(void *ptr, size_t size, const char *pathname)
+{
+    return 0;
+}
+
+int filesystem_map(FileMapping *mapping, const char *pathname)
+{
+    mapping->ptr    = NULL;
+    mapping->size   = 0;
+    mapping->mapped = 0;
+    return 0;
+}
+
+void filesystem_unmap(FileMapping *mapping)
+{
+}
+
+size_t filesystem_filewrite(const void *ptr, size_t size, const char *pathname)
+{
+    FILE *fp;
+    size_t elements_written;
+
+    if ((fp = fopen(pathname, "wb")) == NULL) {
+        fprintf(stderr, "filesystem_filewrite: can't open %s\n", pathname);
+        return 0;
+    }
+    elements_written = fwrite(ptr, size, 1, fp);
+    if (elements_written != 1) {
+        fprintf(stderr, "filesystem_filewrite: can't write %s\n", pathname);
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+    return size;
+}
+
 void filesystem_shutdown(void)
 {
 }
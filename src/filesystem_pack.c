@@ -0,0 +1,119 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "filesystem.h"
+#include "memory.h"
+#include "pack.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_PACKS 16
+
+/* Mounted packs, each mapped whole for the life of the program */
+static FileMapping packs[MAX_PACKS];
+static int packCount = 0;
+
+static void filesystem_unmountpacks(void)
+{
+    while (packCount > 0)
+    {
+        filesystem_unmap(&packs[--packCount]);
+    }
+}
+
+/* Mount packs on the main thread before reading from them; later mounts override earlier ones */
+int filesystem_mount(const char *pathname)
+{
+    FileMapping mapping;
+
+    if (packCount == MAX_PACKS) {
+        fprintf(stderr, "filesystem_mount: too many packs for %s\n", pathname);
+        return 0;
+    }
+    if (!filesystem_map(&mapping, pathname)) {
+        return 0;
+    }
+    if (!pack_validate(mapping.ptr, mapping.size)) {
+        fprintf(stderr, "filesystem_mount: can't mount %s\n", pathname);
+        filesystem_unmap(&mapping);
+        return 0;
+    }
+
+    /* Unmapped before the filesystem itself shuts down */
+    if (packCount == 0) {
+        atexit(filesystem_unmountpacks);
+    }
+    packs[packCount++] = mapping;
+    return 1;
+}
+
+const PackEntry *filesystem_findpacked(const char *pathname, const void **data)
+{
+    const PackEntry *entry;
+    int i;
+
+    for (i = packCount - 1; i >= 0; i--)
+    {
+        if ((entry = pack_findentry(packs[i].ptr, pathname)) != NULL) {
+            if (data != NULL) {
+                *data = (const unsigned char *)packs[i].ptr + entry->offset;
+            }
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Entries are viewed in place when stored uncompressed */
+int filesystem_mappacked(FileMapping *mapping, const char *pathname)
+{
+    const PackEntry *entry;
+    const void *data;
+
+    if ((entry = filesystem_findpacked(pathname, &data)) == NULL ||
+        (entry->flags & PACK_ENTRY_COMPRESSED)) {
+        return 0;
+    }
+    mapping->ptr    = data;
+    mapping->size   = (size_t)entry->size;
+    mapping->mapped = 2;
+    return 1;
+}
+
+/* Like filesystem_fileread, a terminated heap copy released with memory_free; empty entries read as "" */
+int filesystem_readpacked(void **ptr, size_t *size, const PackEntry *entry, const void *data)
+{
+    char *p;
+
+    p = (char *) memory_alloc((size_t)entry->size + 1, MEMORY_FILESYSTEM);
+    if (p == NULL) {
+        return 0;
+    }
+    if (!filesystem_copypacked(p, (size_t)entry->size, entry, data)) {
+        memory_free(p, MEMORY_FILESYSTEM);
+        return 0;
+    }
+    p[entry->size] = '\0';
+    *ptr  = p;
+    *size = (size_t)entry->size;
+    return 1;
+}
+
+/* Copying touches every byte anyway, so the checksum is verified here and not on map; copies entry->size bytes */
+int filesystem_copypacked(void *ptr, size_t size, const PackEntry *entry, const void *data)
+{
+    if (entry->flags & PACK_ENTRY_COMPRESSED) {
+        fprintf(stderr, "filesystem_copypacked: compressed entries are not supported\n");
+        return 0;
+    }
+    if (entry->size > size) {
+        fprintf(stderr, "filesystem_copypacked: entry does not fit\n");
+        return 0;
+    }
+    memcpy(ptr, data, (size_t)entry->size);
+    if (pack_checksum(0, ptr, (size_t)entry->size) != entry->checksum) {
+        fprintf(stderr, "filesystem_copypacked: checksum mismatch\n");
+        return 0;
+    }
+    return 1;
+}
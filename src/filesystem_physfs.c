@@ -1,46 +1,249 @@
 /* Copyright Planimeter. All Rights Reserved. */
 
+/* mmap and posix_madvise under strict C99 */
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "physfs.h"
+#include "filesystem.h"
+#include "memory.h"
+#include "pack.h"
+#include "profiler.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define FILESYSTEM_MMAP
+#endif
 
 void filesystem_init(const char *argv0)
 {
     void filesystem_shutdown(void);
+    const char *prefdir;
 
     PHYSFS_init(argv0);
+
+    /* Files written by the engine go to the save directory, which is searched first */
+    prefdir = PHYSFS_getPrefDir("Planimeter", "game");
+    if (prefdir != NULL && PHYSFS_setWriteDir(prefdir)) {
+        PHYSFS_mount(prefdir, NULL, 0);
+    }
     PHYSFS_mount(".", NULL, 1);
 
     atexit(filesystem_shutdown);
 }
 
+int filesystem_exists(const char *pathname)
+{
+    return filesystem_findpacked(pathname, NULL) != NULL || PHYSFS_exists(pathname);
+}
+
+size_t filesystem_filesize(const char *pathname)
+{
+    const PackEntry *entry;
+    PHYSFS_Stat stat;
+
+    if ((entry = filesystem_findpacked(pathname, NULL)) != NULL) {
+        return (size_t)entry->size;
+    }
+    if (!PHYSFS_stat(pathname, &stat) || stat.filesize < 0) {
+        return 0;
+    }
+    return (size_t)stat.filesize;
+}
+
 size_t filesystem_fileread(void **ptr, const char *pathname)
 {
+    const PackEntry *entry;
+    const void *data;
     PHYSFS_File *fp;
     PHYSFS_sint64 size;
     char *p;
     PHYSFS_sint64 elements_read;
 
+    PROFILER_BEGIN("filesystem_fileread");
+    if ((entry = filesystem_findpacked(pathname, &data)) != NULL) {
+        size_t length = 0;
+
+        if (!filesystem_readpacked(ptr, &length, entry, data)) {
+            length = 0;
+        }
+        PROFILER_END();
+        return length;
+    }
     if ((fp = PHYSFS_openRead(pathname)) == NULL) {
         fprintf(stderr, "filesystem_fileread: can't open %s\n", pathname);
+        PROFILER_END();
         return 0;
     }
     size = PHYSFS_fileLength(fp);
-    p = (char *) malloc(size+1);  /* +1 for ′\0′ */
+    p = (char *) memory_alloc(size+1, MEMORY_FILESYSTEM);  /* +1 for ′\0′ */
     if (p == NULL) {
         PHYSFS_close(fp);
+        PROFILER_END();
         return 0;
     }
     elements_read = PHYSFS_readBytes(fp, p, size);
     if (elements_read != size) {
         fprintf(stderr, "filesystem_fileread: can't read %s\n", pathname);
-        free(p);
+        memory_free(p, MEMORY_FILESYSTEM);
         PHYSFS_close(fp);
+        PROFILER_END();
         return 0;
     }
     p[size] = '\0';
     PHYSFS_close(fp);
     *ptr = p;
+    PROFILER_END();
+    return size;
+}
+
+/* Read a whole file into the caller's buffer; fails if it does not fit */
+size_t filesystem_filereadbuffer(void *ptr, size_t size, const char *pathname)
+{
+    const PackEntry *entry;
+    const void *data;
+    PHYSFS_File *fp;
+    PHYSFS_sint64 length;
+    PHYSFS_sint64 elements_read;
+
+    PROFILER_BEGIN("filesystem_filereadbuffer");
+    if ((entry = filesystem_findpacked(pathname, &data)) != NULL) {
+        length = filesystem_copypacked(ptr, size, entry, data) ? (PHYSFS_sint64)entry->size : 0;
+        PROFILER_END();
+        return length;
+    }
+    if ((fp = PHYSFS_openRead(pathname)) == NULL) {
+        fprintf(stderr, "filesystem_filereadbuffer: can't open %s\n", pathname);
+        PROFILER_END();
+        return 0;
+    }
+    length = PHYSFS_fileLength(fp);
+    if (length < 0 || (PHYSFS_uint64)length > size) {
+        fprintf(stderr, "filesystem_filereadbuffer: %s does not fit\n", pathname);
+        PHYSFS_close(fp);
+        PROFILER_END();
+        return 0;
+    }
+    elements_read = PHYSFS_readBytes(fp, ptr, length);
+    if (elements_read != length) {
+        fprintf(stderr, "filesystem_filereadbuffer: can't read %s\n", pathname);
+        PHYSFS_close(fp);
+        PROFILER_END();
+        return 0;
+    }
+    PHYSFS_close(fp);
+    PROFILER_END();
+    return (size_t)length;
+}
+
+#ifdef FILESYSTEM_MMAP
+/* Map a file that lives loose in a mounted directory; archive entries have no real path */
+static int filesystem_mapreal(FileMapping *mapping, const char *pathname)
+{
+    const char *realdir = PHYSFS_getRealDir(pathname);
+    const char *separator = PHYSFS_getDirSeparator();
+    char realpath[4096];
+    struct stat stbuf;
+    void *p;
+    int fd;
+
+    if (realdir == NULL ||
+        snprintf(realpath, sizeof(realpath), "%s%s%s", realdir, separator, pathname) >= (int)sizeof(realpath)) {
+        return 0;
+    }
+    if ((fd = open(realpath, O_RDONLY)) == -1) {
+        return 0;
+    }
+    /* An archive's real dir is the archive file itself, so the joined path is not a regular file */
+    if (fstat(fd, &stbuf) == -1 || !S_ISREG(stbuf.st_mode) || stbuf.st_size <= 0) {
+        close(fd);
+        return 0;
+    }
+
+    /* https://pubs.opengroup.org/onlinepubs/9699919799/functions/mmap.html */
+    p = mmap(NULL, stbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return 0;
+    }
+    /* Assets are consumed front to back, so let the kernel read ahead */
+    posix_madvise(p, stbuf.st_size, POSIX_MADV_SEQUENTIAL);
+
+    mapping->ptr    = p;
+    mapping->size   = stbuf.st_size;
+    mapping->mapped = 1;
+    return 1;
+}
+#endif
+
+/* Loose files are mapped; anything else falls back to a heap copy behind the same interface */
+int filesystem_map(FileMapping *mapping, const char *pathname)
+{
+    void *p = NULL;
+
+    mapping->ptr    = NULL;
+    mapping->size   = 0;
+    mapping->mapped = 0;
+
+    PROFILER_BEGIN("filesystem_map");
+    if (filesystem_mappacked(mapping, pathname)) {
+        PROFILER_END();
+        return 1;
+    }
+#ifdef FILESYSTEM_MMAP
+    if (filesystem_mapreal(mapping, pathname)) {
+        PROFILER_END();
+        return 1;
+    }
+#endif
+    mapping->size = filesystem_fileread(&p, pathname);
+    if (mapping->size == 0) {
+        /* An empty file still returns its terminator */
+        memory_free(p, MEMORY_FILESYSTEM);
+        PROFILER_END();
+        return 0;
+    }
+    mapping->ptr = p;
+    PROFILER_END();
+    return 1;
+}
+
+void filesystem_unmap(FileMapping *mapping)
+{
+    if (mapping->mapped == 1) {
+#ifdef FILESYSTEM_MMAP
+        munmap((void *)mapping->ptr, mapping->size);
+#endif
+    } else if (mapping->mapped == 0 && mapping->ptr != NULL) {
+        memory_free((void *)mapping->ptr, MEMORY_FILESYSTEM);
+    }
+    mapping->ptr    = NULL;
+    mapping->size   = 0;
+    mapping->mapped = 0;
+}
+
+size_t filesystem_filewrite(const void *ptr, size_t size, const char *pathname)
+{
+    PHYSFS_File *fp;
+    PHYSFS_sint64 elements_written;
+
+    if ((fp = PHYSFS_openWrite(pathname)) == NULL) {
+        fprintf(stderr, "filesystem_filewrite: can't open %s\n", pathname);
+        return 0;
+    }
+    elements_written = PHYSFS_writeBytes(fp, ptr, size);
+    if (elements_written != (PHYSFS_sint64)size) {
+        fprintf(stderr, "filesystem_filewrite: can't write %s\n", pathname);
+        PHYSFS_close(fp);
+        return 0;
+    }
+    PHYSFS_close(fp);
     return size;
 }
 
@@ -1,8 +1,15 @@
 /* Copyright Planimeter. All Rights Reserved. */
 
+#include "filesystem.h"
+#include "memory.h"
+#include "pack.h"
+#include "profiler.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /* fsize:  return size of file "name" */
 static off_t fsize(char *name, FILE *stream)
@@ -23,33 +30,190 @@ void filesystem_init(const char *argv0)
     atexit(filesystem_shutdown);
 }
 
+int filesystem_exists(const char *pathname)
+{
+    FILE *fp;
+
+    if (filesystem_findpacked(pathname, NULL) != NULL) {
+        return 1;
+    }
+    if ((fp = fopen(pathname, "rb")) == NULL) {
+        return 0;
+    }
+    fclose(fp);
+    return 1;
+}
+
+size_t filesystem_filesize(const char *pathname)
+{
+    const PackEntry *entry;
+    struct stat stbuf;
+
+    if ((entry = filesystem_findpacked(pathname, NULL)) != NULL) {
+        return (size_t)entry->size;
+    }
+    if (stat(pathname, &stbuf) == -1) {
+        return 0;
+    }
+    return stbuf.st_size;
+}
+
 size_t filesystem_fileread(void **ptr, const char *pathname)
 {
+    const PackEntry *entry;
+    const void *data;
     FILE *fp;
     off_t size;
     char *p;
     size_t elements_read;
 
+    PROFILER_BEGIN("filesystem_fileread");
+    if ((entry = filesystem_findpacked(pathname, &data)) != NULL) {
+        size_t length = 0;
+
+        if (!filesystem_readpacked(ptr, &length, entry, data)) {
+            length = 0;
+        }
+        PROFILER_END();
+        return length;
+    }
     if ((fp = fopen(pathname, "rb")) == NULL) {
         fprintf(stderr, "filesystem_fileread: can't open %s\n", pathname);
+        PROFILER_END();
         return 0;
     }
     size = fsize((char *)pathname, fp);
-    p = (char *) malloc(size+1);  /* +1 for ′\0′ */
+    p = (char *) memory_alloc(size+1, MEMORY_FILESYSTEM);  /* +1 for ′\0′ */
     if (p == NULL) {
         fclose(fp);
+        PROFILER_END();
         return 0;
     }
     elements_read = fread(p, size, 1, fp);
     if (elements_read != 1) {
         fprintf(stderr, "filesystem_fileread: can't read %s\n", pathname);
-        free(p);
+        memory_free(p, MEMORY_FILESYSTEM);
         fclose(fp);
+        PROFILER_END();
         return 0;
     }
     p[size] = '\0';
     fclose(fp);
     *ptr = p;
+    PROFILER_END();
+    return size;
+}
+
+/* Read a whole file into the caller's buffer; fails if it does not fit */
+size_t filesystem_filereadbuffer(void *ptr, size_t size, const char *pathname)
+{
+    const PackEntry *entry;
+    const void *data;
+    FILE *fp;
+    off_t length;
+    size_t elements_read;
+
+    PROFILER_BEGIN("filesystem_filereadbuffer");
+    if ((entry = filesystem_findpacked(pathname, &data)) != NULL) {
+        length = filesystem_copypacked(ptr, size, entry, data) ? (off_t)entry->size : 0;
+        PROFILER_END();
+        return length;
+    }
+    if ((fp = fopen(pathname, "rb")) == NULL) {
+        fprintf(stderr, "filesystem_filereadbuffer: can't open %s\n", pathname);
+        PROFILER_END();
+        return 0;
+    }
+    length = fsize((char *)pathname, fp);
+    if (length < 0 || (size_t)length > size) {
+        fprintf(stderr, "filesystem_filereadbuffer: %s does not fit\n", pathname);
+        fclose(fp);
+        PROFILER_END();
+        return 0;
+    }
+    elements_read = fread(ptr, length, 1, fp);
+    if (length > 0 && elements_read != 1) {
+        fprintf(stderr, "filesystem_filereadbuffer: can't read %s\n", pathname);
+        fclose(fp);
+        PROFILER_END();
+        return 0;
+    }
+    fclose(fp);
+    PROFILER_END();
+    return length;
+}
+
+/* https://pubs.opengroup.org/onlinepubs/9699919799/functions/mmap.html */
+int filesystem_map(FileMapping *mapping, const char *pathname)
+{
+    struct stat stbuf;
+    void *p;
+    int fd;
+
+    mapping->ptr    = NULL;
+    mapping->size   = 0;
+    mapping->mapped = 0;
+
+    PROFILER_BEGIN("filesystem_map");
+    if (filesystem_mappacked(mapping, pathname)) {
+        PROFILER_END();
+        return 1;
+    }
+    if ((fd = open(pathname, O_RDONLY)) == -1) {
+        fprintf(stderr, "filesystem_map: can't open %s\n", pathname);
+        PROFILER_END();
+        return 0;
+    }
+    /* Empty files cannot be mapped */
+    if (fstat(fd, &stbuf) == -1 || stbuf.st_size <= 0) {
+        fprintf(stderr, "filesystem_map: can't access %s\n", pathname);
+        close(fd);
+        PROFILER_END();
+        return 0;
+    }
+    p = mmap(NULL, stbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "filesystem_map: can't map %s\n", pathname);
+        PROFILER_END();
+        return 0;
+    }
+    /* Assets are consumed front to back, so let the kernel read ahead */
+    posix_madvise(p, stbuf.st_size, POSIX_MADV_SEQUENTIAL);
+
+    mapping->ptr    = p;
+    mapping->size   = stbuf.st_size;
+    mapping->mapped = 1;
+    PROFILER_END();
+    return 1;
+}
+
+void filesystem_unmap(FileMapping *mapping)
+{
+    if (mapping->mapped == 1) {
+        munmap((void *)mapping->ptr, mapping->size);
+    }
+    mapping->ptr    = NULL;
+    mapping->size   = 0;
+    mapping->mapped = 0;
+}
+
+size_t filesystem_filewrite(const void *ptr, size_t size, const char *pathname)
+{
+    FILE *fp;
+    size_t elements_written;
+
+    if ((fp = fopen(pathname, "wb")) == NULL) {
+        fprintf(stderr, "filesystem_filewrite: can't open %s\n", pathname);
+        return 0;
+    }
+    elements_written = fwrite(ptr, size, 1, fp);
+    if (elements_written != 1) {
+        fprintf(stderr, "filesystem_filewrite: can't write %s\n", pathname);
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
     return size;
 }
 
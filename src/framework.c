@@ -1,23 +1,173 @@
 /* Copyright Planimeter. All Rights Reserved. */
 
+#include "framework.h"
 #include "filesystem.h"
 #include "window.h"
 #include "graphics.h"
+#include "job.h"
+#include "memory.h"
+#include "profiler.h"
+#include "texture.h"
+#include "timer.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
-void framework_init(const char *argv0)
+static const GraphicsVertex triangle_vertices[3] = {
+    { {  0.0f, -0.5f, 0.0f }, { 0.5f, 0.0f }, { 1.0f, 0.0f, 0.0f, 1.0f } },
+    { {  0.5f,  0.5f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 1.0f } },
+    { { -0.5f,  0.5f, 0.0f }, { 0.0f, 1.0f }, { 0.0f, 0.0f, 1.0f, 1.0f } }
+};
+
+static Mesh     triangle;
+static Material material;
+
+/* Triangles drawn in a row with --instances <n>, or 0 for the one in the middle */
+static uint32_t instancecount;
+
+/* Written as a Chrome trace on quit when set with --trace <path> */
+static const char *tracepath;
+
+/* GPU timings written on quit when set with --gpu-profile <path>, as CSV or as JSON for .json */
+static const char *gpuprofilepath;
+
+/* Simulation ticks per second, or 0 to update once per rendered frame */
+static uint32_t tickrate;
+
+/* Ticks run per rendered frame before the simulation gives up catching up */
+#define MAX_TICKS_PER_FRAME 8
+
+/* Simulation time owed, in nanoseconds scaled by the tick rate */
+static uint64_t accumulator;
+
+/* Ticks into the current second, which spreads its nanoseconds over the ticks exactly */
+static uint32_t tickphase;
+
+/* Render on a thread of its own, read once after framework_load */
+static int threaded;
+
+/* Frames to draw before quitting with --frames <n>, or 0 to run until asked to quit */
+static uint32_t framelimit;
+static uint32_t framecount;
+static uint64_t framestart;
+
+static void framework_setpresentmode(const char *name)
+{
+    if (strcmp(name, "fifo") == 0) {
+        graphics_setpresentmode(PRESENT_MODE_FIFO);
+    } else if (strcmp(name, "mailbox") == 0) {
+        graphics_setpresentmode(PRESENT_MODE_MAILBOX);
+    } else if (strcmp(name, "immediate") == 0) {
+        graphics_setpresentmode(PRESENT_MODE_IMMEDIATE);
+    } else if (strcmp(name, "fifo-relaxed") == 0) {
+        graphics_setpresentmode(PRESENT_MODE_FIFO_RELAXED);
+    } else {
+        fprintf(stderr, "framework_load: unknown present mode %s\n", name);
+    }
+}
+
+void framework_init(int argc, char *argv[])
 {
-    filesystem_init(argv0);
-    window_init();
+    const char *outputpath = NULL;
+    unsigned int width = 640, height = 480;
+    int headless = 0;
+    int i;
+
+    memory_init();
+    profiler_init();
+    job_init();
+    filesystem_init(argv[0]);
+
+    /* Whether there is a window has to be known before the device is created */
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = 1;
+        }
+    }
+
+    for (i = 1; i < argc - 1; i++)
+    {
+        if (strcmp(argv[i], "--size") == 0) {
+            if (sscanf(argv[i + 1], "%ux%u", &width, &height) != 2) {
+                fprintf(stderr, "framework_init: bad size %s\n", argv[i + 1]);
+            }
+        } else if (strcmp(argv[i], "--output") == 0) {
+            outputpath = argv[i + 1];
+        }
+    }
+
+    /* Shipped assets come from the pack when there is one, ahead of loose files */
+    if (filesystem_exists("game.pak")) {
+        filesystem_mount("game.pak");
+    }
+
+    if (headless) {
+        graphics_setheadless(width, height, outputpath);
+    } else {
+        window_init();
+    }
     graphics_init();
 }
 
 void framework_load(int argc, char *argv[])
 {
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--threaded") == 0) {
+            framework_setthreaded(1);
+        } else if (strcmp(argv[i], "--hot-reload") == 0) {
+            graphics_setshaderhotreload(1);
+        } else if (strcmp(argv[i], "--low-latency") == 0) {
+            graphics_setlowlatency(1);
+        }
+    }
+
+    for (i = 1; i < argc - 1; i++)
+    {
+        if (strcmp(argv[i], "--trace") == 0) {
+            tracepath = argv[i + 1];
+        } else if (strcmp(argv[i], "--gpu-profile") == 0) {
+            gpuprofilepath = argv[i + 1];
+        } else if (strcmp(argv[i], "--tickrate") == 0) {
+            framework_settickrate((uint32_t)strtoul(argv[i + 1], NULL, 10));
+        } else if (strcmp(argv[i], "--fps") == 0) {
+            unsigned long fps = strtoul(argv[i + 1], NULL, 10);
+            timer_settargetframetime(fps > 0 ? 1000000000ull / fps : 0);
+        } else if (strcmp(argv[i], "--texture-benchmark") == 0) {
+            texture_benchmark(argv[i + 1]);
+        } else if (strcmp(argv[i], "--frames") == 0) {
+            framelimit = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "--present-mode") == 0) {
+            framework_setpresentmode(argv[i + 1]);
+        } else if (strcmp(argv[i], "--instances") == 0) {
+            instancecount = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+        }
+    }
+
+    triangle = graphics_createmesh(triangle_vertices, 3, NULL, 0);
+    material = graphics_creatematerial(NULL, NULL, NULL);
+
+    framestart = timer_getnanoseconds();
 }
 
 int framework_quit()
 {
+    if (tracepath != NULL)
+    {
+        profiler_save(tracepath);
+    }
+
+    if (gpuprofilepath != NULL)
+    {
+        printf("framework: wrote %d frames of GPU timings to %s\n",
+               graphics_saveprofile(gpuprofilepath), gpuprofilepath);
+    }
+
     return 1;
 }
 
@@ -89,10 +239,117 @@ void framework_wheelmoved(int x, int y)
 {
 }
 
+void framework_settickrate(uint32_t rate)
+{
+    tickrate    = rate;
+    accumulator = 0;
+    tickphase   = 0;
+}
+
+uint32_t framework_gettickrate()
+{
+    return tickrate;
+}
+
+void framework_setthreaded(int _threaded)
+{
+    threaded = _threaded;
+}
+
+int framework_isthreaded()
+{
+    return threaded;
+}
+
+int framework_isfinished()
+{
+    return framelimit > 0 && framecount >= framelimit;
+}
+
+/* Run the ticks owed for dt nanoseconds of frame time; returns how far between the last two ticks to draw */
+float framework_advance(uint64_t dt)
+{
+    uint32_t ticks = 0;
+    uint64_t start, end;
+
+    /* Variable timestep */
+    if (tickrate == 0)
+    {
+        accumulator = 0;
+
+        PROFILER_BEGIN("framework_update");
+        framework_update(dt);
+        PROFILER_END();
+        return 1.0f;
+    }
+
+    /* Fixed timestep; tick lengths differ by at most a nanosecond so that tickrate of them make a second */
+    accumulator += dt * tickrate;
+    while (accumulator >= 1000000000 && ticks < MAX_TICKS_PER_FRAME)
+    {
+        start = (uint64_t)tickphase * 1000000000 / tickrate;
+        end   = (uint64_t)(tickphase + 1) * 1000000000 / tickrate;
+        tickphase = (tickphase + 1) % tickrate;
+
+        PROFILER_BEGIN("framework_update");
+        framework_update(end - start);
+        PROFILER_END();
+
+        accumulator -= 1000000000;
+        ticks++;
+    }
+
+    /* Drop time the simulation cannot catch up on rather than spiral */
+    if (accumulator >= 1000000000)
+    {
+        accumulator %= 1000000000;
+    }
+
+    return accumulator / 1000000000.0f;
+}
+
+/* dt is in nanoseconds */
 void framework_update(uint64_t dt)
 {
 }
 
-void framework_draw()
+void framework_draw(float alpha)
 {
+    float transform[16] = { 1.0f, 0.0f, 0.0f, 0.0f,
+                            0.0f, 1.0f, 0.0f, 0.0f,
+                            0.0f, 0.0f, 1.0f, 0.0f,
+                            0.0f, 0.0f, 0.0f, 1.0f };
+    GraphicsStats stats;
+    uint32_t i;
+
+    /* Frames drawn rather than presented, which is what a headless run measures */
+    if (++framecount == framelimit) {
+        uint64_t elapsed = timer_getnanoseconds() - framestart;
+
+        printf("framework: %u frames in %.3f ms, %.1f frames per second\n",
+               framecount, elapsed / 1e6, elapsed > 0 ? framecount * 1e9 / elapsed : 0.0);
+
+        if (instancecount > 0) {
+            graphics_getstats(&stats);
+            printf("framework: %u of %u instances visible after culling\n", stats.visibleinstances, stats.instances);
+        }
+    }
+
+    if (triangle == NULL)
+    {
+        return;
+    }
+
+    if (instancecount == 0)
+    {
+        graphics_drawmesh(triangle, material, NULL);
+        return;
+    }
+
+    /* A row four times as wide as the view, so the cull pass has something to reject */
+    for (i = 0; i < instancecount; i++)
+    {
+        transform[12] = -4.0f + 8.0f * (i + 0.5f) / instancecount;
+        graphics_drawmesh(triangle, material, transform);
+    }
 }
@@ -9,7 +9,7 @@
 extern "C" {
 #endif
 
-void framework_init(const char *argv0);
+void framework_init(int argc, char *argv[]);
 void framework_load(int argc, char *argv[]);
 int  framework_quit();
 void framework_lowmemory();
@@ -29,8 +29,14 @@ void framework_mousemoved(int x, int y, int dx, int dy, int istouch);
 void framework_mousepressed(int x, int y, const char *button, int istouch);
 void framework_mousereleased(int x, int y, const char *button, int istouch);
 void framework_wheelmoved(int x, int y);
+void framework_settickrate(uint32_t rate);
+uint32_t framework_gettickrate();
+void framework_setthreaded(int threaded);
+int  framework_isthreaded();
+int  framework_isfinished();
+float framework_advance(uint64_t dt);
 void framework_update(uint64_t dt);
-void framework_draw();
+void framework_draw(float alpha);
 
 #ifdef __cplusplus
 }
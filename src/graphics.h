@@ -4,22 +4,122 @@
 #define GRAPHICS_H
 
 #include <sys/types.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef void *Shader;
+typedef void *Mesh;
+typedef void *Material;
+typedef void *Texture;
+
+typedef enum TextureFilter {
+    TEXTURE_FILTER_NEAREST,
+    TEXTURE_FILTER_LINEAR
+} TextureFilter;
+
+typedef enum TextureWrap {
+    TEXTURE_WRAP_REPEAT,
+    TEXTURE_WRAP_CLAMP,
+    TEXTURE_WRAP_MIRROR
+} TextureWrap;
+
+/* Numbered as VkFormat, which is what KTX2 files store */
+typedef enum TextureFormat {
+    TEXTURE_FORMAT_RGBA8_UNORM        = 37,
+    TEXTURE_FORMAT_RGBA8_SRGB         = 43,
+    TEXTURE_FORMAT_BC1_RGB_UNORM      = 131,
+    TEXTURE_FORMAT_BC1_RGB_SRGB       = 132,
+    TEXTURE_FORMAT_BC1_RGBA_UNORM     = 133,
+    TEXTURE_FORMAT_BC1_RGBA_SRGB      = 134,
+    TEXTURE_FORMAT_BC2_UNORM          = 135,
+    TEXTURE_FORMAT_BC2_SRGB           = 136,
+    TEXTURE_FORMAT_BC3_UNORM          = 137,
+    TEXTURE_FORMAT_BC3_SRGB           = 138,
+    TEXTURE_FORMAT_BC4_UNORM          = 139,
+    TEXTURE_FORMAT_BC4_SNORM          = 140,
+    TEXTURE_FORMAT_BC5_UNORM          = 141,
+    TEXTURE_FORMAT_BC5_SNORM          = 142,
+    TEXTURE_FORMAT_BC6H_UFLOAT        = 143,
+    TEXTURE_FORMAT_BC6H_SFLOAT        = 144,
+    TEXTURE_FORMAT_BC7_UNORM          = 145,
+    TEXTURE_FORMAT_BC7_SRGB           = 146,
+    TEXTURE_FORMAT_ETC2_RGB8_UNORM    = 147,
+    TEXTURE_FORMAT_ETC2_RGB8_SRGB     = 148,
+    TEXTURE_FORMAT_ETC2_RGB8A1_UNORM  = 149,
+    TEXTURE_FORMAT_ETC2_RGB8A1_SRGB   = 150,
+    TEXTURE_FORMAT_ETC2_RGBA8_UNORM   = 151,
+    TEXTURE_FORMAT_ETC2_RGBA8_SRGB    = 152,
+    TEXTURE_FORMAT_EAC_R11_UNORM      = 153,
+    TEXTURE_FORMAT_EAC_R11_SNORM      = 154,
+    TEXTURE_FORMAT_EAC_RG11_UNORM     = 155,
+    TEXTURE_FORMAT_EAC_RG11_SNORM     = 156,
+    /* Every ASTC LDR footprint lies in between, UNORM then SRGB, 4x4 up to 12x12 */
+    TEXTURE_FORMAT_ASTC_4x4_UNORM     = 157,
+    TEXTURE_FORMAT_ASTC_12x12_SRGB    = 184
+} TextureFormat;
+
+typedef enum PresentMode {
+    PRESENT_MODE_FIFO,           /* waits for vblank, always supported */
+    PRESENT_MODE_MAILBOX,        /* waits for vblank, newest frame replaces a queued one */
+    PRESENT_MODE_IMMEDIATE,      /* does not wait, may tear */
+    PRESENT_MODE_FIFO_RELAXED    /* waits for vblank unless the frame is late */
+} PresentMode;
+
+typedef struct GraphicsVertex {
+    float position[3];
+    float texcoord[2];
+    float color[4];
+} GraphicsVertex;
+
+typedef struct GraphicsStats {
+    uint32_t surfacequeries;
+    uint32_t pipelinehits;
+    uint32_t pipelinemisses;
+    uint32_t bytesuploaded;
+    uint32_t drawcalls;
+    uint32_t instances;
+    uint32_t visibleinstances;  /* kept by GPU culling, counted in headless runs only */
+    uint32_t gpumicroseconds;
+    uint32_t inputlatencymicroseconds;  /* from graphics_markinput to the frame's present */
+} GraphicsStats;
 
 void   graphics_init();
 Shader graphics_createshader(const char *shader, size_t size);
+Shader graphics_loadshader(const char *pathname);
 void   graphics_destroyshader(Shader shader);
 int    graphics_isminimized();
+void   graphics_minimize();
+void   graphics_restore();
 void   graphics_predraw();
 void   graphics_postdraw();
 void   graphics_present();
 void   graphics_resize();
+void   graphics_getstats(GraphicsStats *stats);
+int    graphics_saveprofile(const char *pathname);
+void   graphics_setframesinflight(int count);
+void   graphics_setpresentmode(PresentMode mode);
+void   graphics_setlowlatency(int enabled);
+void   graphics_markinput();
 void   graphics_setshader(Shader vertShader, Shader fragShader);
+Mesh   graphics_createmesh(const GraphicsVertex *vertices, uint32_t vertexcount, const uint32_t *indices, uint32_t indexcount);
+void   graphics_destroymesh(Mesh mesh);
+Material graphics_creatematerial(Shader vertShader, Shader fragShader, const float color[4]);
+void   graphics_destroymaterial(Material material);
+void   graphics_setmaterialtexture(Material material, Texture texture);
+Texture graphics_createtexture(const void *pixels, uint32_t width, uint32_t height, TextureFilter filter, TextureWrap wrap);
+int    graphics_istextureformatsupported(TextureFormat format);
+Texture graphics_createtexturelevels(TextureFormat format, uint32_t width, uint32_t height, const void *const *levels, const size_t *sizes, uint32_t levelcount, TextureFilter filter, TextureWrap wrap);
+void   graphics_destroytexture(Texture texture);
+void   graphics_setviewprojection(const float viewprojection[16]);
+void   graphics_setgpuculling(int enabled);
+void   graphics_setshaderhotreload(int enabled);
+void   graphics_setheadless(uint32_t width, uint32_t height, const char *outputpath);
+void   graphics_drawmesh(Mesh mesh, Material material, const float transform[16]);
+void   graphics_submitframe();
+void   graphics_drawquad(Material material, float x, float y, float width, float height);
 void   graphics_shutdown(void);
 
 #ifdef __cplusplus
@@ -1,9 +1,11 @@
 /* Copyright Planimeter. All Rights Reserved. */
 
 #include "graphics.h"
+#include "memory.h"
 #include "window.h"
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdlib.h>
 #include "SDL3/SDL.h"
 
@@ -23,6 +25,11 @@ Shader graphics_createshader(const char *shader, size_t size)
     return NULL;
 }
 
+Shader graphics_loadshader(const char *pathname)
+{
+    return NULL;
+}
+
 void graphics_destroyshader(Shader shader)
 {
 }
@@ -32,6 +39,14 @@ int graphics_isminimized()
     return 0;
 }
 
+void graphics_minimize()
+{
+}
+
+void graphics_restore()
+{
+}
+
 void graphics_predraw()
 {
     if (graphics_isminimized())
@@ -50,6 +65,8 @@ void graphics_postdraw()
 
 void graphics_present()
 {
+    memory_resetframe();
+
     if (graphics_isminimized())
     {
         return;
@@ -60,10 +77,105 @@ void graphics_resize()
 {
 }
 
+void graphics_getstats(GraphicsStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+int graphics_saveprofile(const char *pathname)
+{
+    return 0;
+}
+
+void graphics_setframesinflight(int count)
+{
+}
+
+void graphics_setpresentmode(PresentMode mode)
+{
+}
+
+void graphics_setlowlatency(int enabled)
+{
+}
+
+void graphics_markinput()
+{
+}
+
 void graphics_setshader(Shader vertShader, Shader fragShader)
 {
 }
 
+Mesh graphics_createmesh(const GraphicsVertex *vertices, uint32_t vertexcount, const uint32_t *indices, uint32_t indexcount)
+{
+    return NULL;
+}
+
+void graphics_destroymesh(Mesh mesh)
+{
+}
+
+Material graphics_creatematerial(Shader vertShader, Shader fragShader, const float color[4])
+{
+    return NULL;
+}
+
+void graphics_destroymaterial(Material material)
+{
+}
+
+void graphics_setmaterialtexture(Material material, Texture texture)
+{
+}
+
+Texture graphics_createtexture(const void *pixels, uint32_t width, uint32_t height, TextureFilter filter, TextureWrap wrap)
+{
+    return NULL;
+}
+
+int graphics_istextureformatsupported(TextureFormat format)
+{
+    return 0;
+}
+
+Texture graphics_createtexturelevels(TextureFormat format, uint32_t width, uint32_t height, const void *const *levels, const size_t *sizes, uint32_t levelcount, TextureFilter filter, TextureWrap wrap)
+{
+    return NULL;
+}
+
+void graphics_destroytexture(Texture texture)
+{
+}
+
+void graphics_setviewprojection(const float viewprojection[16])
+{
+}
+
+void graphics_setgpuculling(int enabled)
+{
+}
+
+void graphics_setshaderhotreload(int enabled)
+{
+}
+
+void graphics_setheadless(uint32_t width, uint32_t height, const char *outputpath)
+{
+}
+
+void graphics_drawmesh(Mesh mesh, Material material, const float transform[16])
+{
+}
+
+void graphics_submitframe()
+{
+}
+
+void graphics_drawquad(Material material, float x, float y, float width, float height)
+{
+}
+
 void graphics_shutdown(void)
 {
 }
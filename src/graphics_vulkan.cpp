@@ -3,6 +3,11 @@
 #include "framework.h"
 #include "filesystem.h"
 #include "graphics.h"
+#include "job.h"
+#include "memory.h"
+#include "spirv.h"
+#include "timer.h"
+#include "watch.h"
 #include "window.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,13 +28,68 @@
     #endif
 #endif
 
+#if defined(VK_USE_PLATFORM_ANDROID_KHR)
+    #define SURFACE_EXTENSION_NAME "VK_KHR_android_surface"
+#elif defined(VK_USE_PLATFORM_METAL_EXT)
+    #define SURFACE_EXTENSION_NAME "VK_EXT_metal_surface"
+#elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
+    #define SURFACE_EXTENSION_NAME "VK_KHR_wayland_surface"
+#elif defined(VK_USE_PLATFORM_WIN32_KHR)
+    #define SURFACE_EXTENSION_NAME "VK_KHR_win32_surface"
+#elif defined(VK_USE_PLATFORM_XCB_KHR)
+    #define SURFACE_EXTENSION_NAME "VK_KHR_xcb_surface"
+#elif defined(VK_USE_PLATFORM_XLIB_KHR)
+    #define SURFACE_EXTENSION_NAME "VK_KHR_xlib_surface"
+#elif defined(VK_USE_PLATFORM_DISPLAY_KHR)
+    #define SURFACE_EXTENSION_NAME "VK_KHR_display"
+#endif
+/* Without one there is no window system to present to, and only headless rendering is built */
+
 #include "vk_mem_alloc.h"
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 /* Constants */
 static const uint32_t MIN_SWAPCHAIN_IMAGES = 2;
+static const uint32_t MAX_FRAMES_IN_FLIGHT = 3;
 static const float CLEAR_COLOR[4] = {0.01f, 0.01f, 0.033f, 1.0f};
+static const char *PIPELINE_CACHE_FILENAME = "pipelinecache.bin";
+static const uint32_t PIPELINE_CACHE_MAGIC = 0x43504b56; /* "VKPC" */
+static const uint32_t PIPELINE_LIBRARY_SIZE = 1024; /* must be a power of two */
+static const uint32_t MAX_SHADER_SOURCES = 64;
+static const uint32_t MAX_SHADER_MODULES = 256;
+static const uint32_t MAX_DESCRIPTOR_SETS = 4;
+static const uint32_t MAX_SET_BINDINGS = 2 * SPIRV_MAX_BINDINGS; /* one stage's worth from each of two */
+static const uint32_t LAYOUT_CACHE_SIZE = 64; /* must be a power of two */
+static const VkDeviceSize STAGING_PARTITION_SIZE = 4 * 1024 * 1024;
+static const VkDeviceSize STAGING_ALIGNMENT = 16;
+static const uint32_t MAX_STAGING_COPIES = 256;
+static const uint32_t MAX_TRANSFER_BATCHES = MAX_FRAMES_IN_FLIGHT + 2;
+static const uint32_t MIN_INSTANCE_CAPACITY = 1024;
+static const uint32_t INSTANCE_COPY_GRAIN = 4096;
+static const uint32_t MAX_RECORDING_THREADS = 16;
+static const uint32_t SECONDARY_DRAW_GRAIN = 128; /* draw runs a secondary buffer must have to pay for itself */
+static const uint32_t MESH_VERTEX_CAPACITY = 1024 * 1024;
+static const uint32_t MESH_INDEX_CAPACITY = 4 * 1024 * 1024;
+static const uint32_t CULL_WORKGROUP_SIZE = 64; /* local_size_x in cull.comp */
+static const uint32_t MAX_PROFILE_SCOPES = 32;
+static const uint32_t RENDER_PACKET_COUNT = 3;
+static const uint32_t RENDER_PACKET_FRESH = 4;
+static const uint32_t PROFILE_HISTORY = 256;
+static const uint32_t MAX_TEXTURES = 4096;
+static const uint32_t MAX_TEXTURE_LEVELS = 16;
+static const uint32_t SAMPLER_CACHE_SIZE = 64; /* must be a power of two */
+static const VkFormat TEXTURE_FORMAT = VK_FORMAT_R8G8B8A8_SRGB;
 
 /* 4.2. Instances */
 static VkInstance instance;
@@ -37,6 +97,7 @@ static VkInstance instance;
 /* 5. Devices and Queues */
 static VkPhysicalDevice *physicalDevices;
 static uint32_t graphicsQueueFamily;
+static uint32_t transferQueueFamily;
 
 /* 5.2.1. Device Creation */
 static VkDevice device;
@@ -46,19 +107,136 @@ static VmaAllocator allocator;
 
 /* 5.3.2. Queue Creation */
 static VkQueue queue;
-
-/* 6. Command Buffers */
-static VkCommandBuffer *commandBuffers;
-
-/* 6.2. Command Pools */
-static VkCommandPool *commandPools;
-
-/* 7.3. Fences */
-static VkFence *fences;
+static VkQueue transferQueue;
+
+/* Uploads recorded for the transfer queue, handed to the graphics queue a frame later */
+typedef struct TransferBatch {
+    VkCommandPool          commandPool;
+    VkCommandBuffer        commandBuffer;
+    VkSemaphore            semaphore;
+    uint64_t               serial;
+    uint32_t               count;
+    uint32_t               capacity;
+    VkBuffer              *stagingBuffers;
+    VmaAllocation         *stagingAllocations;
+    VkBufferMemoryBarrier *barriers;
+    bool                   inUse;
+} TransferBatch;
+
+static TransferBatch transferBatches[MAX_TRANSFER_BATCHES];
+static TransferBatch *recordingBatch;
+static TransferBatch *submittedBatch;
+static uint64_t transferSerial;
+static uint64_t completedTransferSerial;
+
+/* An upload that overflowed the staging ring, copied from a buffer of its own */
+typedef struct StagingUpload {
+    VkBuffer      buffer;
+    VmaAllocation allocation;
+    VkBuffer      target;
+    VkBufferCopy  copy;
+} StagingUpload;
+
+/* Frames in flight */
+typedef struct Frame {
+    /* 6. Command Buffers */
+    VkCommandBuffer commandBuffer;
+
+    /* 6.2. Command Pools */
+    VkCommandPool   commandPool;
+
+    /* A pool per recording thread, each with a secondary buffer for its share of the main pass */
+    VkCommandPool   secondaryPools[MAX_RECORDING_THREADS];
+    VkCommandBuffer secondaryBuffers[MAX_RECORDING_THREADS];
+
+    /* 7.3. Fences */
+    VkFence         fence;
+
+    /* 7.4. Semaphores */
+    VkSemaphore     acquireSemaphore;
+
+    /* Staging ring partition and the copies recorded into it */
+    VkDeviceSize    stagingOffset;
+    VkDeviceSize    stagingHead;
+    uint32_t        stagingCopyCount;
+    VkBuffer        stagingTargets[MAX_STAGING_COPIES];
+    VkBufferCopy    stagingCopies[MAX_STAGING_COPIES];
+
+    /* Overflow from the ring, recorded in order after its copies; the ring stays closed until the frame completes */
+    StagingUpload  *stagingUploads;
+    uint32_t        stagingUploadCount;
+    uint32_t        stagingUploadCapacity;
+
+    /* Transfer batch acquired by this frame, released when its fence signals */
+    TransferBatch  *transferBatch;
+
+    /* Per-instance data for this frame's batched draws, grown on demand */
+    VkBuffer        instanceBuffer;
+    VmaAllocation   instanceAllocation;
+    struct InstanceData *instanceData;
+    uint32_t        instanceCapacity;
+
+    /* Inputs and outputs of the cull pass, sized with the instance buffer */
+    VkBuffer        drawRecordBuffer;
+    VmaAllocation   drawRecordAllocation;
+    struct DrawRecord *drawRecordData;
+    VkBuffer        indirectBuffer;
+    VmaAllocation   indirectAllocation;
+    VkBuffer        countBuffer;
+    VmaAllocation   countAllocation;
+    VkDescriptorSet cullDescriptorSet;
+
+    /* Headless runs copy the cull results back, to count the instances that survived */
+    VkBuffer        cullReadbackBuffer;
+    VmaAllocation   cullReadbackAllocation;
+    const uint8_t  *cullReadbackData;
+    uint32_t        cullReadbackCount;
+    bool            cullReadbackCompact;
+
+    /* Meshes destroyed while this frame could still reference them */
+    struct GraphicsMesh *destroyedMeshes;
+
+    /* Textures destroyed while this frame could still sample them */
+    struct GraphicsTexture *destroyedTextures;
+
+    /* Staging buffers of the textures this frame uploaded */
+    VkBuffer       *textureStagingBuffers;
+    VmaAllocation  *textureStagingAllocations;
+    uint32_t        textureStagingCount;
+    uint32_t        textureStagingCapacity;
+
+    /* Pipelines replaced by a shader reload or removed with their shader while this frame could still bind them */
+    VkPipeline     *retiredPipelines;
+    uint32_t        retiredPipelineCount;
+    uint32_t        retiredPipelineCapacity;
+
+    /* Timestamp pairs for the named GPU scopes recorded this frame */
+    VkQueryPool     queryPool;
+    const char     *scopeNames[MAX_PROFILE_SCOPES];
+    uint32_t        scopeCount;
+    uint32_t        frameScope;
+    uint64_t        frameNumber;
+
+    /* Host-visible copy of the frame's offscreen image, written out once the fence has signaled */
+    VkBuffer        readbackBuffer;
+    VmaAllocation   readbackAllocation;
+    const uint8_t  *readbackData;
+    uint64_t        readbackFrame;
+    bool            readbackPending;
+
+    /* Set once the frame's fence has been waited on, cleared on submit */
+    bool            ready;
+} Frame;
+
+static Frame frames[MAX_FRAMES_IN_FLIGHT];
+static uint32_t framesInFlight = 2;
+static uint32_t recordingThreads = 1;
+static uint32_t pendingFramesInFlight = 2;
+static uint32_t frameIndex;
+static bool frameAcquired;
 
 /* 7.4. Semaphores */
-static VkSemaphore acquireSemaphore;
-static VkSemaphore releaseSemaphore;
+static VkSemaphore *releaseSemaphores;
 
 /* 8. Render Pass */
 static VkRenderPass renderPass;
@@ -70,21 +248,345 @@ static VkFramebuffer *framebuffers;
 static Shader vertShader;
 static Shader fragShader;
 
+/*
+ * A shader loaded from a file. The module it was first created with keeps
+ * keying the pipeline library; module is the newest build of the file.
+ */
+typedef struct ShaderSource {
+    char           pathname[256];
+    VkShaderModule shader;
+    VkShaderModule module;
+} ShaderSource;
+
+static ShaderSource shaderSources[MAX_SHADER_SOURCES];
+static bool shaderHotReload;
+static bool shaderWatching;
+
+/* The interface of every live module, reflected when it was created */
+typedef struct ShaderModuleInfo {
+    VkShaderModule  module;
+    SpirvReflection reflection;
+} ShaderModuleInfo;
+
+static ShaderModuleInfo shaderModules[MAX_SHADER_MODULES];
+
 /* 10. Pipelines */
-static VkPipelineLayout pipelineLayout;
-static VkPipeline graphicsPipeline;
+enum VertexLayout {
+    VERTEX_LAYOUT_BATCH
+};
+
+/* Everything that distinguishes one graphics pipeline from another */
+typedef struct PipelineState {
+    VkShaderModule      vertShader;
+    VkShaderModule      fragShader;
+    uint32_t            vertexLayout;
+    VkPrimitiveTopology topology;
+    VkCullModeFlags     cullMode;
+    VkFrontFace         frontFace;
+    VkBool32            blendEnable;
+    VkRenderPass        renderPass;
+    uint32_t            subpass;
+} PipelineState;
+
+/* 14.2.1. Descriptor Set Layout, by its sorted bindings; pImmutableSamplers is always NULL */
+typedef struct DescriptorSetLayoutKey {
+    uint32_t                     bindingCount;
+    VkDescriptorSetLayoutBinding bindings[MAX_SET_BINDINGS];
+} DescriptorSetLayoutKey;
+
+typedef struct DescriptorSetLayoutEntry {
+    uint64_t               hash;
+    DescriptorSetLayoutKey key;
+    VkDescriptorSetLayout  layout;
+} DescriptorSetLayoutEntry;
+
+/* 14.2.2. Pipeline Layouts, with every stage's push constants merged into one range */
+typedef struct PipelineLayoutKey {
+    uint32_t              setLayoutCount;
+    VkDescriptorSetLayout setLayouts[MAX_DESCRIPTOR_SETS];
+    VkShaderStageFlags    pushConstantStages;
+    uint32_t              pushConstantSize;
+} PipelineLayoutKey;
+
+typedef struct PipelineLayoutEntry {
+    uint64_t          hash;
+    PipelineLayoutKey key;
+    VkPipelineLayout  layout;
+} PipelineLayoutEntry;
+
+/* Layouts derived from reflection, shared by every pipeline with the same interface */
+static DescriptorSetLayoutEntry descriptorSetLayoutCache[LAYOUT_CACHE_SIZE];
+static uint32_t descriptorSetLayoutCount;
+static PipelineLayoutEntry pipelineLayoutCache[LAYOUT_CACHE_SIZE];
+static uint32_t pipelineLayoutCount;
+static std::mutex layoutMutex;
+
+/* A removed entry keeps probes going past it until a miss claims the slot again */
+typedef enum PipelineSlot {
+    PIPELINE_SLOT_EMPTY,
+    PIPELINE_SLOT_OCCUPIED,
+    PIPELINE_SLOT_REMOVED
+} PipelineSlot;
+
+typedef struct PipelineEntry {
+    uint64_t                           hash;
+    PipelineState                      state;
+    std::atomic<VkPipeline>            pipeline;
+    std::atomic<PipelineLayoutEntry *> layout;    /* stored before pipeline */
+    PipelineSlot                       slot;
+} PipelineEntry;
+
+/* Pipeline library, an open-addressed table keyed by PipelineState */
+static PipelineEntry pipelineLibrary[PIPELINE_LIBRARY_SIZE];
+static PipelineState defaultPipelineState;
+static uint32_t defaultPipeline;
+static uint32_t currentPipeline;
+
+/* Pipeline compilation thread */
+static std::thread pipelineWorker;
+static std::mutex pipelineMutex;
+static std::condition_variable pipelineCondition;
+static std::condition_variable pipelineIdleCondition;
+static std::deque<uint32_t> pipelineQueue;
+static uint32_t pipelinePending;
+static bool pipelineWorkerStop;
+
+/* A changed shader file and the library entries built from it, recompiled together */
+typedef struct ShaderReload {
+    uint32_t        source;
+    VkShaderModule  shader;
+    VkShaderModule  module;
+    uint32_t        count;
+    uint32_t       *indices;
+    VkPipeline     *pipelines;
+    PipelineLayoutEntry **layouts;
+} ShaderReload;
+
+/* Reloads to compile, then to swap in at the next frame boundary */
+static std::deque<ShaderReload *> shaderReloadQueue;
+static std::deque<ShaderReload *> completedShaderReloads;
+static std::deque<VkShaderModule> retiredShaderModules;
+
+/* The main thread's side of the two lists above, swapped with them each frame and kept to reuse their storage */
+static std::deque<ShaderReload *> swappingShaderReloads;
+static std::deque<VkShaderModule> destroyingShaderModules;
+
+/* 10.7. Pipeline Cache */
+typedef struct PipelineCacheHeader {
+    uint32_t magic;
+    uint32_t dataSize;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+} PipelineCacheHeader;
+
+static VkPipelineCache pipelineCache;
+static size_t pipelineCacheInitialSize;
 
 /* 12.1. Buffers */
-static VkBuffer vertexBuffer;
+static VkBuffer stagingBuffer;
+static char *stagingData;
 
 /* VmaAllocation Struct */
-static VmaAllocation allocation;
+static VmaAllocation stagingAllocation;
+
+/* Batched renderer */
+/* Matches Instance in cull.comp */
+typedef struct InstanceData {
+    glm::mat4 transform;
+    glm::vec4 color;
+    /* Bounding sphere of the mesh, in model space */
+    glm::vec4 bounds;
+} InstanceData;
+
+/* Matches Draw in cull.comp */
+typedef struct DrawRecord {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t  vertexOffset;
+    uint32_t firstCommand;
+} DrawRecord;
+
+typedef struct CullPushConstants {
+    glm::vec4 planes[6];
+    uint32_t  objectCount;
+    uint32_t  compact;
+} CullPushConstants;
+
+/* Geometry is suballocated from the shared mesh arenas */
+typedef struct GraphicsMesh {
+    VmaVirtualAllocation vertexAllocation;
+    VmaVirtualAllocation indexAllocation;
+    uint32_t             vertexOffset;
+    uint32_t             firstIndex;
+    uint32_t             vertexCount;
+    uint32_t             indexCount;
+    glm::vec4            bounds;
+    uint32_t             id;
+    /* Transfer serial the mesh is drawable after; 0 when it went through the ring */
+    uint64_t             uploadSerial;
+    struct GraphicsMesh *prev;
+    struct GraphicsMesh *next;
+} GraphicsMesh;
+
+/* Sampled images, each with a descriptor set binding it to its sampler */
+typedef struct GraphicsTexture {
+    VkImage                 image;
+    VmaAllocation           allocation;
+    VkImageView             view;
+    VkDescriptorSet         descriptorSet;
+    uint32_t                width;
+    uint32_t                height;
+    uint32_t                mipLevels;
+    uint32_t                id;
+    VkFormat                format;
+    /* Levels given by the caller, waiting for the next recorded frame to copy them; blits build the rest */
+    uint32_t                uploadLevels;
+    VkBuffer                stagingBuffer;
+    VmaAllocation           stagingAllocation;
+    struct GraphicsTexture *nextUpload;
+    struct GraphicsTexture *prev;
+    struct GraphicsTexture *next;
+} GraphicsTexture;
+
+typedef struct GraphicsMaterial {
+    /* Pipeline library index, or UINT32_MAX to follow graphics_setshader */
+    uint32_t         pipeline;
+    glm::vec4        color;
+    GraphicsTexture *texture;
+    uint32_t         id;
+} GraphicsMaterial;
+
+enum DrawSpace {
+    DRAW_SPACE_WORLD,
+    DRAW_SPACE_SCREEN
+};
+
+typedef struct DrawCommand {
+    uint64_t         key;
+    uint32_t         sequence;
+    uint32_t         pipeline;
+    uint32_t         space;
+    GraphicsMesh    *mesh;
+    GraphicsTexture *texture;
+    InstanceData     instance;
+} DrawCommand;
+
+/* Everything the game thread submits for one frame; immutable once published */
+typedef struct RenderPacket {
+    DrawCommand  *drawCommands;
+    uint32_t      drawCommandCount;
+    uint32_t      drawCommandCapacity;
+    glm::mat4     viewProjection;
+    bool          gpuCulling;
+    /* When the input the packet was built from was read, or 0 if graphics_markinput was not called */
+    uint64_t      inputTime;
+    /* Meshes and textures destroyed before this packet, freed once it has been recorded */
+    GraphicsMesh    *destroyedMeshes;
+    GraphicsTexture *destroyedTextures;
+} RenderPacket;
+
+/* A run of sorted draw commands recorded as one draw call */
+typedef struct DrawRun {
+    uint32_t first;
+    uint32_t last;
+} DrawRun;
+
+/* The main pass split into runs, for recording across jobs */
+typedef struct DrawRecording {
+    RenderPacket  *packet;
+    const DrawRun *runs;
+    uint32_t       runCount;
+    uint32_t       culled;
+    uint32_t       chunkCount;
+    glm::mat4      projections[2];
+    uint32_t       drawCalls[MAX_RECORDING_THREADS];
+} DrawRecording;
+
+/* Triple-buffered handoff: the game thread owns writePacket, the render thread
+   owns drawPacket, and readyPacket holds the index of the newest published one
+   with RENDER_PACKET_FRESH set until the render thread takes it */
+static RenderPacket renderPackets[RENDER_PACKET_COUNT];
+static uint32_t writePacket = 0;
+static uint32_t drawPacket = 1;
+static std::atomic<uint32_t> readyPacket(2);
+
+/* Guards uploads, the mesh arenas and statistics shared by the game and render threads */
+static std::mutex resourceMutex;
+
+/* Meshes and materials come from pools, so steady-state creation does not touch the heap */
+static MemoryPool meshPool;
+static MemoryPool materialPool;
+static GraphicsMesh *liveMeshes;
+static GraphicsMesh *destroyedMeshes;
+static GraphicsMesh *quadMesh;
+static uint32_t nextMeshId;
+static uint32_t nextMaterialId;
+
+/* 12.5. Images */
+static MemoryPool texturePool;
+static GraphicsTexture *liveTextures;
+static GraphicsTexture *destroyedTextures;
+static GraphicsTexture *pendingTextures;
+static GraphicsTexture *whiteTexture;
+static uint32_t nextTextureId;
+
+/* Block-compressed families the device samples natively */
+static bool textureCompressionBC;
+static bool textureCompressionETC2;
+static bool textureCompressionASTC;
+
+/* 13. Samplers, cached by state since only a handful are ever distinct */
+typedef struct SamplerState {
+    VkFilter             filter;
+    VkSamplerMipmapMode  mipmapMode;
+    VkSamplerAddressMode addressMode;
+    float                maxAnisotropy;
+} SamplerState;
+
+typedef struct SamplerEntry {
+    uint64_t     hash;
+    SamplerState state;
+    VkSampler    sampler;
+} SamplerEntry;
+
+static SamplerEntry samplerCache[SAMPLER_CACHE_SIZE];
+static uint32_t samplerCount;
+static float maxSamplerAnisotropy = 1.0f;
+
+/* 14. Resource Descriptors */
+static VkDescriptorSetLayout textureDescriptorSetLayout;
+static VkDescriptorPool textureDescriptorPool;
+static glm::mat4 viewProjection(1.0f);
+
+/* Shared geometry arenas, suballocated with VMA virtual blocks */
+static VkBuffer meshVertexBuffer;
+static VkBuffer meshIndexBuffer;
+static VmaAllocation meshVertexAllocation;
+static VmaAllocation meshIndexAllocation;
+static VmaVirtualBlock meshVertexBlock;
+static VmaVirtualBlock meshIndexBlock;
+
+/* GPU-driven culling and indirect drawing */
+static bool gpuCullingSupported;
+static bool gpuCulling = true;
+static bool drawIndirectCountSupported;
+static uint32_t maxDrawIndirectCount;
+static Shader cullShader;
+static VkDescriptorSetLayout cullDescriptorSetLayout;
+static VkDescriptorPool cullDescriptorPool;
+static VkPipelineLayout cullPipelineLayout;
+static VkPipeline cullPipeline;
+
 
 /* 12.5. Image Views */
 static VkImageView *swapchainImageViews;
 
 /* 34.2. WSI Surface */
 static VkSurfaceKHR surface;
+static VkSurfaceCapabilitiesKHR surfaceCapabilities;
+static std::atomic<bool> minimized;
 
 /* 34.10. WSI Swapchain */
 static int w, h;
@@ -93,6 +595,41 @@ static uint32_t swapchainImageCount;
 static VkImage *swapchainImages;
 static uint32_t imageIndex;
 static VkSurfaceFormatKHR swapchainSurfaceFormat = {VK_FORMAT_UNDEFINED, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+static std::atomic<bool> swapchainOutOfDate;
+static VkPresentModeKHR swapchainPresentMode;
+
+/* Requested by the game, applied when the swapchain is next created */
+static std::atomic<PresentMode> presentMode(PRESENT_MODE_IMMEDIATE);
+static std::atomic<bool> lowLatency;
+
+/* Input time of the packet recorded into the frame about to be presented */
+static uint64_t presentInputTime;
+
+/* Offscreen images standing in for the swapchain when there is no window */
+static bool headless;
+static uint32_t headlessWidth;
+static uint32_t headlessHeight;
+static char headlessOutput[256];
+static VmaAllocation *offscreenAllocations;
+
+/* Statistics */
+static GraphicsStats frameStats;
+static GraphicsStats lastFrameStats;
+
+/* GPU profiler, results arrive framesInFlight frames after recording */
+typedef struct ProfileFrame {
+    uint64_t    frame;
+    uint32_t    scopeCount;
+    const char *names[MAX_PROFILE_SCOPES];
+    double      milliseconds[MAX_PROFILE_SCOPES];
+} ProfileFrame;
+
+static ProfileFrame profileHistory[PROFILE_HISTORY];
+static uint32_t profileHead;
+static uint32_t profileCount;
+static float timestampPeriod;
+static uint64_t timestampMask;
+static uint64_t frameCounter;
 
 /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap4.html#initialization-instances */
 static void graphics_createinstance()
@@ -110,7 +647,7 @@ static void graphics_createinstance()
     vkEnumerateInstanceLayerProperties(&layerCount, NULL);
     
     if (layerCount > 0) {
-        VkLayerProperties* availableLayers = (VkLayerProperties*)malloc(layerCount * sizeof(VkLayerProperties));
+        VkLayerProperties* availableLayers = (VkLayerProperties*)memory_framealloc(layerCount * sizeof(VkLayerProperties));
         if (availableLayers) {
             vkEnumerateInstanceLayerProperties(&layerCount, availableLayers);
             
@@ -130,8 +667,6 @@ static void graphics_createinstance()
                 printf("Validation layer not available\n");
             }
             
-            free(availableLayers);
-            availableLayers = NULL;
         }
     }
 #endif
@@ -145,7 +680,7 @@ static void graphics_createinstance()
     // Check for portability enumeration extension (required for MoltenVK).
     uint32_t extensionCount = 0;
     vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, NULL);
-    VkExtensionProperties* availableExtensions = (VkExtensionProperties*)malloc(extensionCount * sizeof(VkExtensionProperties));
+    VkExtensionProperties* availableExtensions = (VkExtensionProperties*)memory_framealloc(extensionCount * sizeof(VkExtensionProperties));
     if (!availableExtensions) {
         fprintf(stderr, "Failed to allocate memory for extension properties\n");
         exit(EXIT_FAILURE);
@@ -159,42 +694,24 @@ static void graphics_createinstance()
             break;
         }
     }
-    free(availableExtensions);
-    availableExtensions = NULL;
     
     // Set up extensions list
-    uint32_t enabledExtensionCount = 2;
-    const char* enabledExtensions[3] = { "VK_KHR_surface" };
+    uint32_t enabledExtensionCount = 0;
+    const char* enabledExtensions[3];
+
+    /* Nothing is presented when headless, so an ICD without WSI will do */
+#ifdef SURFACE_EXTENSION_NAME
+    if (!headless) {
+        enabledExtensions[enabledExtensionCount++] = "VK_KHR_surface";
+        enabledExtensions[enabledExtensionCount++] = SURFACE_EXTENSION_NAME;
+    }
+#endif
     
     if (portabilityEnumerationAvailable) {
         enabledExtensions[enabledExtensionCount++] = "VK_KHR_portability_enumeration";
         createInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
     }
 
-#if defined(VK_USE_PLATFORM_ANDROID_KHR)
-    enabledExtensions[1] = "VK_KHR_android_surface";
-#elif defined(VK_USE_PLATFORM_METAL_EXT)
-    enabledExtensions[1] = "VK_EXT_metal_surface";
-#elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-    enabledExtensions[1] = "VK_KHR_wayland_surface";
-#elif defined(VK_USE_PLATFORM_WIN32_KHR)
-    enabledExtensions[1] = "VK_KHR_win32_surface";
-#elif defined(VK_USE_PLATFORM_XCB_KHR)
-    enabledExtensions[1] = "VK_KHR_xcb_surface";
-#elif defined(VK_USE_PLATFORM_XLIB_KHR)
-    enabledExtensions[1] = "VK_KHR_xlib_surface";
-#elif defined(VK_USE_PLATFORM_DISPLAY_KHR)
-    enabledExtensions[1] = "VK_KHR_display";
-#elif defined(_WIN32) || defined(WIN32)
-    // Fallback for Windows when VK_USE_PLATFORM_WIN32_KHR is not defined
-    enabledExtensions[1] = "VK_KHR_win32_surface";
-#elif defined(__APPLE__)
-    // Fallback for macOS when VK_USE_PLATFORM_METAL_EXT is not defined
-    enabledExtensions[1] = "VK_EXT_metal_surface";
-#else
-    #error Platform not supported
-#endif
-
     /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap4.html#VkApplicationInfo */
     app.apiVersion = VK_API_VERSION_1_1;
 
@@ -231,7 +748,7 @@ static void graphics_enumeratephysicaldevices()
         exit(EXIT_FAILURE);
     }
     
-    physicalDevices = (VkPhysicalDevice *)malloc(sizeof(VkPhysicalDevice) * physicalDeviceCount);
+    physicalDevices = (VkPhysicalDevice *)memory_alloc(sizeof(VkPhysicalDevice) * physicalDeviceCount, MEMORY_GRAPHICS);
     if (!physicalDevices) {
         fprintf(stderr, "Failed to allocate memory for physical devices\n");
         exit(EXIT_FAILURE);
@@ -250,7 +767,7 @@ static uint32_t graphics_findqueuefamily(VkPhysicalDevice physDevice)
         exit(EXIT_FAILURE);
     }
     
-    VkQueueFamilyProperties *queueFamilies = (VkQueueFamilyProperties*)malloc(sizeof(VkQueueFamilyProperties) * queueFamilyCount);
+    VkQueueFamilyProperties *queueFamilies = (VkQueueFamilyProperties*)memory_framealloc(sizeof(VkQueueFamilyProperties) * queueFamilyCount);
     if (!queueFamilies) {
         fprintf(stderr, "Failed to allocate memory for queue families\n");
         exit(EXIT_FAILURE);
@@ -263,8 +780,10 @@ static uint32_t graphics_findqueuefamily(VkPhysicalDevice physDevice)
         // Look for a queue family that supports graphics operations
         if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
             // Also check if it supports presentation to our surface
-            VkBool32 presentSupport = VK_FALSE;
-            vkGetPhysicalDeviceSurfaceSupportKHR(physDevice, i, surface, &presentSupport);
+            VkBool32 presentSupport = headless ? VK_TRUE : VK_FALSE;
+            if (!headless) {
+                vkGetPhysicalDeviceSurfaceSupportKHR(physDevice, i, surface, &presentSupport);
+            }
             
             if (presentSupport) {
                 selectedFamily = i;
@@ -273,8 +792,6 @@ static uint32_t graphics_findqueuefamily(VkPhysicalDevice physDevice)
         }
     }
     
-    free(queueFamilies);
-    queueFamilies = NULL;
     
     if (selectedFamily == UINT32_MAX) {
         fprintf(stderr, "Failed to find suitable queue family\n");
@@ -284,6 +801,60 @@ static uint32_t graphics_findqueuefamily(VkPhysicalDevice physDevice)
     return selectedFamily;
 }
 
+/* Find a queue family with the required capabilities and none of the excluded ones */
+static uint32_t graphics_finddedicatedqueuefamily(VkPhysicalDevice physDevice, VkQueueFlags required, VkQueueFlags excluded)
+{
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physDevice, &queueFamilyCount, NULL);
+
+    VkQueueFamilyProperties *queueFamilies = (VkQueueFamilyProperties*)memory_framealloc(sizeof(VkQueueFamilyProperties) * queueFamilyCount);
+    if (!queueFamilies) {
+        fprintf(stderr, "Failed to allocate memory for queue families\n");
+        exit(EXIT_FAILURE);
+    }
+
+    vkGetPhysicalDeviceQueueFamilyProperties(physDevice, &queueFamilyCount, queueFamilies);
+
+    uint32_t selectedFamily = UINT32_MAX;
+    for (uint32_t i = 0; i < queueFamilyCount; i++) {
+        if ((queueFamilies[i].queueFlags & required) == required &&
+            (queueFamilies[i].queueFlags & excluded) == 0) {
+            selectedFamily = i;
+            break;
+        }
+    }
+
+
+    return selectedFamily;
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap47.html#vkEnumerateDeviceExtensionProperties */
+static bool graphics_hasdeviceextension(VkPhysicalDevice physDevice, const char *name)
+{
+    uint32_t extensionCount = 0;
+    VkExtensionProperties *extensions;
+    bool found = false;
+    uint32_t i;
+
+    vkEnumerateDeviceExtensionProperties(physDevice, NULL, &extensionCount, NULL);
+
+    extensions = (VkExtensionProperties*)memory_framealloc(sizeof(VkExtensionProperties) * extensionCount);
+    if (!extensions) {
+        fprintf(stderr, "Failed to allocate memory for device extensions\n");
+        exit(EXIT_FAILURE);
+    }
+
+    vkEnumerateDeviceExtensionProperties(physDevice, NULL, &extensionCount, extensions);
+
+    for (i = 0; i < extensionCount && !found; i++)
+    {
+        found = strcmp(extensions[i].extensionName, name) == 0;
+    }
+
+
+    return found;
+}
+
 /* Choose the best available surface format */
 static VkSurfaceFormatKHR graphics_choosesurfaceformat(VkPhysicalDevice physDevice, VkSurfaceKHR surface)
 {
@@ -295,7 +866,7 @@ static VkSurfaceFormatKHR graphics_choosesurfaceformat(VkPhysicalDevice physDevi
         exit(EXIT_FAILURE);
     }
     
-    VkSurfaceFormatKHR *availableFormats = (VkSurfaceFormatKHR*)malloc(sizeof(VkSurfaceFormatKHR) * formatCount);
+    VkSurfaceFormatKHR *availableFormats = (VkSurfaceFormatKHR*)memory_framealloc(sizeof(VkSurfaceFormatKHR) * formatCount);
     if (!availableFormats) {
         fprintf(stderr, "Failed to allocate memory for surface formats\n");
         exit(EXIT_FAILURE);
@@ -310,8 +881,6 @@ static VkSurfaceFormatKHR graphics_choosesurfaceformat(VkPhysicalDevice physDevi
         if (availableFormats[i].format == preferredFormat.format && 
             availableFormats[i].colorSpace == preferredFormat.colorSpace) {
             VkSurfaceFormatKHR result = availableFormats[i];
-            free(availableFormats);
-            availableFormats = NULL;
             return result;
         }
     }
@@ -322,40 +891,180 @@ static VkSurfaceFormatKHR graphics_choosesurfaceformat(VkPhysicalDevice physDevi
         if (availableFormats[i].format == fallbackFormat.format && 
             availableFormats[i].colorSpace == fallbackFormat.colorSpace) {
             VkSurfaceFormatKHR result = availableFormats[i];
-            free(availableFormats);
-            availableFormats = NULL;
             return result;
         }
     }
     
     // Fall back to first available format
     VkSurfaceFormatKHR result = availableFormats[0];
-    free(availableFormats);
-    availableFormats = NULL;
     return result;
 }
 
+static const char *graphics_getpresentmodename(VkPresentModeKHR mode)
+{
+    switch (mode)
+    {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:    return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR:      return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR:         return "FIFO";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO relaxed";
+    default:                               return "unknown";
+    }
+}
+
+/* The requested present mode where the surface has it, or the nearest that does not wait any longer; FIFO is always supported */
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#vkGetPhysicalDeviceSurfacePresentModesKHR */
+static VkPresentModeKHR graphics_choosepresentmode(VkPhysicalDevice physDevice, VkSurfaceKHR surface, PresentMode mode)
+{
+    VkPresentModeKHR candidates[2];
+    uint32_t candidateCount = 0;
+    uint32_t modeCount = 0;
+    uint32_t i, j;
+
+    switch (mode)
+    {
+    case PRESENT_MODE_MAILBOX:
+        candidates[candidateCount++] = VK_PRESENT_MODE_MAILBOX_KHR;
+        break;
+    case PRESENT_MODE_IMMEDIATE:
+        /* Mailbox does not tear, but still never blocks on vblank */
+        candidates[candidateCount++] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+        candidates[candidateCount++] = VK_PRESENT_MODE_MAILBOX_KHR;
+        break;
+    case PRESENT_MODE_FIFO_RELAXED:
+        candidates[candidateCount++] = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+        break;
+    default:
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physDevice, surface, &modeCount, NULL);
+    VkPresentModeKHR *availableModes = (VkPresentModeKHR*)memory_framealloc(sizeof(VkPresentModeKHR) * (modeCount > 0 ? modeCount : 1));
+    if (!availableModes) {
+        fprintf(stderr, "Failed to allocate memory for present modes\n");
+        exit(EXIT_FAILURE);
+    }
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physDevice, surface, &modeCount, availableModes);
+    frameStats.surfacequeries++;
+
+    for (i = 0; i < candidateCount; i++)
+    {
+        for (j = 0; j < modeCount; j++)
+        {
+            if (availableModes[j] == candidates[i]) {
+                if (i > 0) {
+                    printf("Present mode %s is not supported, using %s\n",
+                           graphics_getpresentmodename(candidates[0]), graphics_getpresentmodename(candidates[i]));
+                }
+                return candidates[i];
+            }
+        }
+    }
+
+    printf("Present mode %s is not supported, using FIFO\n", graphics_getpresentmodename(candidates[0]));
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
 /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap5.html#devsandqueues-device-creation */
 static void graphics_createdevice()
 {
     VkDeviceCreateInfo createInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
-    VkDeviceQueueCreateInfo queueCreateInfo = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
+    VkDeviceQueueCreateInfo queueCreateInfos[2];
+    uint32_t queueCreateInfoCount = 0;
+    uint32_t families[2];
     float queuePriority = 1.0f;
-    const char *enabledExtensionNames = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+    const char *enabledExtensionNames[2] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+    uint32_t enabledExtensionCount = 1;
+    VkPhysicalDeviceFeatures supportedFeatures;
+    VkPhysicalDeviceFeatures enabledFeatures = { 0 };
+    VkPhysicalDeviceProperties properties;
+    VkQueueFamilyProperties *queueFamilies;
+    uint32_t queueFamilyCount = 0;
     VkResult result;
+    uint32_t i, j;
+
+    /* No surface, so no swapchain */
+    if (headless) {
+        enabledExtensionCount = 0;
+    }
 
     // Find suitable queue family first
     graphicsQueueFamily = graphics_findqueuefamily(physicalDevices[0]);
 
-    queueCreateInfo.queueFamilyIndex = graphicsQueueFamily;
-    queueCreateInfo.queueCount       = 1;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
+    // Prefer a transfer-only family, which runs alongside graphics
+    transferQueueFamily = graphics_finddedicatedqueuefamily(physicalDevices[0], VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+    if (transferQueueFamily == UINT32_MAX) {
+        transferQueueFamily = graphicsQueueFamily;
+    }
+
+    families[0] = graphicsQueueFamily;
+    families[1] = transferQueueFamily;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (j = 0; j < queueCreateInfoCount; j++)
+        {
+            if (queueCreateInfos[j].queueFamilyIndex == families[i]) {
+                break;
+            }
+        }
+        if (j < queueCreateInfoCount) {
+            continue;
+        }
+
+        VkDeviceQueueCreateInfo queueCreateInfo = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
+        queueCreateInfo.queueFamilyIndex = families[i];
+        queueCreateInfo.queueCount       = 1;
+        queueCreateInfo.pQueuePriorities = &queuePriority;
+        queueCreateInfos[queueCreateInfoCount++] = queueCreateInfo;
+    }
+
+    /* GPU culling dispatches on the graphics queue and draws with multi-draw indirect */
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevices[0], &queueFamilyCount, NULL);
+    queueFamilies = (VkQueueFamilyProperties*)memory_framealloc(sizeof(VkQueueFamilyProperties) * queueFamilyCount);
+    if (!queueFamilies) {
+        fprintf(stderr, "Failed to allocate memory for queue families\n");
+        exit(EXIT_FAILURE);
+    }
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevices[0], &queueFamilyCount, queueFamilies);
+
+    vkGetPhysicalDeviceFeatures(physicalDevices[0], &supportedFeatures);
+    vkGetPhysicalDeviceProperties(physicalDevices[0], &properties);
+
+    gpuCullingSupported = (queueFamilies[graphicsQueueFamily].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+                          supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance;
+    if (gpuCullingSupported) {
+        enabledFeatures.multiDrawIndirect         = VK_TRUE;
+        enabledFeatures.drawIndirectFirstInstance = VK_TRUE;
+        maxDrawIndirectCount = properties.limits.maxDrawIndirectCount;
+
+        /* Lets the cull pass compact visible draws and skip the rest entirely */
+        drawIndirectCountSupported = graphics_hasdeviceextension(physicalDevices[0], VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        if (drawIndirectCountSupported) {
+            enabledExtensionNames[enabledExtensionCount++] = VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+        }
+    }
+
+    /* Linear-filtered textures are sampled anisotropically where the device allows */
+    if (supportedFeatures.samplerAnisotropy) {
+        enabledFeatures.samplerAnisotropy = VK_TRUE;
+        maxSamplerAnisotropy = properties.limits.maxSamplerAnisotropy < 16.0f ? properties.limits.maxSamplerAnisotropy : 16.0f;
+    }
+
+    /* Compressed textures upload as-is where the device can sample them, and are transcoded where not */
+    textureCompressionBC   = supportedFeatures.textureCompressionBC == VK_TRUE;
+    textureCompressionETC2 = supportedFeatures.textureCompressionETC2 == VK_TRUE;
+    textureCompressionASTC = supportedFeatures.textureCompressionASTC_LDR == VK_TRUE;
+    enabledFeatures.textureCompressionBC       = supportedFeatures.textureCompressionBC;
+    enabledFeatures.textureCompressionETC2     = supportedFeatures.textureCompressionETC2;
+    enabledFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
 
     /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap5.html#VkDeviceCreateInfo */
-    createInfo.queueCreateInfoCount    = 1;
-    createInfo.pQueueCreateInfos       = &queueCreateInfo;
-    createInfo.enabledExtensionCount   = 1;
-    createInfo.ppEnabledExtensionNames = &enabledExtensionNames;
+    createInfo.queueCreateInfoCount    = queueCreateInfoCount;
+    createInfo.pQueueCreateInfos       = queueCreateInfos;
+    createInfo.enabledExtensionCount   = enabledExtensionCount;
+    createInfo.ppEnabledExtensionNames = enabledExtensionNames;
+    createInfo.pEnabledFeatures        = &enabledFeatures;
 
     /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap5.html#vkCreateDevice */
     result = vkCreateDevice(physicalDevices[0], &createInfo, NULL, &device);
@@ -432,43 +1141,43 @@ static void graphics_createallocator()
 static void graphics_getqueue()
 {
     vkGetDeviceQueue(device, graphicsQueueFamily, 0, &queue);
+    vkGetDeviceQueue(device, transferQueueFamily, 0, &transferQueue);
 }
 
 /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#commandbuffers-pools */
 static void graphics_createcommandpools()
 {
     VkCommandPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
-    size_t i;
+    size_t i, j;
     VkResult result;
 
-    // Validate swapchain image count before allocation
-    if (swapchainImageCount == 0 || swapchainImageCount > 16) {
-        fprintf(stderr, "Invalid swapchain image count for command pools: %u\n", swapchainImageCount);
-        exit(EXIT_FAILURE);
-    }
-
-    commandPools = (VkCommandPool *)malloc(sizeof(VkCommandPool) * swapchainImageCount);
-    if (!commandPools) {
-        fprintf(stderr, "Failed to allocate memory for command pools\n");
-        exit(EXIT_FAILURE);
-    }
-
     /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#VkCommandPoolCreateInfo */
-    createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    createInfo.flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    createInfo.queueFamilyIndex = graphicsQueueFamily;
+
+    /* Command pools are externally synchronized, so each recording thread gets its own */
+    recordingThreads = job_getworkercount();
+    if (recordingThreads < 1) {
+        recordingThreads = 1;
+    } else if (recordingThreads > MAX_RECORDING_THREADS) {
+        recordingThreads = MAX_RECORDING_THREADS;
+    }
 
-    for (i = 0; i < swapchainImageCount; i++)
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
-        result = vkCreateCommandPool(device, &createInfo, NULL, &commandPools[i]);
+        result = vkCreateCommandPool(device, &createInfo, NULL, &frames[i].commandPool);
         if (result != VK_SUCCESS) {
             fprintf(stderr, "Failed to create command pool %zu: %d\n", i, result);
-            // Clean up previously created command pools
-            for (size_t j = 0; j < i; j++) {
-                vkDestroyCommandPool(device, commandPools[j], NULL);
-            }
-            free(commandPools);
-            commandPools = NULL;
             exit(EXIT_FAILURE);
         }
+        for (j = 0; j < recordingThreads; j++)
+        {
+            result = vkCreateCommandPool(device, &createInfo, NULL, &frames[i].secondaryPools[j]);
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "Failed to create secondary command pool %zu: %d\n", i, result);
+                exit(EXIT_FAILURE);
+            }
+        }
     }
 }
 
@@ -476,40 +1185,34 @@ static void graphics_createcommandpools()
 static void graphics_allocatecommandbuffers()
 {
     VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
-    size_t i;
+    size_t i, j;
     VkResult result;
 
-    // Validate swapchain image count before allocation
-    if (swapchainImageCount == 0 || swapchainImageCount > 16) {
-        fprintf(stderr, "Invalid swapchain image count for command buffers: %u\n", swapchainImageCount);
-        exit(EXIT_FAILURE);
-    }
-
-    commandBuffers = (VkCommandBuffer *)malloc(sizeof(VkCommandBuffer) * swapchainImageCount);
-    if (!commandBuffers) {
-        fprintf(stderr, "Failed to allocate memory for command buffers\n");
-        exit(EXIT_FAILURE);
-    }
-
-    for (i = 0; i < swapchainImageCount; i++)
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
         /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#VkCommandBufferAllocateInfo */
-        allocateInfo.commandPool        = commandPools[i];
+        allocateInfo.commandPool        = frames[i].commandPool;
         allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
         allocateInfo.commandBufferCount = 1;
 
         /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#vkAllocateCommandBuffers */
-        result = vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffers[i]);
+        result = vkAllocateCommandBuffers(device, &allocateInfo, &frames[i].commandBuffer);
         if (result != VK_SUCCESS) {
             fprintf(stderr, "Failed to allocate command buffer %zu: %d\n", i, result);
-            // Clean up previously allocated command buffers
-            for (size_t j = 0; j < i; j++) {
-                vkFreeCommandBuffers(device, commandPools[j], 1, &commandBuffers[j]);
-            }
-            free(commandBuffers);
-            commandBuffers = NULL;
             exit(EXIT_FAILURE);
         }
+
+        for (j = 0; j < recordingThreads; j++)
+        {
+            allocateInfo.commandPool = frames[i].secondaryPools[j];
+            allocateInfo.level       = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+
+            result = vkAllocateCommandBuffers(device, &allocateInfo, &frames[i].secondaryBuffers[j]);
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "Failed to allocate secondary command buffer %zu: %d\n", i, result);
+                exit(EXIT_FAILURE);
+            }
+        }
     }
 }
 
@@ -520,23 +1223,20 @@ static void graphics_createfences()
     size_t i;
     VkResult result;
 
-    fences = (VkFence *)malloc(sizeof(VkFence) * swapchainImageCount);
-    if (!fences) {
-        fprintf(stderr, "Failed to allocate memory for fences\n");
-        exit(EXIT_FAILURE);
-    }
-
     /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap7.html#VkFenceCreateInfo */
     createInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
     /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap7.html#vkCreateFence */
-    for (i = 0; i < swapchainImageCount; i++)
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
-        result = vkCreateFence(device, &createInfo, NULL, &fences[i]);
+        result = vkCreateFence(device, &createInfo, NULL, &frames[i].fence);
         if (result != VK_SUCCESS) {
             fprintf(stderr, "Failed to create fence %zu: %d\n", i, result);
             exit(EXIT_FAILURE);
         }
+
+        /* Nothing is in flight yet, so uploads made before the first frame are kept */
+        frames[i].ready = true;
     }
 }
 
@@ -544,19 +1244,42 @@ static void graphics_createfences()
 static void graphics_createsemaphores()
 {
     VkSemaphoreCreateInfo createInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    size_t i;
     VkResult result;
 
     /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap7.html#vkCreateSemaphore */
-    result = vkCreateSemaphore(device, &createInfo, NULL, &acquireSemaphore);
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create acquire semaphore: %d\n", result);
-        exit(EXIT_FAILURE);
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        result = vkCreateSemaphore(device, &createInfo, NULL, &frames[i].acquireSemaphore);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create acquire semaphore %zu: %d\n", i, result);
+            exit(EXIT_FAILURE);
+        }
     }
-    result = vkCreateSemaphore(device, &createInfo, NULL, &releaseSemaphore);
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create release semaphore: %d\n", result);
+}
+
+/* Release semaphores are owned by swapchain images, not frames: a frame's
+   fence says nothing about when the presentation engine is done waiting. */
+static void graphics_createreleasesemaphores()
+{
+    VkSemaphoreCreateInfo createInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    size_t i;
+    VkResult result;
+
+    releaseSemaphores = (VkSemaphore *)memory_alloc(sizeof(VkSemaphore) * swapchainImageCount, MEMORY_GRAPHICS);
+    if (!releaseSemaphores) {
+        fprintf(stderr, "Failed to allocate memory for release semaphores\n");
         exit(EXIT_FAILURE);
     }
+
+    for (i = 0; i < swapchainImageCount; i++)
+    {
+        result = vkCreateSemaphore(device, &createInfo, NULL, &releaseSemaphores[i]);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create release semaphore %zu: %d\n", i, result);
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
 /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap8.html#renderpass-creation */
@@ -566,7 +1289,7 @@ static void graphics_createrenderpass()
     VkAttachmentDescription attachment     = { 0 };
     VkSubpassDescription    subpass        = { 0 };
     VkAttachmentReference   colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-    VkSubpassDependency     dependency     = { 0 };
+    VkSubpassDependency     dependencies[2] = { { 0 } };
 
     attachment.format            = swapchainSurfaceFormat.format;
     attachment.samples           = VK_SAMPLE_COUNT_1_BIT;
@@ -575,25 +1298,33 @@ static void graphics_createrenderpass()
     attachment.stencilLoadOp     = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachment.stencilStoreOp    = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     attachment.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachment.finalLayout       = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachment.finalLayout       = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     subpass.pipelineBindPoint    = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments    = &colorReference;
 
-    dependency.srcSubpass        = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass        = 0;
-    dependency.srcStageMask      = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstStageMask      = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask     = 0;
-    dependency.dstAccessMask     = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[0].srcSubpass    = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass    = 0;
+    dependencies[0].srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[0].dstStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[0].srcAccessMask = 0;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+    /* Offscreen images are copied out after the pass, once the final transition is done */
+    dependencies[1].srcSubpass    = 0;
+    dependencies[1].dstSubpass    = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].dstStageMask  = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
     createInfo.attachmentCount   = 1;
     createInfo.pAttachments      = &attachment;
     createInfo.subpassCount      = 1;
     createInfo.pSubpasses        = &subpass;
-    createInfo.dependencyCount   = 1;
-    createInfo.pDependencies     = &dependency;
+    createInfo.dependencyCount   = headless ? 2 : 1;
+    createInfo.pDependencies     = dependencies;
 
     /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap8.html#vkCreateRenderPass */
     VkResult result = vkCreateRenderPass(device, &createInfo, NULL, &renderPass);
@@ -610,7 +1341,7 @@ static void graphics_createframebuffers()
     size_t i;
     VkResult result;
 
-    framebuffers = (VkFramebuffer *)malloc(sizeof(VkFramebuffer) * swapchainImageCount);
+    framebuffers = (VkFramebuffer *)memory_alloc(sizeof(VkFramebuffer) * swapchainImageCount, MEMORY_GRAPHICS);
     if (!framebuffers) {
         fprintf(stderr, "Failed to allocate memory for framebuffers\n");
         exit(EXIT_FAILURE);
@@ -635,664 +1366,4420 @@ static void graphics_createframebuffers()
     }
 }
 
-/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap9.html#shader-modules */
-static void graphics_createshaders()
+/* Copy out a module's reflected interface; false for a module this file didn't create */
+static bool graphics_getshaderreflection(VkShaderModule module, SpirvReflection *reflection)
 {
-    char   *vertBinary;
-    size_t  vertSize;
-    char   *fragBinary;
-    size_t  fragSize;
+    std::lock_guard<std::mutex> lock(layoutMutex);
+    size_t i;
 
-    vertSize   = filesystem_fileread((void **)&vertBinary, "shaders/triangle.vert.spv");
-    fragSize   = filesystem_fileread((void **)&fragBinary, "shaders/triangle.frag.spv");
-    vertShader = graphics_createshader(vertBinary, vertSize);
-    fragShader = graphics_createshader(fragBinary, fragSize);
-    free(fragBinary);
-    fragBinary = NULL;
-    free(vertBinary);
-    vertBinary = NULL;
+    for (i = 0; i < MAX_SHADER_MODULES; i++)
+    {
+        if (module != VK_NULL_HANDLE && shaderModules[i].module == module) {
+            *reflection = shaderModules[i].reflection;
+            return true;
+        }
+    }
+    return false;
 }
 
-typedef struct Vertex {
-    glm::vec2 position;
-    glm::vec3 color;
-} Vertex;
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap9.html#shader-modules */
+static VkShaderModule graphics_createshadermodule(const char *code, size_t size)
+{
+    VkShaderModule shaderModule;
+    VkShaderModuleCreateInfo createInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+    SpirvReflection reflection;
+    size_t i;
+
+    /* A half-written file is rejected here rather than by the driver */
+    if (!spirv_reflect(&reflection, code, size)) {
+        fprintf(stderr, "Failed to create shader module: can't reflect SPIR-V\n");
+        return VK_NULL_HANDLE;
+    }
 
-static VkVertexInputBindingDescription graphics_getvertexbindingdescription() {
-    VkVertexInputBindingDescription bindingDescription = {};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    return bindingDescription;
-}
+    createInfo.codeSize = size;
+    createInfo.pCode    = (const uint32_t *)code;
 
-static void graphics_getvertexattributedescriptions(VkVertexInputAttributeDescription* attributeDescriptions) {
-    // Position attribute
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, position);
-    
-    // Color attribute
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, color);
+    VkResult result = vkCreateShaderModule(device, &createInfo, NULL, &shaderModule);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create shader module: %d\n", result);
+        return VK_NULL_HANDLE;
+    }
+
+    std::lock_guard<std::mutex> lock(layoutMutex);
+    for (i = 0; i < MAX_SHADER_MODULES; i++)
+    {
+        if (shaderModules[i].module == VK_NULL_HANDLE) {
+            shaderModules[i].module     = shaderModule;
+            shaderModules[i].reflection = reflection;
+            return shaderModule;
+        }
+    }
+
+    fprintf(stderr, "Failed to create shader module: too many shader modules\n");
+    vkDestroyShaderModule(device, shaderModule, NULL);
+    return VK_NULL_HANDLE;
 }
 
-/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html#pipelines-graphics */
-static void graphics_creategraphicspipeline()
+static void graphics_destroyshadermodule(VkShaderModule module)
 {
-    VkGraphicsPipelineCreateInfo                  createInfo               = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
-    VkPipelineShaderStageCreateInfo               vertShaderStage          = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
-    VkPipelineShaderStageCreateInfo               fragShaderStage          = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
-    VkPipelineShaderStageCreateInfo               stages[2];
-    VkPipelineVertexInputStateCreateInfo          vertexInput              = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
-    VkPipelineInputAssemblyStateCreateInfo        inputAssembly            = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
-    VkPipelineViewportStateCreateInfo             viewport                 = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
-    VkPipelineRasterizationStateCreateInfo        rasterization            = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
-    VkPipelineMultisampleStateCreateInfo          multisample              = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
-    VkPipelineColorBlendStateCreateInfo           colorBlend               = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
-    VkPipelineColorBlendAttachmentState           colorBlendAttachment     = { 0 };
-    VkPipelineDynamicStateCreateInfo              dynamicState             = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
-    const VkDynamicState                          states[]                 = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
-    VkPipelineLayoutCreateInfo                    pipelineLayoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    std::lock_guard<std::mutex> lock(layoutMutex);
+    size_t i;
 
-    // Vertex input setup
-    VkVertexInputBindingDescription bindingDescription = graphics_getvertexbindingdescription();
-    VkVertexInputAttributeDescription attributeDescriptions[2];
-    graphics_getvertexattributedescriptions(attributeDescriptions);
+    for (i = 0; i < MAX_SHADER_MODULES; i++)
+    {
+        if (shaderModules[i].module == module) {
+            shaderModules[i].module = VK_NULL_HANDLE;
+            break;
+        }
+    }
+    vkDestroyShaderModule(device, module, NULL);
+}
 
-    vertShaderStage.stage                       = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStage.module                      = (VkShaderModule)vertShader;
-    vertShaderStage.pName                       = "main";
+/* Build a module from a SPIR-V file, or VK_NULL_HANDLE */
+static VkShaderModule graphics_readshadermodule(const char *pathname)
+{
+    FileMapping binary;
+    VkShaderModule shaderModule;
 
-    fragShaderStage.stage                       = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStage.module                      = (VkShaderModule)fragShader;
-    fragShaderStage.pName                       = "main";
+    /* SPIR-V is handed to the driver straight from the page cache */
+    if (!filesystem_map(&binary, pathname)) {
+        fprintf(stderr, "Failed to read shader %s\n", pathname);
+        return VK_NULL_HANDLE;
+    }
+    shaderModule = graphics_createshadermodule((const char *)binary.ptr, binary.size);
+    filesystem_unmap(&binary);
+    return shaderModule;
+}
 
-    stages[0]                                   = vertShaderStage;
-    stages[1]                                   = fragShaderStage;
+/* The newest build of a loaded shader, or the module itself for one created from memory */
+static VkShaderModule graphics_resolveshader(VkShaderModule shader)
+{
+    std::lock_guard<std::mutex> lock(pipelineMutex);
+    size_t i;
 
-    vertexInput.vertexBindingDescriptionCount   = 1;
-    vertexInput.pVertexBindingDescriptions      = &bindingDescription;
-    vertexInput.vertexAttributeDescriptionCount = 2;
-    vertexInput.pVertexAttributeDescriptions    = attributeDescriptions;
+    for (i = 0; i < MAX_SHADER_SOURCES; i++)
+    {
+        if (shader != VK_NULL_HANDLE && shaderSources[i].shader == shader) {
+            return shaderSources[i].module;
+        }
+    }
+    return shader;
+}
 
-    inputAssembly.topology                      = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+static void graphics_createshaders()
+{
+    vertShader = graphics_loadshader("shaders/batch.vert.spv");
+    fragShader = graphics_loadshader("shaders/batch.frag.spv");
+    if (vertShader == NULL || fragShader == NULL) {
+        exit(EXIT_FAILURE);
+    }
+}
 
-    viewport.viewportCount                      = 1;
-    viewport.scissorCount                       = 1;
+/* Binding 0 steps per vertex, binding 1 per instance */
+static uint32_t graphics_getvertexbindingdescriptions(VkVertexInputBindingDescription *bindingDescriptions) {
+    bindingDescriptions[0].binding   = 0;
+    bindingDescriptions[0].stride    = sizeof(GraphicsVertex);
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-    rasterization.cullMode                      = VK_CULL_MODE_BACK_BIT;
-    rasterization.frontFace                     = VK_FRONT_FACE_CLOCKWISE;
-    rasterization.lineWidth                     = 1.0f;
+    bindingDescriptions[1].binding   = 1;
+    bindingDescriptions[1].stride    = sizeof(InstanceData);
+    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    return 2;
+}
 
-    multisample.rasterizationSamples            = VK_SAMPLE_COUNT_1_BIT;
+static uint32_t graphics_getvertexattributedescriptions(VkVertexInputAttributeDescription* attributeDescriptions) {
+    uint32_t i;
 
-    colorBlendAttachment.colorWriteMask         = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    // Position attribute
+    attributeDescriptions[0].binding  = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format   = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[0].offset   = offsetof(GraphicsVertex, position);
 
-    colorBlend.attachmentCount                  = 1;
-    colorBlend.pAttachments                     = &colorBlendAttachment;
+    // Texture coordinate attribute
+    attributeDescriptions[1].binding  = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format   = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[1].offset   = offsetof(GraphicsVertex, texcoord);
 
-    dynamicState.dynamicStateCount              = 2;
-    dynamicState.pDynamicStates                 = states;
+    // Color attribute
+    attributeDescriptions[2].binding  = 0;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format   = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescriptions[2].offset   = offsetof(GraphicsVertex, color);
 
-    VkResult result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &pipelineLayout);
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create pipeline layout: %d\n", result);
-        exit(EXIT_FAILURE);
+    // Instance transform, one column per location
+    for (i = 0; i < 4; i++)
+    {
+        attributeDescriptions[3 + i].binding  = 1;
+        attributeDescriptions[3 + i].location = 3 + i;
+        attributeDescriptions[3 + i].format   = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributeDescriptions[3 + i].offset   = offsetof(InstanceData, transform) + sizeof(glm::vec4) * i;
     }
 
-    createInfo.stageCount                       = 2;
-    createInfo.pStages                          = stages;
-    createInfo.pVertexInputState                = &vertexInput;
-    createInfo.pInputAssemblyState              = &inputAssembly;
-    createInfo.pViewportState                   = &viewport;
-    createInfo.pRasterizationState              = &rasterization;
-    createInfo.pMultisampleState                = &multisample;
-    createInfo.pColorBlendState                 = &colorBlend;
-    createInfo.pDynamicState                    = &dynamicState;
-    createInfo.layout                           = pipelineLayout;
-    createInfo.renderPass                       = renderPass;
+    // Instance color attribute
+    attributeDescriptions[7].binding  = 1;
+    attributeDescriptions[7].location = 7;
+    attributeDescriptions[7].format   = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescriptions[7].offset   = offsetof(InstanceData, color);
+    return 8;
+}
+
+/* 0 for UINT, 1 for SINT, 2 for SFLOAT: the 32-bit formats cycle through them in that order */
+static uint32_t graphics_getnumericclass(VkFormat format)
+{
+    return ((uint32_t)format - VK_FORMAT_R32_UINT) % 3;
+}
 
-    if (graphicsPipeline != VK_NULL_HANDLE)
+/*
+ * The stream attributes a vertex shader reads, found by location. The
+ * streams keep their own formats; the shader only has to agree on whether
+ * it reads floats or integers.
+ */
+static bool graphics_getvertexinput(const SpirvReflection *reflection,
+                                    VkVertexInputBindingDescription *bindingDescriptions, uint32_t *bindingCount,
+                                    VkVertexInputAttributeDescription *attributeDescriptions, uint32_t *attributeCount)
+{
+    VkVertexInputBindingDescription streamBindings[2];
+    VkVertexInputAttributeDescription streamAttributes[8];
+    uint32_t streamBindingCount   = graphics_getvertexbindingdescriptions(streamBindings);
+    uint32_t streamAttributeCount = graphics_getvertexattributedescriptions(streamAttributes);
+    bool used[2] = { false, false };
+    uint32_t i, j;
+
+    *bindingCount   = 0;
+    *attributeCount = 0;
+    for (i = 0; i < reflection->inputcount; i++)
     {
-        vkDestroyPipeline(device, graphicsPipeline, NULL);
-        graphicsPipeline = VK_NULL_HANDLE;
+        for (j = 0; j < streamAttributeCount && streamAttributes[j].location != reflection->inputs[i].location; j++)
+        {
+        }
+        if (j == streamAttributeCount ||
+            graphics_getnumericclass(streamAttributes[j].format) != graphics_getnumericclass((VkFormat)reflection->inputs[i].format)) {
+            fprintf(stderr, "Failed to create graphics pipeline: no vertex attribute matches input %u\n", reflection->inputs[i].location);
+            return false;
+        }
+        attributeDescriptions[(*attributeCount)++] = streamAttributes[j];
+        used[streamAttributes[j].binding]          = true;
     }
 
-    result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &createInfo, NULL, &graphicsPipeline);
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create graphics pipeline: %d\n", result);
-        exit(EXIT_FAILURE);
+    for (i = 0; i < streamBindingCount; i++)
+    {
+        if (used[streamBindings[i].binding]) {
+            bindingDescriptions[(*bindingCount)++] = streamBindings[i];
+        }
     }
-
-    graphics_destroyshader(vertShader);
-    graphics_destroyshader(fragShader);
-    vertShader = VK_NULL_HANDLE;
-    fragShader = VK_NULL_HANDLE;
+    return true;
 }
 
-static Vertex triangle_vertices[3] = {
-    { glm::vec2( 0.0f, -0.5f), glm::vec3(1.0f, 0.0f, 0.0f) },
-    { glm::vec2( 0.5f,  0.5f), glm::vec3(0.0f, 1.0f, 0.0f) },
-    { glm::vec2(-0.5f,  0.5f), glm::vec3(0.0f, 0.0f, 1.0f) }
-};
-
-/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html#resources-buffers */
-static void graphics_createvertexbuffer()
+/* Fill in the header that identifies which device and driver produced a cache */
+static void graphics_getpipelinecacheheader(PipelineCacheHeader *header, size_t dataSize)
 {
-    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
-    VmaAllocationCreateInfo allocInfo = { 0 };
-    void *mappedData;
+    VkPhysicalDeviceProperties properties;
 
-    bufferInfo.size        = sizeof(triangle_vertices);
-    bufferInfo.usage       = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    vkGetPhysicalDeviceProperties(physicalDevices[0], &properties);
 
-    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
-    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+    memset(header, 0, sizeof(*header));
+    header->magic         = PIPELINE_CACHE_MAGIC;
+    header->dataSize      = (uint32_t)dataSize;
+    header->vendorID      = properties.vendorID;
+    header->deviceID      = properties.deviceID;
+    header->driverVersion = properties.driverVersion;
+    memcpy(header->pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+}
 
-    VkResult result = vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &vertexBuffer, &allocation, NULL);
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create vertex buffer: %d\n", result);
-        exit(EXIT_FAILURE);
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html#pipelines-cache */
+static void graphics_createpipelinecache()
+{
+    VkPipelineCacheCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+    PipelineCacheHeader expected;
+    PipelineCacheHeader *header;
+    char *data = NULL;
+    size_t size = 0;
+
+    if (filesystem_exists(PIPELINE_CACHE_FILENAME)) {
+        size = filesystem_fileread((void **)&data, PIPELINE_CACHE_FILENAME);
+    }
+
+    /* Discard caches written by a different device, driver or engine build */
+    if (size >= sizeof(PipelineCacheHeader)) {
+        header = (PipelineCacheHeader *)data;
+        graphics_getpipelinecacheheader(&expected, size - sizeof(PipelineCacheHeader));
+        if (memcmp(header, &expected, sizeof(PipelineCacheHeader)) == 0) {
+            pipelineCacheInitialSize   = header->dataSize;
+            createInfo.initialDataSize = header->dataSize;
+            createInfo.pInitialData    = data + sizeof(PipelineCacheHeader);
+        } else {
+            printf("Pipeline cache is stale, rebuilding\n");
+        }
     }
 
-    result = vmaMapMemory(allocator, allocation, &mappedData);
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html#vkCreatePipelineCache */
+    VkResult result = vkCreatePipelineCache(device, &createInfo, NULL, &pipelineCache);
+    if (result != VK_SUCCESS && createInfo.initialDataSize > 0) {
+        /* The driver rejected the blob; start from an empty cache */
+        pipelineCacheInitialSize   = 0;
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData    = NULL;
+        result = vkCreatePipelineCache(device, &createInfo, NULL, &pipelineCache);
+    }
     if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to map vertex buffer memory: %d\n", result);
+        fprintf(stderr, "Failed to create pipeline cache: %d\n", result);
         exit(EXIT_FAILURE);
     }
-    memcpy(mappedData, triangle_vertices, sizeof(triangle_vertices));
-    vmaUnmapMemory(allocator, allocation);
-}
 
-/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#_wsi_surface */
-static void graphics_createsurface()
-{
-    window_vulkan_createsurface(instance, &surface);
+    memory_free(data, MEMORY_FILESYSTEM);
+    data = NULL;
 }
 
-static void graphics_destroyframebuffers();
-static void graphics_destroyimageviews();
-static void graphics_destroyfences();
-static void graphics_freecommandbuffers();
-static void graphics_destroycommandpools();
-static void graphics_destroysemaphores();
-static VkVertexInputBindingDescription graphics_getvertexbindingdescription();
-static void graphics_getvertexattributedescriptions(VkVertexInputAttributeDescription* attributeDescriptions);
-
-/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#_wsi_swapchain */
-static void graphics_createswapchain()
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html#vkGetPipelineCacheData */
+static void graphics_savepipelinecache()
 {
-    VkSwapchainCreateInfoKHR createInfo = { VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
-    VkExtent2D imageExtent;
-    VkSwapchainKHR oldSwapchain;
+    PipelineCacheHeader *header;
+    char *data;
+    size_t size;
 
-    window_getwindowsizeinpixels(&w, &h);
+    if (vkGetPipelineCacheData(device, pipelineCache, &size, NULL) != VK_SUCCESS || size == 0) {
+        return;
+    }
 
-    // Select surface format if not already done
-    if (swapchainSurfaceFormat.format == VK_FORMAT_UNDEFINED) {
-        swapchainSurfaceFormat = graphics_choosesurfaceformat(physicalDevices[0], surface);
+    data = (char *)memory_alloc(sizeof(PipelineCacheHeader) + size, MEMORY_GRAPHICS);
+    if (!data) {
+        fprintf(stderr, "Failed to allocate memory for pipeline cache data\n");
+        return;
     }
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#VkSwapchainCreateInfoKHR */
-    imageExtent.width  = w;
-    imageExtent.height = h;
+    if (vkGetPipelineCacheData(device, pipelineCache, &size, data + sizeof(PipelineCacheHeader)) == VK_SUCCESS) {
+        header = (PipelineCacheHeader *)data;
+        graphics_getpipelinecacheheader(header, size);
+        filesystem_filewrite(data, sizeof(PipelineCacheHeader) + size, PIPELINE_CACHE_FILENAME);
+    }
 
-    oldSwapchain = swapchain;
+    memory_free(data, MEMORY_GRAPHICS);
+    data = NULL;
+}
 
-    createInfo.surface          = surface;
-    createInfo.minImageCount    = MIN_SWAPCHAIN_IMAGES;
-    createInfo.imageFormat      = swapchainSurfaceFormat.format;
-    createInfo.imageColorSpace  = swapchainSurfaceFormat.colorSpace;
-    createInfo.imageExtent      = imageExtent;
-    createInfo.imageArrayLayers = 1;
-    createInfo.imageUsage       = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    createInfo.preTransform     = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
-    createInfo.compositeAlpha   = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-    createInfo.presentMode      = VK_PRESENT_MODE_IMMEDIATE_KHR;
-    createInfo.clipped          = VK_TRUE;
-    createInfo.oldSwapchain     = oldSwapchain;
+/* FNV-1a; keys are always zero-initialized */
+static uint64_t graphics_hashlayoutkey(const void *key, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#vkCreateSwapchainKHR */
-    VkResult result = vkCreateSwapchainKHR(device, &createInfo, NULL, &swapchain);
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create swapchain: %d\n", result);
-        exit(EXIT_FAILURE);
+    for (i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
     }
+    return hash;
+}
 
-    if (oldSwapchain != VK_NULL_HANDLE)
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#descriptorsets-setlayout */
+static VkDescriptorSetLayout graphics_finddescriptorsetlayout(const DescriptorSetLayoutKey *key)
+{
+    VkDescriptorSetLayoutCreateInfo createInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+    uint64_t hash = graphics_hashlayoutkey(key, sizeof(DescriptorSetLayoutKey));
+    uint32_t i;
+
+    for (i = (uint32_t)hash & (LAYOUT_CACHE_SIZE - 1); descriptorSetLayoutCache[i].layout != VK_NULL_HANDLE; i = (i + 1) & (LAYOUT_CACHE_SIZE - 1))
     {
-        graphics_destroyimageviews();
-        graphics_destroyfences();
-        graphics_freecommandbuffers();
-        graphics_destroycommandpools();
-        graphics_destroysemaphores();
+        if (descriptorSetLayoutCache[i].hash == hash && memcmp(&descriptorSetLayoutCache[i].key, key, sizeof(DescriptorSetLayoutKey)) == 0) {
+            return descriptorSetLayoutCache[i].layout;
+        }
+    }
 
-        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#vkDestroySwapchainKHR */
-        vkDestroySwapchainKHR(device, oldSwapchain, NULL);
+    /* Keep one slot empty so probing terminates */
+    if (descriptorSetLayoutCount == LAYOUT_CACHE_SIZE - 1) {
+        fprintf(stderr, "Descriptor set layout cache is full\n");
+        exit(EXIT_FAILURE);
+    }
+
+    createInfo.bindingCount = key->bindingCount;
+    createInfo.pBindings    = key->bindings;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#vkCreateDescriptorSetLayout */
+    VkResult result = vkCreateDescriptorSetLayout(device, &createInfo, NULL, &descriptorSetLayoutCache[i].layout);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create descriptor set layout: %d\n", result);
+        exit(EXIT_FAILURE);
     }
+    descriptorSetLayoutCache[i].hash = hash;
+    descriptorSetLayoutCache[i].key  = *key;
+    descriptorSetLayoutCount++;
+    return descriptorSetLayoutCache[i].layout;
 }
 
-/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#vkGetSwapchainImagesKHR */
-static void graphics_getswapchainimages()
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#descriptorsets-pipelinelayout */
+static PipelineLayoutEntry *graphics_findpipelinelayout(const PipelineLayoutKey *key)
 {
-    vkGetSwapchainImagesKHR(device, swapchain, &swapchainImageCount, NULL);
-    
-    // Validate swapchain image count
-    if (swapchainImageCount == 0) {
-        fprintf(stderr, "No swapchain images available\n");
-        exit(EXIT_FAILURE);
+    VkPipelineLayoutCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    VkPushConstantRange pushConstantRange;
+    uint64_t hash = graphics_hashlayoutkey(key, sizeof(PipelineLayoutKey));
+    uint32_t i;
+
+    for (i = (uint32_t)hash & (LAYOUT_CACHE_SIZE - 1); pipelineLayoutCache[i].layout != VK_NULL_HANDLE; i = (i + 1) & (LAYOUT_CACHE_SIZE - 1))
+    {
+        if (pipelineLayoutCache[i].hash == hash && memcmp(&pipelineLayoutCache[i].key, key, sizeof(PipelineLayoutKey)) == 0) {
+            return &pipelineLayoutCache[i];
+        }
     }
-    if (swapchainImageCount > 16) {
-        fprintf(stderr, "Too many swapchain images: %u\n", swapchainImageCount);
+
+    if (pipelineLayoutCount == LAYOUT_CACHE_SIZE - 1) {
+        fprintf(stderr, "Pipeline layout cache is full\n");
         exit(EXIT_FAILURE);
     }
-    
-    swapchainImages = (VkImage *)malloc(sizeof(VkImage) * swapchainImageCount);
-    if (!swapchainImages) {
-        fprintf(stderr, "Failed to allocate memory for swapchain images\n");
+
+    pushConstantRange.stageFlags = key->pushConstantStages;
+    pushConstantRange.offset     = 0;
+    pushConstantRange.size       = key->pushConstantSize;
+
+    createInfo.setLayoutCount         = key->setLayoutCount;
+    createInfo.pSetLayouts            = key->setLayouts;
+    createInfo.pushConstantRangeCount = key->pushConstantSize > 0 ? 1 : 0;
+    createInfo.pPushConstantRanges    = &pushConstantRange;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#vkCreatePipelineLayout */
+    VkResult result = vkCreatePipelineLayout(device, &createInfo, NULL, &pipelineLayoutCache[i].layout);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create pipeline layout: %d\n", result);
         exit(EXIT_FAILURE);
     }
-    
-    vkGetSwapchainImagesKHR(device, swapchain, &swapchainImageCount, swapchainImages);
+    pipelineLayoutCache[i].hash = hash;
+    pipelineLayoutCache[i].key  = *key;
+    pipelineLayoutCount++;
+    return &pipelineLayoutCache[i];
 }
 
-/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html#resources-image-views */
-static void graphics_createimageviews()
+/* Merge what each stage declares into one layout, or NULL if two stages disagree about a binding */
+static PipelineLayoutEntry *graphics_getpipelinelayout(const SpirvReflection *const *reflections, uint32_t stageCount)
 {
-    VkImageViewCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
-    size_t i;
-    VkResult result;
+    DescriptorSetLayoutKey setKeys[MAX_DESCRIPTOR_SETS];
+    PipelineLayoutKey key;
+    uint32_t i, j, k;
 
-    createInfo.viewType                    = VK_IMAGE_VIEW_TYPE_2D;
-    createInfo.format                      = swapchainSurfaceFormat.format;
-    createInfo.components.r                = VK_COMPONENT_SWIZZLE_IDENTITY;
-    createInfo.components.g                = VK_COMPONENT_SWIZZLE_IDENTITY;
-    createInfo.components.b                = VK_COMPONENT_SWIZZLE_IDENTITY;
-    createInfo.components.a                = VK_COMPONENT_SWIZZLE_IDENTITY;
-    createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    createInfo.subresourceRange.levelCount = 1;
-    createInfo.subresourceRange.layerCount = 1;
+    memset(setKeys, 0, sizeof(setKeys));
+    memset(&key, 0, sizeof(key));
 
-    swapchainImageViews = (VkImageView *)malloc(sizeof(VkImageView) * swapchainImageCount);
-    if (!swapchainImageViews) {
-        fprintf(stderr, "Failed to allocate memory for swapchain image views\n");
-        exit(EXIT_FAILURE);
+    for (i = 0; i < stageCount; i++)
+    {
+        if (reflections[i]->pushconstantsize > key.pushConstantSize) {
+            key.pushConstantSize = reflections[i]->pushconstantsize;
+        }
+        if (reflections[i]->pushconstantsize > 0) {
+            key.pushConstantStages |= reflections[i]->stage;
+        }
+
+        for (j = 0; j < reflections[i]->bindingcount; j++)
+        {
+            const SpirvBinding *binding = &reflections[i]->bindings[j];
+            DescriptorSetLayoutKey *setKey;
+
+            if (binding->set >= MAX_DESCRIPTOR_SETS) {
+                fprintf(stderr, "Failed to create pipeline layout: set %u is out of range\n", binding->set);
+                return NULL;
+            }
+            setKey = &setKeys[binding->set];
+
+            /* Bindings stay sorted, so identical sets hash the same */
+            for (k = 0; k < setKey->bindingCount && setKey->bindings[k].binding < binding->binding; k++)
+            {
+            }
+            if (k < setKey->bindingCount && setKey->bindings[k].binding == binding->binding) {
+                if (setKey->bindings[k].descriptorType != (VkDescriptorType)binding->descriptortype ||
+                    setKey->bindings[k].descriptorCount != binding->count) {
+                    fprintf(stderr, "Failed to create pipeline layout: stages disagree on set %u binding %u\n", binding->set, binding->binding);
+                    return NULL;
+                }
+                setKey->bindings[k].stageFlags |= reflections[i]->stage;
+                continue;
+            }
+
+            memmove(&setKey->bindings[k + 1], &setKey->bindings[k], sizeof(VkDescriptorSetLayoutBinding) * (setKey->bindingCount - k));
+            memset(&setKey->bindings[k], 0, sizeof(VkDescriptorSetLayoutBinding));
+            setKey->bindings[k].binding         = binding->binding;
+            setKey->bindings[k].descriptorType  = (VkDescriptorType)binding->descriptortype;
+            setKey->bindings[k].descriptorCount = binding->count;
+            setKey->bindings[k].stageFlags      = reflections[i]->stage;
+            setKey->bindingCount++;
+            if (binding->set >= key.setLayoutCount) {
+                key.setLayoutCount = binding->set + 1;
+            }
+        }
     }
 
-    for (i = 0; i < swapchainImageCount; i++)
+    /* Sets skipped over get an empty layout */
+    std::lock_guard<std::mutex> lock(layoutMutex);
+    for (i = 0; i < key.setLayoutCount; i++)
     {
-        createInfo.image = swapchainImages[i];
+        key.setLayouts[i] = graphics_finddescriptorsetlayout(&setKeys[i]);
+    }
+    return graphics_findpipelinelayout(&key);
+}
 
-        result = vkCreateImageView(device, &createInfo, NULL, &swapchainImageViews[i]);
-        if (result != VK_SUCCESS) {
-            fprintf(stderr, "Failed to create image view %zu: %d\n", i, result);
-            exit(EXIT_FAILURE);
+/* Materials bind their texture at set 0, binding 0, for the fragment shader to sample */
+static void graphics_createtexturesetlayout()
+{
+    DescriptorSetLayoutKey key;
+
+    memset(&key, 0, sizeof(key));
+    key.bindingCount                = 1;
+    key.bindings[0].binding         = 0;
+    key.bindings[0].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    key.bindings[0].descriptorCount = 1;
+    key.bindings[0].stageFlags      = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    std::lock_guard<std::mutex> lock(layoutMutex);
+    textureDescriptorSetLayout = graphics_finddescriptorsetlayout(&key);
+}
+
+static void graphics_destroylayouts()
+{
+    size_t i;
+
+    for (i = 0; i < LAYOUT_CACHE_SIZE; i++)
+    {
+        if (pipelineLayoutCache[i].layout != VK_NULL_HANDLE) {
+            vkDestroyPipelineLayout(device, pipelineLayoutCache[i].layout, NULL);
+        }
+    }
+    for (i = 0; i < LAYOUT_CACHE_SIZE; i++)
+    {
+        if (descriptorSetLayoutCache[i].layout != VK_NULL_HANDLE) {
+            vkDestroyDescriptorSetLayout(device, descriptorSetLayoutCache[i].layout, NULL);
         }
     }
+    memset(pipelineLayoutCache, 0, sizeof(pipelineLayoutCache));
+    memset(descriptorSetLayoutCache, 0, sizeof(descriptorSetLayoutCache));
+    pipelineLayoutCount        = 0;
+    descriptorSetLayoutCount   = 0;
+    textureDescriptorSetLayout = VK_NULL_HANDLE;
 }
 
-static void graphics_destroyframebuffers()
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html#pipelines-graphics */
+static VkPipeline graphics_creategraphicspipeline(const PipelineState *state, PipelineLayoutEntry **layout)
 {
-    size_t i;
+    VkGraphicsPipelineCreateInfo                  createInfo               = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+    VkPipelineShaderStageCreateInfo               vertShaderStage          = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+    VkPipelineShaderStageCreateInfo               fragShaderStage          = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+    VkPipelineShaderStageCreateInfo               stages[2];
+    VkPipelineVertexInputStateCreateInfo          vertexInput              = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+    VkPipelineInputAssemblyStateCreateInfo        inputAssembly            = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+    VkPipelineViewportStateCreateInfo             viewport                 = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+    VkPipelineRasterizationStateCreateInfo        rasterization            = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+    VkPipelineMultisampleStateCreateInfo          multisample              = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+    VkPipelineColorBlendStateCreateInfo           colorBlend               = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+    VkPipelineColorBlendAttachmentState           colorBlendAttachment     = { 0 };
+    VkPipelineDynamicStateCreateInfo              dynamicState             = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+    const VkDynamicState                          states[]                 = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipeline                                    pipeline                 = VK_NULL_HANDLE;
 
-    vkQueueWaitIdle(queue);
+    // Vertex input setup
+    VkVertexInputBindingDescription bindingDescriptions[2];
+    VkVertexInputAttributeDescription attributeDescriptions[8];
+    uint32_t bindingCount, attributeCount;
+    SpirvReflection reflections[2];
+    const SpirvReflection *stageReflections[2] = { &reflections[0], &reflections[1] };
 
-    if (framebuffers) {
-        for (i = swapchainImageCount; i-- > 0;)
-        {
-            vkDestroyFramebuffer(device, framebuffers[i], NULL);
-        }
-        free(framebuffers);
-        framebuffers = NULL;
+    vertShaderStage.stage                       = VK_SHADER_STAGE_VERTEX_BIT;
+    vertShaderStage.module                      = graphics_resolveshader(state->vertShader);
+    vertShaderStage.pName                       = "main";
+
+    fragShaderStage.stage                       = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragShaderStage.module                      = graphics_resolveshader(state->fragShader);
+    fragShaderStage.pName                       = "main";
+
+    /* Vertex input and layout follow from what the two stages declare */
+    *layout = NULL;
+    if (!graphics_getshaderreflection(vertShaderStage.module, &reflections[0]) ||
+        !graphics_getshaderreflection(fragShaderStage.module, &reflections[1])) {
+        fprintf(stderr, "Failed to create graphics pipeline: unknown shader module\n");
+        return VK_NULL_HANDLE;
+    }
+    if (!graphics_getvertexinput(&reflections[0], bindingDescriptions, &bindingCount, attributeDescriptions, &attributeCount)) {
+        return VK_NULL_HANDLE;
+    }
+    if ((*layout = graphics_getpipelinelayout(stageReflections, 2)) == NULL) {
+        return VK_NULL_HANDLE;
+    }
+
+    stages[0]                                   = vertShaderStage;
+    stages[1]                                   = fragShaderStage;
+
+    vertexInput.vertexBindingDescriptionCount   = bindingCount;
+    vertexInput.pVertexBindingDescriptions      = bindingDescriptions;
+    vertexInput.vertexAttributeDescriptionCount = attributeCount;
+    vertexInput.pVertexAttributeDescriptions    = attributeDescriptions;
+
+    inputAssembly.topology                      = state->topology;
+
+    viewport.viewportCount                      = 1;
+    viewport.scissorCount                       = 1;
+
+    rasterization.cullMode                      = state->cullMode;
+    rasterization.frontFace                     = state->frontFace;
+    rasterization.lineWidth                     = 1.0f;
+
+    multisample.rasterizationSamples            = VK_SAMPLE_COUNT_1_BIT;
+
+    colorBlendAttachment.blendEnable            = state->blendEnable;
+    colorBlendAttachment.srcColorBlendFactor    = VK_BLEND_FACTOR_SRC_ALPHA;
+    colorBlendAttachment.dstColorBlendFactor    = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlendAttachment.colorBlendOp           = VK_BLEND_OP_ADD;
+    colorBlendAttachment.srcAlphaBlendFactor    = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstAlphaBlendFactor    = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlendAttachment.alphaBlendOp           = VK_BLEND_OP_ADD;
+    colorBlendAttachment.colorWriteMask         = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+    colorBlend.attachmentCount                  = 1;
+    colorBlend.pAttachments                     = &colorBlendAttachment;
+
+    dynamicState.dynamicStateCount              = 2;
+    dynamicState.pDynamicStates                 = states;
+
+    createInfo.stageCount                       = 2;
+    createInfo.pStages                          = stages;
+    createInfo.pVertexInputState                = &vertexInput;
+    createInfo.pInputAssemblyState              = &inputAssembly;
+    createInfo.pViewportState                   = &viewport;
+    createInfo.pRasterizationState              = &rasterization;
+    createInfo.pMultisampleState                = &multisample;
+    createInfo.pColorBlendState                 = &colorBlend;
+    createInfo.pDynamicState                    = &dynamicState;
+    createInfo.layout                           = (*layout)->layout;
+    createInfo.renderPass                       = state->renderPass;
+    createInfo.subpass                          = state->subpass;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html#vkCreateGraphicsPipelines */
+    VkResult result = vkCreateGraphicsPipelines(device, pipelineCache, 1, &createInfo, NULL, &pipeline);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create graphics pipeline: %d\n", result);
+        return VK_NULL_HANDLE;
     }
+
+    return pipeline;
 }
 
-static void graphics_destroyimageviews()
+/* FNV-1a, continued from hash */
+static uint64_t graphics_hashbytes(uint64_t hash, const void *data, size_t size)
 {
+    const unsigned char *p = (const unsigned char *)data;
     size_t i;
 
-    if (swapchainImageViews) {
-        for (i = swapchainImageCount; i-- > 0;)
-        {
-            vkDestroyImageView(device, swapchainImageViews[i], NULL);
-        }
-        free(swapchainImageViews);
-        swapchainImageViews = NULL;
+    for (i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
     }
+    return hash;
+}
+
+/* Field by field, as struct copies need not preserve the padding between them */
+static uint64_t graphics_hashpipelinestate(const PipelineState *state)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    hash = graphics_hashbytes(hash, &state->vertShader, sizeof(state->vertShader));
+    hash = graphics_hashbytes(hash, &state->fragShader, sizeof(state->fragShader));
+    hash = graphics_hashbytes(hash, &state->vertexLayout, sizeof(state->vertexLayout));
+    hash = graphics_hashbytes(hash, &state->topology, sizeof(state->topology));
+    hash = graphics_hashbytes(hash, &state->cullMode, sizeof(state->cullMode));
+    hash = graphics_hashbytes(hash, &state->frontFace, sizeof(state->frontFace));
+    hash = graphics_hashbytes(hash, &state->blendEnable, sizeof(state->blendEnable));
+    hash = graphics_hashbytes(hash, &state->renderPass, sizeof(state->renderPass));
+    hash = graphics_hashbytes(hash, &state->subpass, sizeof(state->subpass));
+    return hash;
+}
+
+static bool graphics_equalpipelinestate(const PipelineState *a, const PipelineState *b)
+{
+    return a->vertShader == b->vertShader && a->fragShader == b->fragShader &&
+           a->vertexLayout == b->vertexLayout && a->topology == b->topology &&
+           a->cullMode == b->cullMode && a->frontFace == b->frontFace &&
+           a->blendEnable == b->blendEnable && a->renderPass == b->renderPass &&
+           a->subpass == b->subpass;
+}
+
+static void graphics_freeshaderreload(ShaderReload *reload)
+{
+    memory_free(reload->indices, MEMORY_GRAPHICS);
+    memory_free(reload->pipelines, MEMORY_GRAPHICS);
+    memory_free(reload->layouts, MEMORY_GRAPHICS);
+    memory_free(reload, MEMORY_GRAPHICS);
+}
+
+/* Destroy a reload that was never swapped in, along with everything it built */
+static void graphics_discardshaderreload(ShaderReload *reload)
+{
+    uint32_t i;
+
+    for (i = 0; i < reload->count; i++)
+    {
+        if (reload->pipelines[i] != VK_NULL_HANDLE) {
+            vkDestroyPipeline(device, reload->pipelines[i], NULL);
+        }
+    }
+    if (reload->module != VK_NULL_HANDLE) {
+        graphics_destroyshadermodule(reload->module);
+    }
+    graphics_freeshaderreload(reload);
+}
+
+/* Rebuild a changed shader and every pipeline using it; called without pipelineMutex */
+static bool graphics_compileshaderreload(ShaderReload *reload, const char *pathname)
+{
+    PipelineState state;
+    uint32_t i;
+
+    reload->module = graphics_readshadermodule(pathname);
+    if (reload->module == VK_NULL_HANDLE) {
+        return false;
+    }
+
+    /* The other stage resolves to its own newest build */
+    for (i = 0; i < reload->count; i++)
+    {
+        state = pipelineLibrary[reload->indices[i]].state;
+        if (state.vertShader == reload->shader) {
+            state.vertShader = reload->module;
+        }
+        if (state.fragShader == reload->shader) {
+            state.fragShader = reload->module;
+        }
+        reload->pipelines[i] = graphics_creategraphicspipeline(&state, &reload->layouts[i]);
+        if (reload->pipelines[i] == VK_NULL_HANDLE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Background compilation of pipeline library misses and shader reloads */
+static void graphics_pipelineworker()
+{
+    std::unique_lock<std::mutex> lock(pipelineMutex);
+
+    for (;;)
+    {
+        while (!pipelineWorkerStop && pipelineQueue.empty() && shaderReloadQueue.empty())
+        {
+            pipelineCondition.wait(lock);
+        }
+        if (pipelineQueue.empty() && shaderReloadQueue.empty())
+        {
+            return;
+        }
+
+        if (pipelineQueue.empty())
+        {
+            ShaderReload *reload = shaderReloadQueue.front();
+            ShaderSource *source = &shaderSources[reload->source];
+            char pathname[sizeof(source->pathname)];
+
+            shaderReloadQueue.pop_front();
+            memcpy(pathname, source->pathname, sizeof(pathname));
+
+            lock.unlock();
+            bool compiled = graphics_compileshaderreload(reload, pathname);
+            lock.lock();
+
+            if (compiled)
+            {
+                /* Later compiles pick the new build up at once; the pipelines wait for a frame boundary */
+                if (source->module != source->shader) {
+                    retiredShaderModules.push_back(source->module);
+                }
+                source->module = reload->module;
+                completedShaderReloads.push_back(reload);
+            }
+            else
+            {
+                fprintf(stderr, "Failed to reload %s, keeping the previous version\n", pathname);
+                graphics_discardshaderreload(reload);
+            }
+            pipelinePending--;
+            pipelineIdleCondition.notify_all();
+            continue;
+        }
+
+        uint32_t index = pipelineQueue.front();
+        pipelineQueue.pop_front();
+
+        lock.unlock();
+        PipelineLayoutEntry *layout;
+        VkPipeline pipeline = graphics_creategraphicspipeline(&pipelineLibrary[index].state, &layout);
+        lock.lock();
+
+        pipelineLibrary[index].layout.store(layout, std::memory_order_relaxed);
+        pipelineLibrary[index].pipeline.store(pipeline, std::memory_order_release);
+        pipelinePending--;
+        pipelineIdleCondition.notify_all();
+    }
+}
+
+/* Block until every queued pipeline has been compiled */
+static void graphics_waitpipelines()
+{
+    std::unique_lock<std::mutex> lock(pipelineMutex);
+
+    while (pipelinePending > 0)
+    {
+        pipelineIdleCondition.wait(lock);
+    }
+}
+
+/* Look a pipeline up by state, compiling it on a miss; called with resourceMutex held */
+static uint32_t graphics_findpipeline(const PipelineState *state, bool async)
+{
+    uint64_t hash = graphics_hashpipelinestate(state);
+    uint32_t index = (uint32_t)(hash & (PIPELINE_LIBRARY_SIZE - 1));
+    uint32_t removed = UINT32_MAX;
+    uint32_t probes;
+
+    for (probes = 0; probes < PIPELINE_LIBRARY_SIZE; probes++)
+    {
+        PipelineEntry *entry = &pipelineLibrary[index];
+
+        if (entry->slot == PIPELINE_SLOT_EMPTY)
+        {
+            break;
+        }
+        if (entry->slot == PIPELINE_SLOT_REMOVED)
+        {
+            /* The state may still be further along, so keep probing */
+            if (removed == UINT32_MAX) {
+                removed = index;
+            }
+        }
+        else if (entry->hash == hash && graphics_equalpipelinestate(&entry->state, state))
+        {
+            frameStats.pipelinehits++;
+            return index;
+        }
+        index = (index + 1) & (PIPELINE_LIBRARY_SIZE - 1);
+    }
+
+    /* Reuse the first removed slot on the way rather than lengthening the chain */
+    if (removed != UINT32_MAX) {
+        index = removed;
+    } else if (probes == PIPELINE_LIBRARY_SIZE) {
+        fprintf(stderr, "Pipeline library is full\n");
+        exit(EXIT_FAILURE);
+    }
+
+    PipelineEntry *entry = &pipelineLibrary[index];
+    entry->hash  = hash;
+    entry->state = *state;
+    entry->slot  = PIPELINE_SLOT_OCCUPIED;
+    frameStats.pipelinemisses++;
+
+    if (async)
+    {
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        pipelineQueue.push_back(index);
+        pipelinePending++;
+        pipelineCondition.notify_one();
+    }
+    else
+    {
+        PipelineLayoutEntry *layout;
+        VkPipeline pipeline = graphics_creategraphicspipeline(state, &layout);
+
+        entry->layout.store(layout, std::memory_order_relaxed);
+        entry->pipeline.store(pipeline, std::memory_order_release);
+    }
+
+    return index;
+}
+
+/* The compiled pipeline for an entry and its layout, or the fallback's while it is still compiling */
+static VkPipeline graphics_resolvepipeline(uint32_t index, PipelineLayoutEntry **layout)
+{
+    PipelineEntry *entry = &pipelineLibrary[index];
+    VkPipeline pipeline = entry->pipeline.load(std::memory_order_acquire);
+
+    if (pipeline == VK_NULL_HANDLE)
+    {
+        entry    = &pipelineLibrary[defaultPipeline];
+        pipeline = entry->pipeline.load(std::memory_order_acquire);
+    }
+    *layout = entry->layout.load(std::memory_order_relaxed);
+    return pipeline;
+}
+
+static void graphics_createpipelinelibrary()
+{
+    PipelineState state;
+
+    memset(&state, 0, sizeof(state));
+    state.vertShader   = (VkShaderModule)vertShader;
+    state.fragShader   = (VkShaderModule)fragShader;
+    state.vertexLayout = VERTEX_LAYOUT_BATCH;
+    state.topology     = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    state.cullMode     = VK_CULL_MODE_BACK_BIT;
+    state.frontFace    = VK_FRONT_FACE_CLOCKWISE;
+    state.blendEnable  = VK_FALSE;
+    state.renderPass   = renderPass;
+    state.subpass      = 0;
+
+    defaultPipelineState = state;
+
+    /* The default pipeline is the fallback for every miss, so it is compiled up front */
+    defaultPipeline = graphics_findpipeline(&state, false);
+    if (pipelineLibrary[defaultPipeline].pipeline.load() == VK_NULL_HANDLE) {
+        exit(EXIT_FAILURE);
+    }
+    currentPipeline = defaultPipeline;
+
+    pipelineWorker = std::thread(graphics_pipelineworker);
+}
+
+/* Destroy the pipelines a frame could still have bound when they were replaced */
+static void graphics_releasepipelines(Frame *frame)
+{
+    uint32_t i;
+
+    for (i = frame->retiredPipelineCount; i-- > 0;)
+    {
+        vkDestroyPipeline(device, frame->retiredPipelines[i], NULL);
+    }
+    frame->retiredPipelineCount = 0;
+}
+
+static void graphics_retirepipeline(Frame *frame, VkPipeline pipeline)
+{
+    if (frame->retiredPipelineCount == frame->retiredPipelineCapacity)
+    {
+        frame->retiredPipelineCapacity = frame->retiredPipelineCapacity ? frame->retiredPipelineCapacity * 2 : 16;
+        frame->retiredPipelines        = (VkPipeline *)memory_realloc(frame->retiredPipelines, sizeof(VkPipeline) * frame->retiredPipelineCapacity, MEMORY_GRAPHICS);
+        if (!frame->retiredPipelines) {
+            fprintf(stderr, "Failed to allocate memory for retired pipelines\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    frame->retiredPipelines[frame->retiredPipelineCount++] = pipeline;
+}
+
+/* Queue a rebuild of every library entry using a changed shader; called with resourceMutex held */
+static void graphics_queueshaderreload(uint32_t source)
+{
+    VkShaderModule shader = shaderSources[source].shader;
+    ShaderReload *reload;
+    uint32_t i, count = 0;
+
+    reload = (ShaderReload *)memory_alloc(sizeof(ShaderReload), MEMORY_GRAPHICS);
+    if (reload == NULL) {
+        fprintf(stderr, "Failed to allocate memory for shader reload\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(reload, 0, sizeof(ShaderReload));
+    reload->source    = source;
+    reload->shader    = shader;
+    reload->indices   = (uint32_t *)memory_alloc(sizeof(uint32_t) * PIPELINE_LIBRARY_SIZE, MEMORY_GRAPHICS);
+    reload->pipelines = (VkPipeline *)memory_alloc(sizeof(VkPipeline) * PIPELINE_LIBRARY_SIZE, MEMORY_GRAPHICS);
+    reload->layouts   = (PipelineLayoutEntry **)memory_alloc(sizeof(PipelineLayoutEntry *) * PIPELINE_LIBRARY_SIZE, MEMORY_GRAPHICS);
+    if (reload->indices == NULL || reload->pipelines == NULL || reload->layouts == NULL) {
+        fprintf(stderr, "Failed to allocate memory for shader reload\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Entries still queued for their first compile are included, as they compile with the old build */
+    for (i = 0; i < PIPELINE_LIBRARY_SIZE; i++)
+    {
+        if (pipelineLibrary[i].slot == PIPELINE_SLOT_OCCUPIED &&
+            (pipelineLibrary[i].state.vertShader == shader || pipelineLibrary[i].state.fragShader == shader)) {
+            reload->indices[count]   = i;
+            reload->pipelines[count] = VK_NULL_HANDLE;
+            count++;
+        }
+    }
+    reload->count = count;
+
+    shaderReloadQueue.push_back(reload);
+    pipelinePending++;
+    pipelineCondition.notify_one();
+}
+
+/*
+ * Pick up changed shader files and swap in whatever finished rebuilding
+ * since the last frame. Called at the top of a frame with resourceMutex
+ * held, so no draw is recorded with a half-swapped set of pipelines.
+ */
+static void graphics_reloadshaders(Frame *frame)
+{
+    std::deque<ShaderReload *> &completed = swappingShaderReloads;
+    std::deque<VkShaderModule> &retired   = destroyingShaderModules;
+    char pathname[256];
+    size_t j;
+    uint32_t i;
+
+    /* Reloads still in progress when hot reload was turned off are discarded at shutdown */
+    if (!shaderHotReload)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+
+        while (watch_poll(pathname, sizeof(pathname)))
+        {
+            for (i = 0; i < MAX_SHADER_SOURCES; i++)
+            {
+                if (shaderSources[i].shader != VK_NULL_HANDLE && strcmp(shaderSources[i].pathname, pathname) == 0) {
+                    fprintf(stderr, "Reloading %s\n", pathname);
+                    graphics_queueshaderreload(i);
+                }
+            }
+        }
+        completed.swap(completedShaderReloads);
+        retired.swap(retiredShaderModules);
+    }
+
+    /* Modules are only read while a pipeline is created, and none uses these any more */
+    for (j = 0; j < retired.size(); j++)
+    {
+        graphics_destroyshadermodule(retired[j]);
+    }
+
+    for (j = 0; j < completed.size(); j++)
+    {
+        ShaderReload *reload = completed[j];
+
+        for (i = 0; i < reload->count; i++)
+        {
+            PipelineEntry *entry = &pipelineLibrary[reload->indices[i]];
+            VkPipeline old;
+
+            entry->layout.store(reload->layouts[i], std::memory_order_relaxed);
+            old = entry->pipeline.exchange(reload->pipelines[i], std::memory_order_acq_rel);
+
+            if (old != VK_NULL_HANDLE) {
+                graphics_retirepipeline(frame, old);
+            }
+        }
+        graphics_freeshaderreload(reload);
+    }
+    completed.clear();
+    retired.clear();
+}
+
+static void graphics_destroypipelinelibrary()
+{
+    size_t i;
+
+    if (pipelineWorker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(pipelineMutex);
+            pipelineWorkerStop = true;
+            pipelineCondition.notify_one();
+        }
+        pipelineWorker.join();
+    }
+
+    /* Reloads finished after the last frame replaced nothing yet */
+    while (!completedShaderReloads.empty())
+    {
+        graphics_discardshaderreload(completedShaderReloads.front());
+        completedShaderReloads.pop_front();
+    }
+    while (!retiredShaderModules.empty())
+    {
+        graphics_destroyshadermodule(retiredShaderModules.front());
+        retiredShaderModules.pop_front();
+    }
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        graphics_releasepipelines(&frames[i]);
+        memory_free(frames[i].retiredPipelines, MEMORY_GRAPHICS);
+        frames[i].retiredPipelines        = NULL;
+        frames[i].retiredPipelineCapacity = 0;
+    }
+
+    for (i = PIPELINE_LIBRARY_SIZE; i-- > 0;)
+    {
+        VkPipeline pipeline = pipelineLibrary[i].pipeline.load();
+
+        if (pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(device, pipeline, NULL);
+            pipelineLibrary[i].pipeline.store(VK_NULL_HANDLE);
+        }
+        pipelineLibrary[i].layout.store(NULL);
+        pipelineLibrary[i].slot = PIPELINE_SLOT_EMPTY;
+    }
+}
+
+/* https://gpuopen-librariesandsdks.github.io/VulkanMemoryAllocator/html/usage_patterns.html#usage_patterns_staging_copy_upload */
+static void graphics_createstagingbuffer()
+{
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    VmaAllocationCreateInfo allocInfo = { 0 };
+    VmaAllocationInfo allocationInfo;
+    size_t i;
+
+    bufferInfo.size        = STAGING_PARTITION_SIZE * MAX_FRAMES_IN_FLIGHT;
+    bufferInfo.usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    /* Persistently mapped, so uploads are a memcpy with no map/unmap */
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VkResult result = vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &stagingBuffer, &stagingAllocation, &allocationInfo);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create staging buffer: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+    stagingData = (char *)allocationInfo.pMappedData;
+
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        frames[i].stagingOffset = STAGING_PARTITION_SIZE * i;
+    }
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap7.html#synchronization-queue-transfers */
+static void graphics_createtransferbatches()
+{
+    VkCommandPoolCreateInfo poolInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+    VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+    VkSemaphoreCreateInfo semaphoreInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    size_t i;
+    VkResult result;
+
+    poolInfo.flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = transferQueueFamily;
+
+    for (i = 0; i < MAX_TRANSFER_BATCHES; i++)
+    {
+        result = vkCreateCommandPool(device, &poolInfo, NULL, &transferBatches[i].commandPool);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create transfer command pool %zu: %d\n", i, result);
+            exit(EXIT_FAILURE);
+        }
+
+        allocateInfo.commandPool        = transferBatches[i].commandPool;
+        allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocateInfo.commandBufferCount = 1;
+
+        result = vkAllocateCommandBuffers(device, &allocateInfo, &transferBatches[i].commandBuffer);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to allocate transfer command buffer %zu: %d\n", i, result);
+            exit(EXIT_FAILURE);
+        }
+
+        result = vkCreateSemaphore(device, &semaphoreInfo, NULL, &transferBatches[i].semaphore);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create transfer semaphore %zu: %d\n", i, result);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Free a batch's staging buffers once the frame that acquired it has completed */
+static void graphics_releasetransferbatch(TransferBatch *batch)
+{
+    uint32_t i;
+
+    for (i = batch->count; i-- > 0;)
+    {
+        vmaDestroyBuffer(allocator, batch->stagingBuffers[i], batch->stagingAllocations[i]);
+    }
+    batch->count = 0;
+    vkResetCommandPool(device, batch->commandPool, 0);
+    batch->inUse = false;
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap18.html#queries-timestamps */
+static void graphics_createquerypools()
+{
+    VkQueryPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+    VkPhysicalDeviceProperties properties;
+    VkQueueFamilyProperties *queueFamilies;
+    uint32_t queueFamilyCount = 0;
+    uint32_t validBits;
+    size_t i;
+    VkResult result;
+
+    vkGetPhysicalDeviceProperties(physicalDevices[0], &properties);
+
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevices[0], &queueFamilyCount, NULL);
+    queueFamilies = (VkQueueFamilyProperties*)memory_framealloc(sizeof(VkQueueFamilyProperties) * queueFamilyCount);
+    if (!queueFamilies) {
+        fprintf(stderr, "Failed to allocate memory for queue families\n");
+        exit(EXIT_FAILURE);
+    }
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevices[0], &queueFamilyCount, queueFamilies);
+    validBits = queueFamilies[graphicsQueueFamily].timestampValidBits;
+
+    /* Zero valid bits means the queue cannot write timestamps at all */
+    if (validBits == 0 || properties.limits.timestampPeriod == 0.0f)
+    {
+        return;
+    }
+
+    timestampPeriod = properties.limits.timestampPeriod;
+    timestampMask   = validBits >= 64 ? UINT64_MAX : (((uint64_t)1 << validBits) - 1);
+
+    createInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    createInfo.queryCount = MAX_PROFILE_SCOPES * 2;
+
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        result = vkCreateQueryPool(device, &createInfo, NULL, &frames[i].queryPool);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create query pool %zu: %d\n", i, result);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void graphics_destroyquerypools()
+{
+    size_t i;
+
+    for (i = MAX_FRAMES_IN_FLIGHT; i-- > 0;)
+    {
+        if (frames[i].queryPool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(device, frames[i].queryPool, NULL);
+            frames[i].queryPool = VK_NULL_HANDLE;
+        }
+    }
+}
+
+/* Start timing a named pass; name must outlive the profile history, e.g. a string literal */
+static uint32_t graphics_beginscope(VkCommandBuffer commandBuffer, const char *name)
+{
+    Frame *frame = &frames[frameIndex];
+    uint32_t scope;
+
+    if (frame->queryPool == VK_NULL_HANDLE || frame->scopeCount == MAX_PROFILE_SCOPES)
+    {
+        return UINT32_MAX;
+    }
+
+    scope = frame->scopeCount++;
+    frame->scopeNames[scope] = name;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap18.html#vkCmdWriteTimestamp */
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->queryPool, scope * 2);
+    return scope;
+}
+
+static void graphics_endscope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+    Frame *frame = &frames[frameIndex];
+
+    if (scope == UINT32_MAX)
+    {
+        return;
+    }
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->queryPool, scope * 2 + 1);
+}
+
+/* Called once the frame's fence has signaled, so the results are ready and nothing waits */
+static void graphics_resolvescopes(Frame *frame)
+{
+    uint64_t timestamps[MAX_PROFILE_SCOPES * 2];
+    ProfileFrame *profile;
+    uint32_t i;
+
+    if (frame->scopeCount == 0)
+    {
+        return;
+    }
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap18.html#vkGetQueryPoolResults */
+    VkResult result = vkGetQueryPoolResults(device, frame->queryPool, 0, frame->scopeCount * 2, sizeof(timestamps), timestamps,
+                                            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS)
+    {
+        frame->scopeCount = 0;
+        return;
+    }
+
+    profile = &profileHistory[(profileHead + profileCount) % PROFILE_HISTORY];
+    if (profileCount < PROFILE_HISTORY) {
+        profileCount++;
+    } else {
+        profileHead = (profileHead + 1) % PROFILE_HISTORY;
+    }
+
+    profile->frame      = frame->frameNumber;
+    profile->scopeCount = frame->scopeCount;
+    for (i = 0; i < frame->scopeCount; i++)
+    {
+        uint64_t ticks = (timestamps[i * 2 + 1] - timestamps[i * 2]) & timestampMask;
+
+        profile->names[i]        = frame->scopeNames[i];
+        profile->milliseconds[i] = ticks * (double)timestampPeriod / 1000000.0;
+    }
+
+    /* The first scope spans the whole command buffer */
+    frameStats.gpumicroseconds = (uint32_t)(profile->milliseconds[0] * 1000.0);
+    frame->scopeCount = 0;
+}
+
+/* Return a list of destroyed meshes to the arenas */
+static void graphics_freemeshes(GraphicsMesh *mesh)
+{
+    GraphicsMesh *next;
+
+    for (; mesh != NULL; mesh = next)
+    {
+        next = mesh->next;
+        vmaVirtualFree(meshIndexBlock, mesh->indexAllocation);
+        vmaVirtualFree(meshVertexBlock, mesh->vertexAllocation);
+        memory_poolfree(meshPool, mesh);
+    }
+}
+
+/* Hand destroyed meshes to a frame, to be freed once its submission completes */
+static void graphics_retiremeshes(Frame *frame)
+{
+    GraphicsMesh **link = &destroyedMeshes;
+    GraphicsMesh *mesh;
+
+    while ((mesh = *link) != NULL)
+    {
+        /* A copy still on the transfer queue is not covered by this frame's fence */
+        if (mesh->uploadSerial > completedTransferSerial) {
+            link = &mesh->next;
+            continue;
+        }
+        *link                  = mesh->next;
+        mesh->next             = frame->destroyedMeshes;
+        frame->destroyedMeshes = mesh;
+    }
+}
+
+/* Return a list of destroyed textures, with their descriptor sets, to the device */
+static void graphics_freetextures(GraphicsTexture *texture)
+{
+    GraphicsTexture *next;
+
+    for (; texture != NULL; texture = next)
+    {
+        next = texture->next;
+        if (texture->stagingBuffer != VK_NULL_HANDLE) {
+            vmaDestroyBuffer(allocator, texture->stagingBuffer, texture->stagingAllocation);
+        }
+        vkFreeDescriptorSets(device, textureDescriptorPool, 1, &texture->descriptorSet);
+        vkDestroyImageView(device, texture->view, NULL);
+        vmaDestroyImage(allocator, texture->image, texture->allocation);
+        memory_poolfree(texturePool, texture);
+    }
+}
+
+/* Hand destroyed textures to a frame; uploads are recorded before draws, so none is still pending */
+static void graphics_retiretextures(Frame *frame)
+{
+    GraphicsTexture *texture;
+
+    while ((texture = destroyedTextures) != NULL)
+    {
+        destroyedTextures        = texture->next;
+        texture->next            = frame->destroyedTextures;
+        frame->destroyedTextures = texture;
+    }
+}
+
+/* Free the staging buffers of the textures a frame uploaded */
+static void graphics_releasetexturestaging(Frame *frame)
+{
+    uint32_t i;
+
+    for (i = frame->textureStagingCount; i-- > 0;)
+    {
+        vmaDestroyBuffer(allocator, frame->textureStagingBuffers[i], frame->textureStagingAllocations[i]);
+    }
+    frame->textureStagingCount = 0;
+}
+
+/* Free the buffers of the uploads that overflowed a frame's staging ring */
+static void graphics_releasestaginguploads(Frame *frame)
+{
+    uint32_t i;
+
+    for (i = frame->stagingUploadCount; i-- > 0;)
+    {
+        vmaDestroyBuffer(allocator, frame->stagingUploads[i].buffer, frame->stagingUploads[i].allocation);
+    }
+    frame->stagingUploadCount = 0;
+}
+
+/* Write a finished frame's pixels out as a binary PPM, when there is somewhere to write them */
+static void graphics_writereadback(Frame *frame)
+{
+    char pathname[sizeof(headlessOutput) + 32];
+    uint8_t *row;
+    FILE *fp;
+    int x, y;
+
+    if (!frame->readbackPending)
+    {
+        return;
+    }
+    frame->readbackPending = false;
+
+    if (headlessOutput[0] == '\0')
+    {
+        return;
+    }
+
+    /* Host-cached memory need not be coherent */
+    vmaInvalidateAllocation(allocator, frame->readbackAllocation, 0, VK_WHOLE_SIZE);
+
+    snprintf(pathname, sizeof(pathname), "%s/frame%06llu.ppm", headlessOutput, (unsigned long long)frame->readbackFrame);
+    fp = fopen(pathname, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s for writing\n", pathname);
+        return;
+    }
+
+    row = (uint8_t *)memory_framealloc((size_t)w * 3);
+    if (!row) {
+        fprintf(stderr, "Failed to allocate memory for readback row\n");
+        fclose(fp);
+        return;
+    }
+
+    /* Offscreen images are RGBA8, so alpha is all there is to drop */
+    fprintf(fp, "P6\n%d %d\n255\n", w, h);
+    for (y = 0; y < h; y++)
+    {
+        const uint8_t *pixel = frame->readbackData + (size_t)y * w * 4;
+
+        for (x = 0; x < w; x++)
+        {
+            row[x * 3 + 0] = pixel[x * 4 + 0];
+            row[x * 3 + 1] = pixel[x * 4 + 1];
+            row[x * 3 + 2] = pixel[x * 4 + 2];
+        }
+        fwrite(row, 3, w, fp);
+    }
+    fclose(fp);
+}
+
+/* Sum the instances the cull pass kept, from the copy graphics_cullinstances made */
+static void graphics_countvisibleinstances(Frame *frame)
+{
+    const VkDrawIndexedIndirectCommand *commands;
+    const uint32_t *counts;
+    uint32_t i, visible = 0;
+
+    if (frame->cullReadbackCount == 0)
+    {
+        return;
+    }
+
+    vmaInvalidateAllocation(allocator, frame->cullReadbackAllocation, 0, VK_WHOLE_SIZE);
+    commands = (const VkDrawIndexedIndirectCommand *)frame->cullReadbackData;
+    counts   = (const uint32_t *)(frame->cullReadbackData + sizeof(VkDrawIndexedIndirectCommand) * frame->instanceCapacity);
+
+    /* Compacted groups keep their count in their first slot; otherwise each command is 0 or 1 instance */
+    for (i = 0; i < frame->cullReadbackCount; i++)
+    {
+        visible += frame->cullReadbackCompact ? counts[i] : commands[i].instanceCount;
+    }
+    frameStats.visibleinstances = visible;
+    frame->cullReadbackCount    = 0;
+}
+
+/* Wait for the GPU to release a frame's resources, once per submission */
+static void graphics_waitframe(Frame *frame)
+{
+    if (frame->ready)
+    {
+        return;
+    }
+
+    /* Only block on the GPU work submitted framesInFlight frames ago */
+    vkWaitForFences(device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+
+    if (frame->transferBatch != NULL)
+    {
+        graphics_releasetransferbatch(frame->transferBatch);
+        frame->transferBatch = NULL;
+    }
+
+    graphics_resolvescopes(frame);
+    graphics_countvisibleinstances(frame);
+    graphics_writereadback(frame);
+    graphics_releasepipelines(frame);
+    graphics_freemeshes(frame->destroyedMeshes);
+    frame->destroyedMeshes = NULL;
+    graphics_releasetexturestaging(frame);
+    graphics_freetextures(frame->destroyedTextures);
+    frame->destroyedTextures = NULL;
+    graphics_releasestaginguploads(frame);
+
+    frame->stagingHead      = 0;
+    frame->stagingCopyCount = 0;
+    frame->ready            = true;
+}
+
+static void graphics_destroytransferbatches()
+{
+    size_t i;
+
+    for (i = MAX_TRANSFER_BATCHES; i-- > 0;)
+    {
+        TransferBatch *batch = &transferBatches[i];
+
+        if (batch->commandPool == VK_NULL_HANDLE) {
+            continue;
+        }
+        graphics_releasetransferbatch(batch);
+        vkDestroySemaphore(device, batch->semaphore, NULL);
+        vkDestroyCommandPool(device, batch->commandPool, NULL);
+        memory_free(batch->stagingBuffers, MEMORY_GRAPHICS);
+        memory_free(batch->stagingAllocations, MEMORY_GRAPHICS);
+        memory_free(batch->barriers, MEMORY_GRAPHICS);
+        memset(batch, 0, sizeof(*batch));
+    }
+}
+
+/* A host-visible buffer holding a copy of data, to upload from */
+static void graphics_createuploadbuffer(const void *data, VkDeviceSize size, VkBuffer *buffer, VmaAllocation *allocation)
+{
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    VmaAllocationCreateInfo allocInfo = { 0 };
+    VmaAllocationInfo allocationInfo;
+
+    bufferInfo.size        = size;
+    bufferInfo.usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VkResult result = vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, buffer, allocation, &allocationInfo);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create upload buffer: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(allocationInfo.pMappedData, data, size);
+}
+
+/* Whether a batch not yet submitted writes to a buffer */
+static bool graphics_batchwrites(const TransferBatch *batch, VkBuffer dst)
+{
+    uint32_t i;
+
+    for (i = 0; i < batch->count; i++)
+    {
+        if (batch->barriers[i].buffer == dst) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Whether a frame already has a copy to a buffer, from the ring or past it */
+static bool graphics_framewrites(const Frame *frame, VkBuffer dst)
+{
+    uint32_t i;
+
+    for (i = 0; i < frame->stagingCopyCount; i++)
+    {
+        if (frame->stagingTargets[i] == dst) {
+            return true;
+        }
+    }
+    for (i = 0; i < frame->stagingUploadCount; i++)
+    {
+        if (frame->stagingUploads[i].target == dst) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Upload on the transfer queue; the data is usable once completedTransferSerial reaches the result */
+static uint64_t graphics_uploadbufferasync(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size)
+{
+    VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+    VkBufferCopy region;
+    TransferBatch *batch;
+    Frame *oldest;
+    size_t i;
+
+    if (recordingBatch == NULL)
+    {
+        for (i = 0; i < MAX_TRANSFER_BATCHES && transferBatches[i].inUse; i++)
+        {
+        }
+
+        /* Every batch is pending, so wait for the frame holding the oldest one to give it back */
+        if (i == MAX_TRANSFER_BATCHES)
+        {
+            oldest = NULL;
+            for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            {
+                if (frames[i].transferBatch != NULL && (oldest == NULL || frames[i].transferBatch->serial < oldest->transferBatch->serial)) {
+                    oldest = &frames[i];
+                }
+            }
+            if (oldest == NULL) {
+                fprintf(stderr, "Failed to find a free transfer batch\n");
+                exit(EXIT_FAILURE);
+            }
+            batch = oldest->transferBatch;
+            graphics_waitframe(oldest);
+            i = (size_t)(batch - transferBatches);
+        }
+        recordingBatch = &transferBatches[i];
+        recordingBatch->inUse  = true;
+        recordingBatch->serial = ++transferSerial;
+
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(recordingBatch->commandBuffer, &beginInfo);
+    }
+    batch = recordingBatch;
+
+    if (batch->count == batch->capacity)
+    {
+        batch->capacity           = batch->capacity ? batch->capacity * 2 : 16;
+        batch->stagingBuffers     = (VkBuffer *)memory_realloc(batch->stagingBuffers, sizeof(VkBuffer) * batch->capacity, MEMORY_GRAPHICS);
+        batch->stagingAllocations = (VmaAllocation *)memory_realloc(batch->stagingAllocations, sizeof(VmaAllocation) * batch->capacity, MEMORY_GRAPHICS);
+        batch->barriers           = (VkBufferMemoryBarrier *)memory_realloc(batch->barriers, sizeof(VkBufferMemoryBarrier) * batch->capacity, MEMORY_GRAPHICS);
+        if (!batch->stagingBuffers || !batch->stagingAllocations || !batch->barriers) {
+            fprintf(stderr, "Failed to allocate memory for transfer batch\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    graphics_createuploadbuffer(data, size, &batch->stagingBuffers[batch->count], &batch->stagingAllocations[batch->count]);
+
+    region.srcOffset = 0;
+    region.dstOffset = dstOffset;
+    region.size      = size;
+    vkCmdCopyBuffer(batch->commandBuffer, batch->stagingBuffers[batch->count], dst, 1, &region);
+
+    /* Release half of the queue family ownership transfer; the graphics queue acquires */
+    barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask       = 0;
+    barrier.srcQueueFamilyIndex = transferQueueFamily;
+    barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+    barrier.buffer              = dst;
+    barrier.offset              = dstOffset;
+    barrier.size                = size;
+    batch->barriers[batch->count] = barrier;
+    batch->count++;
+
+    return batch->serial;
+}
+
+/*
+ * Copy data into the current frame's staging partition; the copy is recorded at
+ * the next flush. What the ring cannot hold goes to the transfer queue, unless the
+ * frame already copies to dst, as the two queues would race; then it is copied on
+ * the graphics queue after the ring's copies. Returns the transfer serial to wait
+ * for, or 0 when the data is usable from the next frame on.
+ */
+static uint64_t graphics_uploadbuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size)
+{
+    Frame *frame;
+    StagingUpload *upload;
+    VkDeviceSize offset;
+
+    frame = &frames[frameIndex];
+    graphics_waitframe(frame);
+
+    frameStats.bytesuploaded += (uint32_t)size;
+
+    /* Later writes to a buffer the transfer queue is given this frame follow it there, in order */
+    if (recordingBatch != NULL && graphics_batchwrites(recordingBatch, dst))
+    {
+        return graphics_uploadbufferasync(dst, dstOffset, data, size);
+    }
+
+    offset = (frame->stagingHead + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+    if (frame->stagingUploadCount == 0 && offset + size <= STAGING_PARTITION_SIZE && frame->stagingCopyCount < MAX_STAGING_COPIES)
+    {
+        memcpy(stagingData + frame->stagingOffset + offset, data, size);
+
+        frame->stagingTargets[frame->stagingCopyCount]          = dst;
+        frame->stagingCopies[frame->stagingCopyCount].srcOffset = frame->stagingOffset + offset;
+        frame->stagingCopies[frame->stagingCopyCount].dstOffset = dstOffset;
+        frame->stagingCopies[frame->stagingCopyCount].size      = size;
+        frame->stagingCopyCount++;
+        frame->stagingHead = offset + size;
+        return 0;
+    }
+
+    if (!graphics_framewrites(frame, dst))
+    {
+        return graphics_uploadbufferasync(dst, dstOffset, data, size);
+    }
+
+    if (frame->stagingUploadCount == frame->stagingUploadCapacity)
+    {
+        frame->stagingUploadCapacity = frame->stagingUploadCapacity ? frame->stagingUploadCapacity * 2 : 16;
+        frame->stagingUploads        = (StagingUpload *)memory_realloc(frame->stagingUploads, sizeof(StagingUpload) * frame->stagingUploadCapacity, MEMORY_GRAPHICS);
+        if (!frame->stagingUploads) {
+            fprintf(stderr, "Failed to allocate memory for staging uploads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    upload = &frame->stagingUploads[frame->stagingUploadCount++];
+    graphics_createuploadbuffer(data, size, &upload->buffer, &upload->allocation);
+    upload->target         = dst;
+    upload->copy.srcOffset = 0;
+    upload->copy.dstOffset = dstOffset;
+    upload->copy.size      = size;
+    return 0;
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap20.html#copies-buffers */
+static void graphics_flushuploads(VkCommandBuffer commandBuffer)
+{
+    Frame *frame = &frames[frameIndex];
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    const VkPipelineStageFlags readStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                                            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    VkSubmitInfo submit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    uint32_t i, j, first;
+
+    /* Acquire what the transfer queue was given last frame, ahead of this frame's copies; this frame's submit waits on it */
+    if (submittedBatch != NULL)
+    {
+        if (transferQueueFamily != graphicsQueueFamily)
+        {
+            for (i = 0; i < submittedBatch->count; i++)
+            {
+                submittedBatch->barriers[i].srcAccessMask = 0;
+                submittedBatch->barriers[i].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                                                            VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+            }
+            vkCmdPipelineBarrier(commandBuffer, readStages, readStages | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL,
+                                 submittedBatch->count, submittedBatch->barriers, 0, NULL);
+        }
+        frame->transferBatch    = submittedBatch;
+        completedTransferSerial = submittedBatch->serial;
+        submittedBatch          = NULL;
+    }
+
+    /* Hand this frame's batch to the transfer queue, so it runs alongside graphics work */
+    if (recordingBatch != NULL)
+    {
+        if (transferQueueFamily != graphicsQueueFamily)
+        {
+            vkCmdPipelineBarrier(recordingBatch->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                 0, 0, NULL, recordingBatch->count, recordingBatch->barriers, 0, NULL);
+        }
+        vkEndCommandBuffer(recordingBatch->commandBuffer);
+
+        submit.commandBufferCount   = 1;
+        submit.pCommandBuffers      = &recordingBatch->commandBuffer;
+        submit.signalSemaphoreCount = 1;
+        submit.pSignalSemaphores    = &recordingBatch->semaphore;
+        vkQueueSubmit(transferQueue, 1, &submit, VK_NULL_HANDLE);
+
+        submittedBatch = recordingBatch;
+        recordingBatch = NULL;
+    }
+
+    if (frame->stagingCopyCount == 0 && frame->stagingUploadCount == 0)
+    {
+        return;
+    }
+
+    /* Stable insertion sort by destination, so each buffer gets one vkCmdCopyBuffer */
+    for (i = 1; i < frame->stagingCopyCount; i++)
+    {
+        VkBuffer target = frame->stagingTargets[i];
+        VkBufferCopy copy = frame->stagingCopies[i];
+
+        for (j = i; j > 0 && frame->stagingTargets[j - 1] > target; j--)
+        {
+            frame->stagingTargets[j] = frame->stagingTargets[j - 1];
+            frame->stagingCopies[j]  = frame->stagingCopies[j - 1];
+        }
+        frame->stagingTargets[j] = target;
+        frame->stagingCopies[j]  = copy;
+    }
+
+    /* A no-op on coherent memory */
+    vmaFlushAllocation(allocator, stagingAllocation, frame->stagingOffset, frame->stagingHead);
+
+    /* Earlier frames may still be reading the regions we are about to overwrite */
+    vkCmdPipelineBarrier(commandBuffer, readStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+
+    for (first = 0; first < frame->stagingCopyCount; first = i)
+    {
+        for (i = first + 1; i < frame->stagingCopyCount && frame->stagingTargets[i] == frame->stagingTargets[first]; i++)
+        {
+        }
+        vkCmdCopyBuffer(commandBuffer, stagingBuffer, frame->stagingTargets[first], i - first, &frame->stagingCopies[first]);
+    }
+
+    /* Every overflow was made after the ring's copies, and they are kept in order */
+    for (i = 0; i < frame->stagingUploadCount; i++)
+    {
+        vkCmdCopyBuffer(commandBuffer, frame->stagingUploads[i].buffer, frame->stagingUploads[i].target, 1, &frame->stagingUploads[i].copy);
+    }
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                            VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, readStages, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+    frame->stagingCopyCount = 0;
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap47.html#formats-compatibility */
+static bool graphics_getformatblock(VkFormat format, uint32_t *blockWidth, uint32_t *blockHeight, uint32_t *blockSize)
+{
+    static const uint8_t astcFootprints[14][2] = {
+        {  4,  4 }, {  5,  4 }, {  5,  5 }, {  6,  5 }, {  6,  6 }, {  8,  5 }, {  8,  6 },
+        {  8,  8 }, { 10,  5 }, { 10,  6 }, { 10,  8 }, { 10, 10 }, { 12, 10 }, { 12, 12 }
+    };
+
+    *blockWidth  = 4;
+    *blockHeight = 4;
+    switch (format)
+    {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+        *blockWidth  = 1;
+        *blockHeight = 1;
+        *blockSize   = 4;
+        return true;
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+    case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11_SNORM_BLOCK:
+        *blockSize = 8;
+        return true;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+    case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
+        *blockSize = 16;
+        return true;
+    default:
+        if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK) {
+            *blockWidth  = astcFootprints[(format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2][0];
+            *blockHeight = astcFootprints[(format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2][1];
+            *blockSize   = 16;
+            return true;
+        }
+        return false;
+    }
+}
+
+/* Tightly packed bytes of one mip level; partial blocks at the edges are stored whole */
+static VkDeviceSize graphics_getlevelsize(VkFormat format, uint32_t width, uint32_t height, uint32_t level)
+{
+    uint32_t blockWidth, blockHeight, blockSize;
+
+    graphics_getformatblock(format, &blockWidth, &blockHeight, &blockSize);
+    width  = width >> level > 0 ? width >> level : 1;
+    height = height >> level > 0 ? height >> level : 1;
+    return (VkDeviceSize)((width + blockWidth - 1) / blockWidth) * ((height + blockHeight - 1) / blockHeight) * blockSize;
+}
+
+/* Mips are only built on the GPU for formats it can filter and blit */
+static bool graphics_isblittable(VkFormat format)
+{
+    const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                              VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    VkFormatProperties formatProperties;
+
+    vkGetPhysicalDeviceFormatProperties(physicalDevices[0], format, &formatProperties);
+    return (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+}
+
+/* Downsample each level into the next, leaving every level ready to sample */
+static void graphics_generatemipmaps(VkCommandBuffer commandBuffer, const GraphicsTexture *texture)
+{
+    VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    VkImageBlit blit;
+    int32_t width  = (int32_t)texture->width;
+    int32_t height = (int32_t)texture->height;
+    uint32_t i;
+
+    barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image                           = texture->image;
+    barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount     = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount     = 1;
+
+    for (i = 1; i < texture->mipLevels; i++)
+    {
+        barrier.subresourceRange.baseMipLevel = i - 1;
+        barrier.oldLayout                     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout                     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask                 = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask                 = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+        memset(&blit, 0, sizeof(blit));
+        blit.srcOffsets[1].x           = width;
+        blit.srcOffsets[1].y           = height;
+        blit.srcOffsets[1].z           = 1;
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel   = i - 1;
+        blit.srcSubresource.layerCount = 1;
+        blit.dstOffsets[1].x           = width > 1 ? width / 2 : 1;
+        blit.dstOffsets[1].y           = height > 1 ? height / 2 : 1;
+        blit.dstOffsets[1].z           = 1;
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel   = i;
+        blit.dstSubresource.layerCount = 1;
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap20.html#copies-imagescaling */
+        vkCmdBlitImage(commandBuffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+        width  = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+
+    /* The last level is only ever written */
+    barrier.subresourceRange.baseMipLevel = texture->mipLevels - 1;
+    barrier.oldLayout                     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout                     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask                 = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask                 = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+/* Copy pending textures into their images on the graphics queue, which blits need anyway */
+static void graphics_flushtextures(VkCommandBuffer commandBuffer)
+{
+    Frame *frame = &frames[frameIndex];
+    VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    VkBufferImageCopy regions[MAX_TEXTURE_LEVELS];
+    GraphicsTexture *texture;
+    VkDeviceSize offset;
+    uint32_t i;
+
+    while ((texture = pendingTextures) != NULL)
+    {
+        pendingTextures     = texture->nextUpload;
+        texture->nextUpload = NULL;
+
+        barrier.srcAccessMask                   = 0;
+        barrier.dstAccessMask                   = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout                       = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout                       = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image                           = texture->image;
+        barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel   = 0;
+        barrier.subresourceRange.levelCount     = texture->mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount     = 1;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+        /* Levels sit back to back in the staging buffer, as graphics_createtexturelevels laid them out */
+        for (i = 0, offset = 0; i < texture->uploadLevels; i++)
+        {
+            memset(&regions[i], 0, sizeof(VkBufferImageCopy));
+            regions[i].bufferOffset                = offset;
+            regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            regions[i].imageSubresource.mipLevel   = i;
+            regions[i].imageSubresource.layerCount = 1;
+            regions[i].imageExtent.width           = texture->width >> i > 0 ? texture->width >> i : 1;
+            regions[i].imageExtent.height          = texture->height >> i > 0 ? texture->height >> i : 1;
+            regions[i].imageExtent.depth           = 1;
+            offset += graphics_getlevelsize(texture->format, texture->width, texture->height, i);
+        }
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap20.html#vkCmdCopyBufferToImage */
+        vkCmdCopyBufferToImage(commandBuffer, texture->stagingBuffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               texture->uploadLevels, regions);
+
+        if (texture->uploadLevels < texture->mipLevels)
+        {
+            graphics_generatemipmaps(commandBuffer, texture);
+        }
+        else
+        {
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+        }
+
+        /* The staging buffer now belongs to the frame, and is freed with it */
+        if (frame->textureStagingCount == frame->textureStagingCapacity)
+        {
+            frame->textureStagingCapacity    = frame->textureStagingCapacity ? frame->textureStagingCapacity * 2 : 16;
+            frame->textureStagingBuffers     = (VkBuffer *)memory_realloc(frame->textureStagingBuffers, sizeof(VkBuffer) * frame->textureStagingCapacity, MEMORY_GRAPHICS);
+            frame->textureStagingAllocations = (VmaAllocation *)memory_realloc(frame->textureStagingAllocations, sizeof(VmaAllocation) * frame->textureStagingCapacity, MEMORY_GRAPHICS);
+            if (!frame->textureStagingBuffers || !frame->textureStagingAllocations) {
+                fprintf(stderr, "Failed to allocate memory for texture staging\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        frame->textureStagingBuffers[frame->textureStagingCount]     = texture->stagingBuffer;
+        frame->textureStagingAllocations[frame->textureStagingCount] = texture->stagingAllocation;
+        frame->textureStagingCount++;
+        texture->stagingBuffer     = VK_NULL_HANDLE;
+        texture->stagingAllocation = VK_NULL_HANDLE;
+    }
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html#resources-buffers */
+static void graphics_createdevicebuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer *buffer, VmaAllocation *allocation)
+{
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    VmaAllocationCreateInfo allocInfo = { 0 };
+
+    bufferInfo.size        = size;
+    bufferInfo.usage       = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    /* No host access flags, so VMA places the buffer in device-local memory */
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+    VkResult result = vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, buffer, allocation, NULL);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create device buffer: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Persistently mapped buffer the CPU rewrites every frame */
+static void *graphics_createhostbuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer *buffer, VmaAllocation *allocation)
+{
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    VmaAllocationCreateInfo allocInfo = { 0 };
+    VmaAllocationInfo allocationInfo;
+
+    bufferInfo.size        = size;
+    bufferInfo.usage       = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    /* Written once per frame and read once by the GPU, so it stays in host memory */
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VkResult result = vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, buffer, allocation, &allocationInfo);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create host buffer: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+    return allocationInfo.pMappedData;
+}
+
+/* https://gpuopen-librariesandsdks.github.io/VulkanMemoryAllocator/html/virtual_allocator.html */
+static void graphics_createmesharenas()
+{
+    VmaVirtualBlockCreateInfo blockInfo = { 0 };
+    VkResult result;
+
+    /* Every mesh lives in one vertex and one index buffer, so a single indirect draw can cover many meshes */
+    graphics_createdevicebuffer(sizeof(GraphicsVertex) * MESH_VERTEX_CAPACITY, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &meshVertexBuffer, &meshVertexAllocation);
+    graphics_createdevicebuffer(sizeof(uint32_t) * MESH_INDEX_CAPACITY, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, &meshIndexBuffer, &meshIndexAllocation);
+
+    /* The blocks count vertices and indices rather than bytes */
+    blockInfo.size = MESH_VERTEX_CAPACITY;
+    result = vmaCreateVirtualBlock(&blockInfo, &meshVertexBlock);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create mesh vertex arena: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+
+    blockInfo.size = MESH_INDEX_CAPACITY;
+    result = vmaCreateVirtualBlock(&blockInfo, &meshIndexBlock);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create mesh index arena: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+
+    meshPool     = memory_createpool(sizeof(GraphicsMesh), 256, MEMORY_GRAPHICS);
+    materialPool = memory_createpool(sizeof(GraphicsMaterial), 256, MEMORY_GRAPHICS);
+}
+
+static void graphics_destroymesharenas()
+{
+    memory_destroypool(materialPool);
+    materialPool = NULL;
+    memory_destroypool(meshPool);
+    meshPool = NULL;
+    if (meshIndexBlock != VK_NULL_HANDLE) {
+        vmaDestroyVirtualBlock(meshIndexBlock);
+        meshIndexBlock = VK_NULL_HANDLE;
+    }
+    if (meshVertexBlock != VK_NULL_HANDLE) {
+        vmaDestroyVirtualBlock(meshVertexBlock);
+        meshVertexBlock = VK_NULL_HANDLE;
+    }
+    if (meshIndexBuffer != VK_NULL_HANDLE) {
+        vmaDestroyBuffer(allocator, meshIndexBuffer, meshIndexAllocation);
+        meshIndexBuffer = VK_NULL_HANDLE;
+    }
+    if (meshVertexBuffer != VK_NULL_HANDLE) {
+        vmaDestroyBuffer(allocator, meshVertexBuffer, meshVertexAllocation);
+        meshVertexBuffer = VK_NULL_HANDLE;
+    }
+}
+
+/* The unit quad that graphics_drawquad scales into place */
+static void graphics_createquadmesh()
+{
+    static const GraphicsVertex quad_vertices[4] = {
+        { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f, 1.0f } },
+        { { 1.0f, 0.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f, 1.0f, 1.0f } },
+        { { 1.0f, 1.0f, 0.0f }, { 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f } },
+        { { 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f } }
+    };
+    static const uint32_t quad_indices[6] = { 0, 1, 2, 2, 3, 0 };
+
+    quadMesh = (GraphicsMesh *)graphics_createmesh(quad_vertices, 4, quad_indices, 6);
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#descriptorsets-allocation */
+static void graphics_createtexturepool()
+{
+    VkDescriptorPoolCreateInfo poolInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+    VkDescriptorPoolSize poolSize;
+
+    poolSize.type            = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = MAX_TEXTURES;
+
+    /* Textures come and go, so their sets are freed individually */
+    poolInfo.flags         = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    poolInfo.maxSets       = MAX_TEXTURES;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes    = &poolSize;
+
+    VkResult result = vkCreateDescriptorPool(device, &poolInfo, NULL, &textureDescriptorPool);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create texture descriptor pool: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+
+    texturePool = memory_createpool(sizeof(GraphicsTexture), 256, MEMORY_GRAPHICS);
+}
+
+/* What materials without a texture sample, so every draw can bind one */
+static void graphics_createwhitetexture()
+{
+    static const uint8_t white[4] = { 255, 255, 255, 255 };
+
+    whiteTexture = (GraphicsTexture *)graphics_createtexture(white, 1, 1, TEXTURE_FILTER_NEAREST, TEXTURE_WRAP_REPEAT);
+}
+
+/* FNV-1a over the whole description; SamplerState is always zero-initialized */
+static uint64_t graphics_hashsamplerstate(const SamplerState *state)
+{
+    const unsigned char *p = (const unsigned char *)state;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < sizeof(SamplerState); i++)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap13.html#samplers */
+static VkSampler graphics_findsampler(const SamplerState *state)
+{
+    VkSamplerCreateInfo createInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    uint64_t hash = graphics_hashsamplerstate(state);
+    uint32_t i;
+
+    for (i = (uint32_t)hash & (SAMPLER_CACHE_SIZE - 1); samplerCache[i].sampler != VK_NULL_HANDLE; i = (i + 1) & (SAMPLER_CACHE_SIZE - 1))
+    {
+        if (samplerCache[i].hash == hash && memcmp(&samplerCache[i].state, state, sizeof(SamplerState)) == 0) {
+            return samplerCache[i].sampler;
+        }
+    }
+
+    /* Keep one slot empty so probing terminates */
+    if (samplerCount == SAMPLER_CACHE_SIZE - 1) {
+        fprintf(stderr, "Sampler cache is full\n");
+        exit(EXIT_FAILURE);
+    }
+
+    createInfo.magFilter        = state->filter;
+    createInfo.minFilter        = state->filter;
+    createInfo.mipmapMode       = state->mipmapMode;
+    createInfo.addressModeU     = state->addressMode;
+    createInfo.addressModeV     = state->addressMode;
+    createInfo.addressModeW     = state->addressMode;
+    createInfo.anisotropyEnable = state->maxAnisotropy > 1.0f;
+    createInfo.maxAnisotropy    = state->maxAnisotropy;
+    createInfo.minLod           = 0.0f;
+    createInfo.maxLod           = VK_LOD_CLAMP_NONE;
+
+    VkResult result = vkCreateSampler(device, &createInfo, NULL, &samplerCache[i].sampler);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create sampler: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+    samplerCache[i].hash  = hash;
+    samplerCache[i].state = *state;
+    samplerCount++;
+    return samplerCache[i].sampler;
+}
+
+static void graphics_destroytextures()
+{
+    size_t i;
+
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        graphics_releasetexturestaging(&frames[i]);
+        memory_free(frames[i].textureStagingBuffers, MEMORY_GRAPHICS);
+        memory_free(frames[i].textureStagingAllocations, MEMORY_GRAPHICS);
+        frames[i].textureStagingBuffers     = NULL;
+        frames[i].textureStagingAllocations = NULL;
+        frames[i].textureStagingCapacity    = 0;
+        graphics_freetextures(frames[i].destroyedTextures);
+        frames[i].destroyedTextures = NULL;
+    }
+    for (i = 0; i < RENDER_PACKET_COUNT; i++)
+    {
+        graphics_freetextures(renderPackets[i].destroyedTextures);
+        renderPackets[i].destroyedTextures = NULL;
+    }
+    graphics_freetextures(destroyedTextures);
+    destroyedTextures = NULL;
+    graphics_freetextures(liveTextures);
+    liveTextures    = NULL;
+    pendingTextures = NULL;
+    whiteTexture    = NULL;
+
+    for (i = 0; i < SAMPLER_CACHE_SIZE; i++)
+    {
+        if (samplerCache[i].sampler != VK_NULL_HANDLE) {
+            vkDestroySampler(device, samplerCache[i].sampler, NULL);
+        }
+    }
+    memset(samplerCache, 0, sizeof(samplerCache));
+    samplerCount = 0;
+
+    if (textureDescriptorPool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(device, textureDescriptorPool, NULL);
+        textureDescriptorPool = VK_NULL_HANDLE;
+    }
+    memory_destroypool(texturePool);
+    texturePool = NULL;
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html#pipelines-compute */
+static void graphics_createcullpipeline()
+{
+    VkDescriptorPoolSize poolSize;
+    VkDescriptorPoolCreateInfo poolInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+    VkDescriptorSetLayout setLayouts[MAX_FRAMES_IN_FLIGHT];
+    VkDescriptorSetAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    VkDescriptorSet descriptorSets[MAX_FRAMES_IN_FLIGHT];
+    VkComputePipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    SpirvReflection reflection;
+    const SpirvReflection *stageReflection = &reflection;
+    PipelineLayoutEntry *layout;
+    FileMapping binary;
+    size_t i;
+    VkResult result;
+
+    /* Draws fall back to one call per run of meshes; said once, here, rather than every frame */
+    if (!gpuCullingSupported)
+    {
+        fprintf(stderr, "GPU culling is not supported by the device, drawing without it\n");
+        return;
+    }
+
+    if (!filesystem_map(&binary, "shaders/cull.comp.spv"))
+    {
+        fprintf(stderr, "GPU culling is off: shaders/cull.comp.spv is missing\n");
+        gpuCullingSupported = false;
+        return;
+    }
+    cullShader = graphics_createshader((const char *)binary.ptr, binary.size);
+    filesystem_unmap(&binary);
+
+    /* Instances, draw records, indirect commands and draw counts, as cull.comp declares them */
+    graphics_getshaderreflection((VkShaderModule)cullShader, &reflection);
+    layout = graphics_getpipelinelayout(&stageReflection, 1);
+    if (layout == NULL || layout->key.setLayoutCount != 1 || reflection.bindingcount != 4 ||
+        layout->key.pushConstantSize < sizeof(CullPushConstants)) {
+        fprintf(stderr, "Failed to create cull pipeline: unexpected interface in cull.comp\n");
+        exit(EXIT_FAILURE);
+    }
+    cullDescriptorSetLayout = layout->key.setLayouts[0];
+    cullPipelineLayout      = layout->layout;
+
+    poolSize.type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = 4 * MAX_FRAMES_IN_FLIGHT;
+
+    poolInfo.maxSets       = MAX_FRAMES_IN_FLIGHT;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes    = &poolSize;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#vkCreateDescriptorPool */
+    result = vkCreateDescriptorPool(device, &poolInfo, NULL, &cullDescriptorPool);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create cull descriptor pool: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        setLayouts[i] = cullDescriptorSetLayout;
+    }
+
+    allocateInfo.descriptorPool     = cullDescriptorPool;
+    allocateInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+    allocateInfo.pSetLayouts        = setLayouts;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#vkAllocateDescriptorSets */
+    result = vkAllocateDescriptorSets(device, &allocateInfo, descriptorSets);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to allocate cull descriptor sets: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        frames[i].cullDescriptorSet = descriptorSets[i];
+    }
+
+    createInfo.stage.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    createInfo.stage.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
+    createInfo.stage.module = (VkShaderModule)cullShader;
+    createInfo.stage.pName  = "main";
+    createInfo.layout       = cullPipelineLayout;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html#vkCreateComputePipelines */
+    result = vkCreateComputePipelines(device, pipelineCache, 1, &createInfo, NULL, &cullPipeline);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create cull pipeline: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void graphics_destroycullpipeline()
+{
+    if (cullPipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device, cullPipeline, NULL);
+    }
+    if (cullDescriptorPool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(device, cullDescriptorPool, NULL);
+    }
+    if (cullShader != NULL) {
+        graphics_destroyshadermodule((VkShaderModule)cullShader);
+    }
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#descriptorsets-updates */
+static void graphics_updatecullset(Frame *frame)
+{
+    VkDescriptorBufferInfo bufferInfos[4];
+    VkWriteDescriptorSet writes[4];
+    size_t i;
+
+    bufferInfos[0].buffer = frame->instanceBuffer;
+    bufferInfos[1].buffer = frame->drawRecordBuffer;
+    bufferInfos[2].buffer = frame->indirectBuffer;
+    bufferInfos[3].buffer = frame->countBuffer;
+
+    for (i = 0; i < 4; i++)
+    {
+        bufferInfos[i].offset = 0;
+        bufferInfos[i].range  = VK_WHOLE_SIZE;
+
+        memset(&writes[i], 0, sizeof(writes[i]));
+        writes[i].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet          = frame->cullDescriptorSet;
+        writes[i].dstBinding      = (uint32_t)i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo     = &bufferInfos[i];
+    }
+
+    vkUpdateDescriptorSets(device, 4, writes, 0, NULL);
+}
+
+/* Release a frame's per-object buffers; its fence has been waited on, so they are idle */
+static void graphics_destroyinstancebuffers(Frame *frame)
+{
+    if (frame->instanceBuffer != VK_NULL_HANDLE) {
+        vmaDestroyBuffer(allocator, frame->instanceBuffer, frame->instanceAllocation);
+        frame->instanceBuffer = VK_NULL_HANDLE;
+    }
+    if (frame->drawRecordBuffer != VK_NULL_HANDLE) {
+        vmaDestroyBuffer(allocator, frame->drawRecordBuffer, frame->drawRecordAllocation);
+        frame->drawRecordBuffer = VK_NULL_HANDLE;
+    }
+    if (frame->indirectBuffer != VK_NULL_HANDLE) {
+        vmaDestroyBuffer(allocator, frame->indirectBuffer, frame->indirectAllocation);
+        frame->indirectBuffer = VK_NULL_HANDLE;
+    }
+    if (frame->countBuffer != VK_NULL_HANDLE) {
+        vmaDestroyBuffer(allocator, frame->countBuffer, frame->countAllocation);
+        frame->countBuffer = VK_NULL_HANDLE;
+    }
+    if (frame->cullReadbackBuffer != VK_NULL_HANDLE) {
+        vmaDestroyBuffer(allocator, frame->cullReadbackBuffer, frame->cullReadbackAllocation);
+        frame->cullReadbackBuffer = VK_NULL_HANDLE;
+        frame->cullReadbackData   = NULL;
+    }
+    frame->instanceCapacity = 0;
+}
+
+/* Grow the frame's per-object buffers to hold count instances */
+static void graphics_reserveinstances(Frame *frame, uint32_t count)
+{
+    uint32_t capacity;
+
+    if (count <= frame->instanceCapacity)
+    {
+        return;
+    }
+
+    capacity = frame->instanceCapacity ? frame->instanceCapacity : MIN_INSTANCE_CAPACITY;
+    while (capacity < count)
+    {
+        capacity *= 2;
+    }
+
+    graphics_destroyinstancebuffers(frame);
+
+    frame->instanceData = (InstanceData *)graphics_createhostbuffer(sizeof(InstanceData) * capacity,
+                                                                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                                    &frame->instanceBuffer, &frame->instanceAllocation);
+    frame->instanceCapacity = capacity;
+
+    if (!gpuCullingSupported)
+    {
+        return;
+    }
+
+    /* The cull pass turns draw records into indirect commands, one per visible object */
+    frame->drawRecordData = (DrawRecord *)graphics_createhostbuffer(sizeof(DrawRecord) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                                    &frame->drawRecordBuffer, &frame->drawRecordAllocation);
+    graphics_createdevicebuffer(sizeof(VkDrawIndexedIndirectCommand) * capacity,
+                                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                &frame->indirectBuffer, &frame->indirectAllocation);
+    graphics_createdevicebuffer(sizeof(uint32_t) * capacity,
+                                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                &frame->countBuffer, &frame->countAllocation);
+    graphics_updatecullset(frame);
+
+    /* The commands, then the counts, as graphics_cullinstances copies them */
+    if (headless)
+    {
+        VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        VmaAllocationCreateInfo allocInfo = { 0 };
+        VmaAllocationInfo allocationInfo;
+
+        bufferInfo.size        = (sizeof(VkDrawIndexedIndirectCommand) + sizeof(uint32_t)) * capacity;
+        bufferInfo.usage       = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+        VkResult result = vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frame->cullReadbackBuffer, &frame->cullReadbackAllocation, &allocationInfo);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create cull readback buffer: %d\n", result);
+            exit(EXIT_FAILURE);
+        }
+        frame->cullReadbackData = (const uint8_t *)allocationInfo.pMappedData;
+    }
+}
+
+/* Gribb and Hartmann, with Vulkan's 0 <= z <= w clip volume */
+static void graphics_getfrustumplanes(const glm::mat4 &m, glm::vec4 planes[6])
+{
+    glm::vec4 rows[4];
+    size_t i;
+
+    for (i = 0; i < 4; i++)
+    {
+        rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    }
+
+    planes[0] = rows[3] + rows[0];
+    planes[1] = rows[3] - rows[0];
+    planes[2] = rows[3] + rows[1];
+    planes[3] = rows[3] - rows[1];
+    planes[4] = rows[2];
+    planes[5] = rows[3] - rows[2];
+
+    for (i = 0; i < 6; i++)
+    {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
+
+/* Fill a slice of the frame's mapped instance buffer, from a job */
+static void graphics_copyinstances(uint32_t first, uint32_t last, void *data)
+{
+    const RenderPacket *packet = (const RenderPacket *)data;
+    Frame *frame = &frames[frameIndex];
+    uint32_t i;
+
+    for (i = first; i < last; i++)
+    {
+        frame->instanceData[i] = packet->drawCommands[i].instance;
+    }
+}
+
+/* Order by sort key, keeping submission order between equal keys */
+static int graphics_comparedrawcommands(const void *a, const void *b)
+{
+    const DrawCommand *lhs = (const DrawCommand *)a;
+    const DrawCommand *rhs = (const DrawCommand *)b;
+
+    if (lhs->key != rhs->key) {
+        return lhs->key < rhs->key ? -1 : 1;
+    }
+    return lhs->sequence < rhs->sequence ? -1 : lhs->sequence > rhs->sequence;
+}
+
+static void graphics_submitdraw(GraphicsMesh *mesh, GraphicsMaterial *material, const glm::mat4 &transform, uint32_t space)
+{
+    RenderPacket *packet = &renderPackets[writePacket];
+    DrawCommand *command;
+
+    if (packet->drawCommandCount == packet->drawCommandCapacity)
+    {
+        packet->drawCommandCapacity = packet->drawCommandCapacity ? packet->drawCommandCapacity * 2 : MIN_INSTANCE_CAPACITY;
+        packet->drawCommands        = (DrawCommand *)memory_realloc(packet->drawCommands, sizeof(DrawCommand) * packet->drawCommandCapacity, MEMORY_GRAPHICS);
+        if (!packet->drawCommands) {
+            fprintf(stderr, "Failed to allocate memory for draw commands\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    command = &packet->drawCommands[packet->drawCommandCount];
+    command->sequence = packet->drawCommandCount++;
+    command->pipeline = material->pipeline != UINT32_MAX ? material->pipeline : currentPipeline;
+    command->space    = space;
+    command->mesh     = mesh;
+    command->texture  = material->texture;
+
+    /* space | pipeline | texture | mesh | material, so equal meshes under one pipeline and texture are adjacent */
+    command->key = ((uint64_t)space << 63) |
+                   ((uint64_t)command->pipeline << 53) |
+                   ((uint64_t)(material->texture->id & 0x3fff) << 39) |
+                   ((uint64_t)(mesh->id & 0xfffff) << 19) |
+                   (uint64_t)(material->id & 0x7ffff);
+
+    command->instance.transform = transform;
+    command->instance.color     = material->color;
+    command->instance.bounds    = mesh->bounds;
+}
+
+/* Record the cull pass over the first count instances, which are world-space and grouped by pipeline */
+static void graphics_cullinstances(VkCommandBuffer commandBuffer, const RenderPacket *packet, uint32_t count)
+{
+    Frame *frame = &frames[frameIndex];
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    CullPushConstants constants;
+    uint32_t i, j, first;
+
+    /* A group shares a pipeline and texture, and becomes one indirect draw */
+    for (first = 0; first < count; first = i)
+    {
+        for (i = first + 1; i < count && i - first < maxDrawIndirectCount &&
+             packet->drawCommands[i].pipeline == packet->drawCommands[first].pipeline &&
+             packet->drawCommands[i].texture == packet->drawCommands[first].texture; i++)
+        {
+        }
+        for (j = first; j < i; j++)
+        {
+            frame->drawRecordData[j].indexCount   = packet->drawCommands[j].mesh->indexCount;
+            frame->drawRecordData[j].firstIndex   = packet->drawCommands[j].mesh->firstIndex;
+            frame->drawRecordData[j].vertexOffset = (int32_t)packet->drawCommands[j].mesh->vertexOffset;
+            frame->drawRecordData[j].firstCommand = first;
+        }
+    }
+    vmaFlushAllocation(allocator, frame->drawRecordAllocation, 0, sizeof(DrawRecord) * count);
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap20.html#vkCmdFillBuffer */
+    vkCmdFillBuffer(commandBuffer, frame->countBuffer, 0, sizeof(uint32_t) * count, 0);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+    graphics_getfrustumplanes(packet->viewProjection, constants.planes);
+    constants.objectCount = count;
+    constants.compact     = drawIndirectCountSupported;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &frame->cullDescriptorSet, 0, NULL);
+    vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap31.html#vkCmdDispatch */
+    vkCmdDispatch(commandBuffer, (count + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+    /* Headless runs read the results back, so a test can check what was drawn */
+    if (frame->cullReadbackBuffer != VK_NULL_HANDLE)
+    {
+        VkBufferCopy region;
+
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+        region.srcOffset = 0;
+        region.dstOffset = 0;
+        region.size      = sizeof(VkDrawIndexedIndirectCommand) * count;
+        vkCmdCopyBuffer(commandBuffer, frame->indirectBuffer, frame->cullReadbackBuffer, 1, &region);
+
+        region.dstOffset = sizeof(VkDrawIndexedIndirectCommand) * frame->instanceCapacity;
+        region.size      = sizeof(uint32_t) * count;
+        vkCmdCopyBuffer(commandBuffer, frame->countBuffer, frame->cullReadbackBuffer, 1, &region);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+        frame->cullReadbackCount   = count;
+        frame->cullReadbackCompact = drawIndirectCountSupported;
+    }
+}
+
+/* Record a range of runs into a command buffer inside the main pass; returns the draw calls made.
+   Nothing is inherited, so each buffer sets up its own state */
+static uint32_t graphics_recorddraws(VkCommandBuffer commandBuffer, const DrawRecording *recording, uint32_t firstRun, uint32_t lastRun)
+{
+    Frame *frame = &frames[frameIndex];
+    RenderPacket *packet = recording->packet;
+
+    /* 3.5. Command Syntax and Duration */
+    VkDeviceSize offset = 0;
+
+    /* 27.9. Controlling the Viewport */
+    VkViewport viewport = { 0 };
+
+    /* 29.2. Scissor Test */
+    VkRect2D scissor = { 0 };
+
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    PipelineLayoutEntry *boundLayout = NULL;
+    GraphicsTexture *boundTexture = NULL;
+    uint32_t boundSpace = UINT32_MAX;
+    uint32_t run, drawCalls = 0;
+
+    viewport.width    = w;
+    viewport.height   = h;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap27.html#vertexpostproc-viewport */
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    scissor.extent.width  = w;
+    scissor.extent.height = h;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap29.html#fragops-scissor */
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    if (firstRun < lastRun)
+    {
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap22.html#vkCmdBindVertexBuffers */
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &meshVertexBuffer, &offset);
+        vkCmdBindVertexBuffers(commandBuffer, 1, 1, &frame->instanceBuffer, &offset);
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap21.html#vkCmdBindIndexBuffer */
+        vkCmdBindIndexBuffer(commandBuffer, meshIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    }
+
+    for (run = firstRun; run < lastRun; run++)
+    {
+        uint32_t first = recording->runs[run].first;
+        uint32_t last  = recording->runs[run].last;
+        DrawCommand *command = &packet->drawCommands[first];
+        PipelineLayoutEntry *layout;
+        VkPipeline pipeline;
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html#pipelines-binding */
+        pipeline = graphics_resolvepipeline(command->pipeline, &layout);
+        if (pipeline != boundPipeline)
+        {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            boundPipeline = pipeline;
+        }
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#descriptorsets-compatibility */
+        if (layout != boundLayout)
+        {
+            boundLayout  = layout;
+            boundSpace   = UINT32_MAX;
+            boundTexture = NULL;
+        }
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#vkCmdPushConstants */
+        if (command->space != boundSpace)
+        {
+            /* Only shaders that declare the view-projection get it */
+            if (layout->key.pushConstantSize >= sizeof(glm::mat4)) {
+                vkCmdPushConstants(commandBuffer, layout->layout, layout->key.pushConstantStages, 0, sizeof(glm::mat4), glm::value_ptr(recording->projections[command->space]));
+            }
+            boundSpace = command->space;
+        }
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap14.html#descriptorsets-binding */
+        if (command->texture != boundTexture)
+        {
+            if (layout->key.setLayoutCount > 0 && layout->key.setLayouts[0] == textureDescriptorSetLayout) {
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout->layout, 0, 1, &command->texture->descriptorSet, 0, NULL);
+            }
+            boundTexture = command->texture;
+        }
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap21.html#drawing */
+        if (first < recording->culled)
+        {
+            VkDeviceSize commandOffset = sizeof(VkDrawIndexedIndirectCommand) * first;
+
+            /* Without a GPU count, culled objects are left in place with no instances */
+            if (drawIndirectCountSupported) {
+                vkCmdDrawIndexedIndirectCountKHR(commandBuffer, frame->indirectBuffer, commandOffset, frame->countBuffer, sizeof(uint32_t) * first,
+                                                 last - first, sizeof(VkDrawIndexedIndirectCommand));
+            } else {
+                vkCmdDrawIndexedIndirect(commandBuffer, frame->indirectBuffer, commandOffset, last - first, sizeof(VkDrawIndexedIndirectCommand));
+            }
+        }
+        else
+        {
+            vkCmdDrawIndexed(commandBuffer, command->mesh->indexCount, last - first, command->mesh->firstIndex, (int32_t)command->mesh->vertexOffset, first);
+        }
+        drawCalls++;
+    }
+    return drawCalls;
+}
+
+/* Record chunks of the runs into the frame's secondary buffers, one pool per chunk */
+static void graphics_recordsecondary(uint32_t first, uint32_t last, void *data)
+{
+    DrawRecording *recording = (DrawRecording *)data;
+    Frame *frame = &frames[frameIndex];
+    VkCommandBufferInheritanceInfo inheritance = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+    VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    uint32_t chunk;
+
+    inheritance.renderPass  = renderPass;
+    inheritance.subpass     = 0;
+    inheritance.framebuffer = framebuffers[imageIndex];
+
+    beginInfo.flags            = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritance;
+
+    for (chunk = first; chunk < last; chunk++)
+    {
+        VkCommandBuffer commandBuffer = frame->secondaryBuffers[chunk];
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#commandbuffers-secondary */
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        recording->drawCalls[chunk] = graphics_recorddraws(commandBuffer, recording,
+                                                           (uint32_t)((uint64_t)recording->runCount * chunk / recording->chunkCount),
+                                                           (uint32_t)((uint64_t)recording->runCount * (chunk + 1) / recording->chunkCount));
+        vkEndCommandBuffer(commandBuffer);
+    }
+}
+
+/* Sort the packet's submissions and draw them in as few calls as possible:
+   world-space objects through the cull pass and indirect draws when available,
+   everything else as one instanced draw per run sharing a pipeline, space and mesh */
+static void graphics_flushdraws(VkCommandBuffer commandBuffer, RenderPacket *packet)
+{
+    Frame *frame = &frames[frameIndex];
+
+    /* 8.4. Render Pass Commands */
+    VkRenderPassBeginInfo renderPassBegin = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+
+    /* 19.3. Clear Values */
+    VkClearValue clearValue = {{CLEAR_COLOR[0], CLEAR_COLOR[1], CLEAR_COLOR[2], CLEAR_COLOR[3]}};
+
+    DrawRecording recording;
+    DrawRun *runs;
+    uint32_t i, first, count, culled = 0, runCount = 0;
+    uint32_t scope, passScope;
+
+    qsort(packet->drawCommands, packet->drawCommandCount, sizeof(DrawCommand), graphics_comparedrawcommands);
+
+    /* Meshes still on the transfer queue are skipped until they are resident */
+    for (i = 0, count = 0; i < packet->drawCommandCount; i++)
+    {
+        if (packet->drawCommands[i].mesh->uploadSerial <= completedTransferSerial) {
+            packet->drawCommands[count++] = packet->drawCommands[i];
+        }
+    }
+
+    /* Instance data is laid out in sorted order, so each run is a contiguous range */
+    if (count > 0)
+    {
+        graphics_reserveinstances(frame, count);
+        job_parallelfor(count, INSTANCE_COPY_GRAIN, graphics_copyinstances, packet);
+        vmaFlushAllocation(allocator, frame->instanceAllocation, 0, sizeof(InstanceData) * count);
+    }
+
+    /* World space sorts first, so the culled objects are a prefix */
+    if (packet->gpuCulling && gpuCullingSupported)
+    {
+        while (culled < count && packet->drawCommands[culled].space == DRAW_SPACE_WORLD)
+        {
+            culled++;
+        }
+        if (culled > 0) {
+            scope = graphics_beginscope(commandBuffer, "cull");
+            graphics_cullinstances(commandBuffer, packet, culled);
+            graphics_endscope(commandBuffer, scope);
+        }
+    }
+
+    /* Group the sorted draws into runs; the culled prefix must match the grouping in graphics_cullinstances */
+    runs = (DrawRun *)memory_framealloc(sizeof(DrawRun) * (count > 0 ? count : 1));
+    for (first = 0; first < count; first = i)
+    {
+        DrawCommand *command = &packet->drawCommands[first];
+
+        if (first < culled)
+        {
+            for (i = first + 1; i < culled && i - first < maxDrawIndirectCount &&
+                 packet->drawCommands[i].pipeline == command->pipeline &&
+                 packet->drawCommands[i].texture == command->texture; i++)
+            {
+            }
+        }
+        else
+        {
+            for (i = first + 1; i < count &&
+                 packet->drawCommands[i].pipeline == command->pipeline &&
+                 packet->drawCommands[i].space == command->space &&
+                 packet->drawCommands[i].texture == command->texture &&
+                 packet->drawCommands[i].mesh == command->mesh; i++)
+            {
+            }
+        }
+        runs[runCount].first = first;
+        runs[runCount].last  = i;
+        runCount++;
+    }
+
+    recording.packet   = packet;
+    recording.runs     = runs;
+    recording.runCount = runCount;
+    recording.culled   = culled;
+
+    /* Screen space has its origin at the top left, in pixels */
+    recording.projections[DRAW_SPACE_WORLD]  = packet->viewProjection;
+    recording.projections[DRAW_SPACE_SCREEN] = glm::ortho(0.0f, (float)w, 0.0f, (float)h);
+
+    /* Large scenes are split across jobs, each chunk in its own secondary buffer */
+    recording.chunkCount = runCount / SECONDARY_DRAW_GRAIN;
+    if (recording.chunkCount > recordingThreads) {
+        recording.chunkCount = recordingThreads;
+    }
+
+    renderPassBegin.renderPass               = renderPass;
+    renderPassBegin.framebuffer              = framebuffers[imageIndex];
+    renderPassBegin.renderArea.extent.width  = w;
+    renderPassBegin.renderArea.extent.height = h;
+    renderPassBegin.clearValueCount          = 1;
+    renderPassBegin.pClearValues             = &clearValue;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap8.html#renderpass-commands */
+    passScope = graphics_beginscope(commandBuffer, "main pass");
+    if (recording.chunkCount > 1)
+    {
+        vkCmdBeginRenderPass(commandBuffer, &renderPassBegin, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        job_parallelfor(recording.chunkCount, 1, graphics_recordsecondary, &recording);
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#vkCmdExecuteCommands */
+        vkCmdExecuteCommands(commandBuffer, recording.chunkCount, frame->secondaryBuffers);
+        for (i = 0; i < recording.chunkCount; i++)
+        {
+            frameStats.drawcalls += recording.drawCalls[i];
+        }
+    }
+    else
+    {
+        vkCmdBeginRenderPass(commandBuffer, &renderPassBegin, VK_SUBPASS_CONTENTS_INLINE);
+        frameStats.drawcalls += graphics_recorddraws(commandBuffer, &recording, 0, runCount);
+    }
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap8.html#vkCmdEndRenderPass */
+    vkCmdEndRenderPass(commandBuffer);
+    graphics_endscope(commandBuffer, passScope);
+
+    frameStats.instances     += count;
+    frameStats.bytesuploaded += (uint32_t)(sizeof(InstanceData) * count);
+
+    /* Keep the sorted, resident draws in case the packet is drawn again */
+    packet->drawCommandCount = count;
+}
+
+/* Take the newest published packet, or keep drawing the last one if the game thread has not published since */
+static RenderPacket *graphics_acquirepacket()
+{
+    RenderPacket *packet;
+
+    if (readyPacket.load(std::memory_order_relaxed) & RENDER_PACKET_FRESH)
+    {
+        drawPacket = readyPacket.exchange(drawPacket, std::memory_order_acq_rel) & ~RENDER_PACKET_FRESH;
+    }
+    packet = &renderPackets[drawPacket];
+
+    /* Nothing recorded from here on can draw them */
+    while (packet->destroyedMeshes != NULL)
+    {
+        GraphicsMesh *mesh = packet->destroyedMeshes;
+
+        packet->destroyedMeshes = mesh->next;
+        mesh->next              = destroyedMeshes;
+        destroyedMeshes         = mesh;
+    }
+    while (packet->destroyedTextures != NULL)
+    {
+        GraphicsTexture *texture = packet->destroyedTextures;
+
+        packet->destroyedTextures = texture->next;
+        texture->next             = destroyedTextures;
+        destroyedTextures         = texture;
+    }
+    return packet;
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#_wsi_surface */
+static void graphics_createsurface()
+{
+    window_vulkan_createsurface(instance, &surface);
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#vkGetPhysicalDeviceSurfaceCapabilitiesKHR */
+static void graphics_getsurfacecapabilities()
+{
+    /* This is a driver round-trip, so it is only made when the swapchain is (re)created */
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevices[0], surface, &surfaceCapabilities);
+    frameStats.surfacequeries++;
+}
+
+/* One image past the minimum lets a frame be recorded while another waits to be shown; low latency keeps to the minimum */
+static uint32_t graphics_chooseimagecount()
+{
+    uint32_t count = surfaceCapabilities.minImageCount + (lowLatency ? 0 : 1);
+
+    if (count < MIN_SWAPCHAIN_IMAGES) {
+        count = MIN_SWAPCHAIN_IMAGES;
+    }
+
+    /* A maxImageCount of 0 means there is no limit */
+    if (surfaceCapabilities.maxImageCount > 0 && count > surfaceCapabilities.maxImageCount) {
+        count = surfaceCapabilities.maxImageCount;
+    }
+    return count;
+}
+
+static void graphics_destroyframebuffers();
+static void graphics_destroyimageviews();
+static void graphics_destroyreleasesemaphores();
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#_wsi_swapchain */
+static void graphics_createswapchain()
+{
+    VkSwapchainCreateInfoKHR createInfo = { VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
+    VkExtent2D imageExtent;
+    VkSwapchainKHR oldSwapchain;
+
+    // Select surface format if not already done
+    if (swapchainSurfaceFormat.format == VK_FORMAT_UNDEFINED) {
+        swapchainSurfaceFormat = graphics_choosesurfaceformat(physicalDevices[0], surface);
+    }
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#VkSurfaceCapabilitiesKHR */
+    if (surfaceCapabilities.currentExtent.width != UINT32_MAX) {
+        imageExtent = surfaceCapabilities.currentExtent;
+    } else {
+        window_getwindowsizeinpixels(&w, &h);
+        imageExtent.width  = w;
+        imageExtent.height = h;
+        if (imageExtent.width < surfaceCapabilities.minImageExtent.width)   imageExtent.width  = surfaceCapabilities.minImageExtent.width;
+        if (imageExtent.width > surfaceCapabilities.maxImageExtent.width)   imageExtent.width  = surfaceCapabilities.maxImageExtent.width;
+        if (imageExtent.height < surfaceCapabilities.minImageExtent.height) imageExtent.height = surfaceCapabilities.minImageExtent.height;
+        if (imageExtent.height > surfaceCapabilities.maxImageExtent.height) imageExtent.height = surfaceCapabilities.maxImageExtent.height;
+    }
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#VkSwapchainCreateInfoKHR */
+    w = imageExtent.width;
+    h = imageExtent.height;
+
+    oldSwapchain = swapchain;
+
+    swapchainPresentMode = graphics_choosepresentmode(physicalDevices[0], surface, presentMode);
+
+    createInfo.surface          = surface;
+    createInfo.minImageCount    = graphics_chooseimagecount();
+    createInfo.imageFormat      = swapchainSurfaceFormat.format;
+    createInfo.imageColorSpace  = swapchainSurfaceFormat.colorSpace;
+    createInfo.imageExtent      = imageExtent;
+    createInfo.imageArrayLayers = 1;
+    createInfo.imageUsage       = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    createInfo.preTransform     = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+    createInfo.compositeAlpha   = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    createInfo.presentMode      = swapchainPresentMode;
+    createInfo.clipped          = VK_TRUE;
+    createInfo.oldSwapchain     = oldSwapchain;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#vkCreateSwapchainKHR */
+    VkResult result = vkCreateSwapchainKHR(device, &createInfo, NULL, &swapchain);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create swapchain: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+
+    if (oldSwapchain != VK_NULL_HANDLE)
+    {
+        graphics_destroyimageviews();
+        graphics_destroyreleasesemaphores();
+
+        /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#vkDestroySwapchainKHR */
+        vkDestroySwapchainKHR(device, oldSwapchain, NULL);
+    }
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#vkGetSwapchainImagesKHR */
+static void graphics_getswapchainimages()
+{
+    vkGetSwapchainImagesKHR(device, swapchain, &swapchainImageCount, NULL);
+    
+    // Validate swapchain image count
+    if (swapchainImageCount == 0) {
+        fprintf(stderr, "No swapchain images available\n");
+        exit(EXIT_FAILURE);
+    }
+    if (swapchainImageCount > 16) {
+        fprintf(stderr, "Too many swapchain images: %u\n", swapchainImageCount);
+        exit(EXIT_FAILURE);
+    }
+    
+    memory_free(swapchainImages, MEMORY_GRAPHICS);
+    swapchainImages = (VkImage *)memory_alloc(sizeof(VkImage) * swapchainImageCount, MEMORY_GRAPHICS);
+    if (!swapchainImages) {
+        fprintf(stderr, "Failed to allocate memory for swapchain images\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    vkGetSwapchainImagesKHR(device, swapchain, &swapchainImageCount, swapchainImages);
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html#resources-images */
+static void graphics_createoffscreenimages()
+{
+    VkImageCreateInfo imageInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    VmaAllocationCreateInfo allocInfo = { 0 };
+    size_t i;
+    VkResult result;
+
+    /* The surface format's fallback, so frames read back match what a window would show */
+    swapchainSurfaceFormat.format     = VK_FORMAT_R8G8B8A8_UNORM;
+    swapchainSurfaceFormat.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+    swapchainImageCount               = MAX_FRAMES_IN_FLIGHT;
+    w                                 = headlessWidth;
+    h                                 = headlessHeight;
+
+    imageInfo.imageType     = VK_IMAGE_TYPE_2D;
+    imageInfo.format        = swapchainSurfaceFormat.format;
+    imageInfo.extent.width  = headlessWidth;
+    imageInfo.extent.height = headlessHeight;
+    imageInfo.extent.depth  = 1;
+    imageInfo.mipLevels     = 1;
+    imageInfo.arrayLayers   = 1;
+    imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage         = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+    swapchainImages      = (VkImage *)memory_alloc(sizeof(VkImage) * swapchainImageCount, MEMORY_GRAPHICS);
+    offscreenAllocations = (VmaAllocation *)memory_alloc(sizeof(VmaAllocation) * swapchainImageCount, MEMORY_GRAPHICS);
+    if (!swapchainImages || !offscreenAllocations) {
+        fprintf(stderr, "Failed to allocate memory for offscreen images\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < swapchainImageCount; i++)
+    {
+        result = vmaCreateImage(allocator, &imageInfo, &allocInfo, &swapchainImages[i], &offscreenAllocations[i], NULL);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create offscreen image %zu: %d\n", i, result);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* One readback buffer per frame in flight, reused every time the frame comes round */
+static void graphics_createreadbackbuffers()
+{
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    VmaAllocationCreateInfo allocInfo = { 0 };
+    VmaAllocationInfo allocationInfo;
+    size_t i;
+    VkResult result;
+
+    bufferInfo.size        = (VkDeviceSize)w * h * 4;
+    bufferInfo.usage       = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    /* Read by the CPU in full, so prefer host-cached memory */
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        result = vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &frames[i].readbackBuffer, &frames[i].readbackAllocation, &allocationInfo);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create readback buffer %zu: %d\n", i, result);
+            exit(EXIT_FAILURE);
+        }
+        frames[i].readbackData = (const uint8_t *)allocationInfo.pMappedData;
+    }
+}
+
+/* Copy the frame's image into its readback buffer, visible to the host once the fence signals */
+static void graphics_recordreadback(VkCommandBuffer commandBuffer)
+{
+    Frame *frame = &frames[frameIndex];
+    VkBufferImageCopy region = { 0 };
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width           = w;
+    region.imageExtent.height          = h;
+    region.imageExtent.depth           = 1;
+
+    /* The render pass left the image in TRANSFER_SRC_OPTIMAL
+       https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap20.html#copies-images */
+    vkCmdCopyImageToBuffer(commandBuffer, swapchainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           frame->readbackBuffer, 1, &region);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         1, &barrier, 0, NULL, 0, NULL);
+
+    frame->readbackFrame   = frame->frameNumber;
+    frame->readbackPending = true;
+}
+
+static void graphics_destroyoffscreenimages()
+{
+    size_t i;
+
+    for (i = MAX_FRAMES_IN_FLIGHT; i-- > 0;)
+    {
+        /* Frames still in flight at exit are written out too */
+        graphics_writereadback(&frames[i]);
+        if (frames[i].readbackBuffer != VK_NULL_HANDLE) {
+            vmaDestroyBuffer(allocator, frames[i].readbackBuffer, frames[i].readbackAllocation);
+            frames[i].readbackBuffer = VK_NULL_HANDLE;
+        }
+    }
+
+    if (offscreenAllocations) {
+        for (i = swapchainImageCount; i-- > 0;)
+        {
+            vmaDestroyImage(allocator, swapchainImages[i], offscreenAllocations[i]);
+        }
+        memory_free(offscreenAllocations, MEMORY_GRAPHICS);
+        offscreenAllocations = NULL;
+    }
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html#resources-image-views */
+static void graphics_createimageviews()
+{
+    VkImageViewCreateInfo createInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    size_t i;
+    VkResult result;
+
+    createInfo.viewType                    = VK_IMAGE_VIEW_TYPE_2D;
+    createInfo.format                      = swapchainSurfaceFormat.format;
+    createInfo.components.r                = VK_COMPONENT_SWIZZLE_IDENTITY;
+    createInfo.components.g                = VK_COMPONENT_SWIZZLE_IDENTITY;
+    createInfo.components.b                = VK_COMPONENT_SWIZZLE_IDENTITY;
+    createInfo.components.a                = VK_COMPONENT_SWIZZLE_IDENTITY;
+    createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    createInfo.subresourceRange.levelCount = 1;
+    createInfo.subresourceRange.layerCount = 1;
+
+    swapchainImageViews = (VkImageView *)memory_alloc(sizeof(VkImageView) * swapchainImageCount, MEMORY_GRAPHICS);
+    if (!swapchainImageViews) {
+        fprintf(stderr, "Failed to allocate memory for swapchain image views\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < swapchainImageCount; i++)
+    {
+        createInfo.image = swapchainImages[i];
+
+        result = vkCreateImageView(device, &createInfo, NULL, &swapchainImageViews[i]);
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "Failed to create image view %zu: %d\n", i, result);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void graphics_destroyframebuffers()
+{
+    size_t i;
+
+    vkQueueWaitIdle(queue);
+
+    if (framebuffers) {
+        for (i = swapchainImageCount; i-- > 0;)
+        {
+            vkDestroyFramebuffer(device, framebuffers[i], NULL);
+        }
+        memory_free(framebuffers, MEMORY_GRAPHICS);
+        framebuffers = NULL;
+    }
+}
+
+static void graphics_destroyimageviews()
+{
+    size_t i;
+
+    if (swapchainImageViews) {
+        for (i = swapchainImageCount; i-- > 0;)
+        {
+            vkDestroyImageView(device, swapchainImageViews[i], NULL);
+        }
+        memory_free(swapchainImageViews, MEMORY_GRAPHICS);
+        swapchainImageViews = NULL;
+    }
+}
+
+static void graphics_destroyfences()
+{
+    size_t i;
+
+    for (i = MAX_FRAMES_IN_FLIGHT; i-- > 0;)
+    {
+        if (frames[i].fence != VK_NULL_HANDLE) {
+            vkDestroyFence(device, frames[i].fence, NULL);
+            frames[i].fence = VK_NULL_HANDLE;
+        }
+    }
+}
+
+static void graphics_freecommandbuffers()
+{
+    size_t i, j;
+
+    for (i = MAX_FRAMES_IN_FLIGHT; i-- > 0;)
+    {
+        for (j = MAX_RECORDING_THREADS; j-- > 0;)
+        {
+            if (frames[i].secondaryBuffers[j] != VK_NULL_HANDLE) {
+                vkFreeCommandBuffers(device, frames[i].secondaryPools[j], 1, &frames[i].secondaryBuffers[j]);
+                frames[i].secondaryBuffers[j] = VK_NULL_HANDLE;
+            }
+        }
+        if (frames[i].commandBuffer != VK_NULL_HANDLE) {
+            vkFreeCommandBuffers(device, frames[i].commandPool, 1, &frames[i].commandBuffer);
+            frames[i].commandBuffer = VK_NULL_HANDLE;
+        }
+    }
+}
+
+static void graphics_destroycommandpools()
+{
+    size_t i, j;
+
+    for (i = MAX_FRAMES_IN_FLIGHT; i-- > 0;)
+    {
+        for (j = MAX_RECORDING_THREADS; j-- > 0;)
+        {
+            if (frames[i].secondaryPools[j] != VK_NULL_HANDLE) {
+                vkDestroyCommandPool(device, frames[i].secondaryPools[j], NULL);
+                frames[i].secondaryPools[j] = VK_NULL_HANDLE;
+            }
+        }
+        if (frames[i].commandPool != VK_NULL_HANDLE) {
+            vkDestroyCommandPool(device, frames[i].commandPool, NULL);
+            frames[i].commandPool = VK_NULL_HANDLE;
+        }
+    }
+}
+
+static void graphics_destroysemaphores()
+{
+    size_t i;
+
+    for (i = MAX_FRAMES_IN_FLIGHT; i-- > 0;)
+    {
+        if (frames[i].acquireSemaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, frames[i].acquireSemaphore, NULL);
+            frames[i].acquireSemaphore = VK_NULL_HANDLE;
+        }
+    }
+}
+
+static void graphics_destroyreleasesemaphores()
+{
+    size_t i;
+
+    if (releaseSemaphores) {
+        for (i = swapchainImageCount; i-- > 0;)
+        {
+            vkDestroySemaphore(device, releaseSemaphores[i], NULL);
+        }
+        memory_free(releaseSemaphores, MEMORY_GRAPHICS);
+        releaseSemaphores = NULL;
+    }
+}
+
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#vkAcquireNextImageKHR */
+static VkResult graphics_acquirenextimage()
+{
+    Frame *frame = &frames[frameIndex];
+    VkResult res;
+    uint32_t i;
+
+    {
+        std::lock_guard<std::mutex> lock(resourceMutex);
+        graphics_waitframe(frame);
+    }
+
+    /* Each frame in flight has an offscreen image of its own, free again once its fence has signaled */
+    if (headless)
+    {
+        imageIndex = frameIndex;
+        res        = VK_SUCCESS;
+    }
+    else
+    {
+        res = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, frame->acquireSemaphore, VK_NULL_HANDLE, &imageIndex);
+    }
+    if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR)
+    {
+        return res;
+    }
+
+    /* The acquire semaphore is now pending, so this frame must be submitted */
+    vkResetFences(device, 1, &frame->fence);
+    vkResetCommandPool(device, frame->commandPool, 0);
+    for (i = 0; i < recordingThreads; i++)
+    {
+        vkResetCommandPool(device, frame->secondaryPools[i], 0);
+    }
+    return res;
+}
+
+static void graphics_recreateswapchain()
+{
+    /* Cleared first, so a resize from the event thread during recreation is not lost */
+    swapchainOutOfDate = false;
+
+    /* Offscreen images keep the size they were created with */
+    if (headless)
+    {
+        minimized = false;
+        return;
+    }
+
+    graphics_getsurfacecapabilities();
+
+    if (surfaceCapabilities.currentExtent.width  == 0 ||
+        surfaceCapabilities.currentExtent.height == 0)
+    {
+        /* Keep the swapchain marked out of date until the window is restored */
+        minimized          = true;
+        swapchainOutOfDate = true;
+        return;
+    }
+
+    vkDeviceWaitIdle(device);
+
+    graphics_destroyframebuffers();
+    graphics_createswapchain();
+    graphics_getswapchainimages();
+    graphics_createreleasesemaphores();
+    graphics_createimageviews();
+    graphics_createframebuffers();
+}
+
+void graphics_init()
+{
+    std::chrono::steady_clock::time_point pipelineStart;
+    std::chrono::duration<double, std::milli> pipelineTime;
+
+#ifndef SURFACE_EXTENSION_NAME
+    if (!headless) {
+        fprintf(stderr, "Built without a window system, rendering headless\n");
+        graphics_setheadless(640, 480, NULL);
+    }
+#endif
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap4.html */
+    graphics_createinstance();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap5.html */
+    graphics_enumeratephysicaldevices();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html */
+    if (!headless) {
+        graphics_createsurface();
+    }
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap5.html */
+    graphics_createdevice();
+    /* https://gpuopen-librariesandsdks.github.io/VulkanMemoryAllocator/html/quick_start.html */
+    graphics_createallocator();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap5.html */
+    graphics_getqueue();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap7.html */
+    graphics_createsemaphores();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap9.html */
+    graphics_createshaders();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html */
+    if (headless) {
+        graphics_createoffscreenimages();
+        graphics_createreadbackbuffers();
+    } else {
+        graphics_getsurfacecapabilities();
+        graphics_createswapchain();
+        graphics_getswapchainimages();
+        graphics_createreleasesemaphores();
+    }
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap8.html */
+    graphics_createrenderpass();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html */
+    graphics_createpipelinecache();
+    graphics_createtexturesetlayout();
+    pipelineStart = std::chrono::steady_clock::now();
+    graphics_createpipelinelibrary();
+    pipelineTime  = std::chrono::steady_clock::now() - pipelineStart;
+    printf("Pipeline cache %s (%zu bytes), pipeline creation took %.3f ms\n",
+           pipelineCacheInitialSize > 0 ? "warm" : "cold", pipelineCacheInitialSize, pipelineTime.count());
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html */
+    graphics_createcommandpools();
+    graphics_allocatecommandbuffers();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap7.html */
+    graphics_createfences();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap18.html */
+    graphics_createquerypools();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html */
+    graphics_createstagingbuffer();
+    graphics_createtransferbatches();
+    graphics_createmesharenas();
+    graphics_createquadmesh();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html#resources-images */
+    graphics_createtexturepool();
+    graphics_createwhitetexture();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html */
+    graphics_createcullpipeline();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html */
+    graphics_createimageviews();
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap8.html */
+    graphics_createframebuffers();
+    atexit(graphics_shutdown);
+}
+
+Shader graphics_createshader(const char *shader, size_t size)
+{
+    VkShaderModule shaderModule = graphics_createshadermodule(shader, size);
+
+    if (shaderModule == VK_NULL_HANDLE) {
+        exit(EXIT_FAILURE);
+    }
+
+    return shaderModule;
+}
+
+/* A shader from a SPIR-V file, rebuilt whenever the file changes while hot reload is on */
+Shader graphics_loadshader(const char *pathname)
+{
+    VkShaderModule shaderModule;
+    size_t i;
+
+    if (strlen(pathname) >= sizeof(shaderSources[0].pathname)) {
+        fprintf(stderr, "Shader path is too long: %s\n", pathname);
+        return NULL;
+    }
+
+    shaderModule = graphics_readshadermodule(pathname);
+    if (shaderModule == VK_NULL_HANDLE) {
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> lock(pipelineMutex);
+    for (i = 0; i < MAX_SHADER_SOURCES; i++)
+    {
+        if (shaderSources[i].shader == VK_NULL_HANDLE) {
+            strcpy(shaderSources[i].pathname, pathname);
+            shaderSources[i].shader = shaderModule;
+            shaderSources[i].module = shaderModule;
+            return shaderModule;
+        }
+    }
+
+    /* Still usable, just not reloadable */
+    fprintf(stderr, "Too many shaders loaded to reload %s\n", pathname);
+    return shaderModule;
+}
+
+void graphics_destroyshader(Shader shader)
+{
+    VkShaderModule module = (VkShaderModule)shader;
+    Frame *frame;
+    size_t i;
+    uint32_t j;
+
+    /* A queued compile or reload may still reference the module */
+    graphics_waitpipelines();
+
+    std::lock_guard<std::mutex> resourceLock(resourceMutex);
+    std::lock_guard<std::mutex> pipelineLock(pipelineMutex);
+
+    for (i = 0; i < MAX_SHADER_SOURCES; i++)
+    {
+        if (shaderSources[i].shader != module) {
+            continue;
+        }
+
+        /* Rebuilds not swapped in yet have nothing left to replace */
+        for (std::deque<ShaderReload *>::iterator it = completedShaderReloads.begin(); it != completedShaderReloads.end();)
+        {
+            if ((*it)->source == i) {
+                (*it)->module = VK_NULL_HANDLE;
+                graphics_discardshaderreload(*it);
+                it = completedShaderReloads.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (shaderSources[i].module != module) {
+            graphics_destroyshadermodule(shaderSources[i].module);
+        }
+        memset(&shaderSources[i], 0, sizeof(ShaderSource));
+    }
+
+    /* The last submitted frame is the newest that can have bound the pipelines */
+    frame = &frames[(frameIndex + framesInFlight - 1) % framesInFlight];
+
+    /* Remove the pipelines built from the module, so a recycled handle cannot hit them and the slots are reused */
+    for (i = 0; i < PIPELINE_LIBRARY_SIZE; i++)
+    {
+        PipelineEntry *entry = &pipelineLibrary[i];
+        VkPipeline pipeline;
+
+        if (entry->slot != PIPELINE_SLOT_OCCUPIED ||
+            (entry->state.vertShader != module && entry->state.fragShader != module)) {
+            continue;
+        }
+
+        /* The fallback for every miss stays, and only loses its module */
+        if (i == defaultPipeline) {
+            if (entry->state.vertShader == module) {
+                entry->state.vertShader = VK_NULL_HANDLE;
+            }
+            if (entry->state.fragShader == module) {
+                entry->state.fragShader = VK_NULL_HANDLE;
+            }
+            continue;
+        }
+
+        /* Rebuilds of the other stage would otherwise swap into the freed slot */
+        for (std::deque<ShaderReload *>::iterator it = completedShaderReloads.begin(); it != completedShaderReloads.end(); ++it)
+        {
+            ShaderReload *reload = *it;
+
+            for (j = reload->count; j-- > 0;)
+            {
+                if (reload->indices[j] != i) {
+                    continue;
+                }
+                if (reload->pipelines[j] != VK_NULL_HANDLE) {
+                    vkDestroyPipeline(device, reload->pipelines[j], NULL);
+                }
+                reload->count--;
+                reload->indices[j]   = reload->indices[reload->count];
+                reload->pipelines[j] = reload->pipelines[reload->count];
+                reload->layouts[j]   = reload->layouts[reload->count];
+            }
+        }
+
+        entry->layout.store(NULL, std::memory_order_relaxed);
+        pipeline = entry->pipeline.exchange(VK_NULL_HANDLE, std::memory_order_acq_rel);
+        if (pipeline != VK_NULL_HANDLE) {
+            graphics_retirepipeline(frame, pipeline);
+        }
+        entry->slot = PIPELINE_SLOT_REMOVED;
+
+        if (currentPipeline == i) {
+            currentPipeline = defaultPipeline;
+        }
+    }
+
+    graphics_destroyshadermodule(module);
+}
+
+int graphics_isminimized()
+{
+    return minimized;
+}
+
+void graphics_minimize()
+{
+    minimized = true;
+}
+
+void graphics_restore()
+{
+    /* The surface extent may have changed while the window was minimized */
+    minimized          = false;
+    swapchainOutOfDate = true;
+}
+
+void graphics_predraw()
+{
+    /* 6.4. Command Buffer Recording */
+    VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+
+    /* 34.10. WSI Swapchain */
+    VkResult res;
+
+    if (swapchainOutOfDate && !minimized)
+    {
+        graphics_recreateswapchain();
+    }
+
+    if (graphics_isminimized())
+    {
+        return;
+    }
+
+    res = graphics_acquirenextimage();
+
+    if (res == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        graphics_recreateswapchain();
+        if (graphics_isminimized())
+        {
+            return;
+        }
+        res = graphics_acquirenextimage();
+    }
+
+    /* A suboptimal image is still signaled; the swapchain is recreated after present */
+    if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR)
+    {
+        return;
+    }
+
+    frameAcquired = true;
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#commandbuffers-recording */
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(frames[frameIndex].commandBuffer, &beginInfo);
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap18.html#vkCmdResetQueryPool */
+    if (frames[frameIndex].queryPool != VK_NULL_HANDLE)
+    {
+        vkCmdResetQueryPool(frames[frameIndex].commandBuffer, frames[frameIndex].queryPool, 0, MAX_PROFILE_SCOPES * 2);
+    }
+    frames[frameIndex].scopeCount  = 0;
+    frames[frameIndex].frameNumber = frameCounter;
+    frames[frameIndex].frameScope  = graphics_beginscope(frames[frameIndex].commandBuffer, "frame");
+}
+
+void graphics_postdraw()
+{
+    /* 6.5. Command Buffer Submission */
+    VkSubmitInfo submit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+
+    /* 7.1.2. Pipeline Stages */
+    VkPipelineStageFlags waitStages[2] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                           VK_PIPELINE_STAGE_TRANSFER_BIT |
+                                           VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT };
+
+    /* 7.4. Semaphores */
+    VkSemaphore waitSemaphores[2];
+
+    std::lock_guard<std::mutex> lock(resourceMutex);
+    RenderPacket *packet = graphics_acquirepacket();
+    uint32_t scope;
+    uint32_t count, i;
+
+    if (!frameAcquired)
+    {
+        /* Nothing is recorded while minimized */
+        return;
+    }
+
+    presentInputTime = packet->inputTime;
+
+    graphics_reloadshaders(&frames[frameIndex]);
+
+    /* Copies must be recorded outside the render pass, and before the draws that read them */
+    scope = graphics_beginscope(frames[frameIndex].commandBuffer, "uploads");
+    graphics_flushuploads(frames[frameIndex].commandBuffer);
+    graphics_flushtextures(frames[frameIndex].commandBuffer);
+    graphics_endscope(frames[frameIndex].commandBuffer, scope);
+    graphics_flushdraws(frames[frameIndex].commandBuffer, packet);
+    if (headless)
+    {
+        scope = graphics_beginscope(frames[frameIndex].commandBuffer, "readback");
+        graphics_recordreadback(frames[frameIndex].commandBuffer);
+        graphics_endscope(frames[frameIndex].commandBuffer, scope);
+    }
+    graphics_endscope(frames[frameIndex].commandBuffer, frames[frameIndex].frameScope);
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#vkEndCommandBuffer */
+    vkEndCommandBuffer(frames[frameIndex].commandBuffer);
+
+    submit.commandBufferCount   = 1;
+    submit.pCommandBuffers      = &frames[frameIndex].commandBuffer;
+    waitSemaphores[0] = frames[frameIndex].acquireSemaphore;
+    waitSemaphores[1] = frames[frameIndex].transferBatch ? frames[frameIndex].transferBatch->semaphore : VK_NULL_HANDLE;
+
+    submit.waitSemaphoreCount   = frames[frameIndex].transferBatch ? 2 : 1;
+    submit.pWaitSemaphores      = waitSemaphores;
+    submit.pWaitDstStageMask    = waitStages;
+    submit.signalSemaphoreCount = 1;
+    submit.pSignalSemaphores    = &releaseSemaphores[imageIndex];
+
+    /* Offscreen images are neither acquired nor presented */
+    if (headless)
+    {
+        submit.waitSemaphoreCount--;
+        submit.pWaitSemaphores      = &waitSemaphores[1];
+        submit.pWaitDstStageMask    = &waitStages[1];
+        submit.signalSemaphoreCount = 0;
+        submit.pSignalSemaphores    = NULL;
+    }
+
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#vkQueueSubmit */
+    vkQueueSubmit(queue, 1, &submit, frames[frameIndex].fence);
+    frames[frameIndex].ready = false;
+
+    graphics_retiremeshes(&frames[frameIndex]);
+    graphics_retiretextures(&frames[frameIndex]);
+
+    /* Advance the ring here rather than at present, so uploads made from now on
+       land in the next frame; a new frame count only takes effect at a frame boundary.
+       Low latency keeps one frame in flight, so the CPU never runs ahead of the GPU */
+    frameCounter++;
+    count = lowLatency ? 1 : pendingFramesInFlight;
+
+    /* Frames past a smaller count leave the ring, so release them now or they never would be */
+    for (i = count; i < framesInFlight; i++)
+    {
+        graphics_waitframe(&frames[i]);
+    }
+    framesInFlight = count;
+    frameIndex     = (frameIndex + 1) % framesInFlight;
+}
+
+/* Time from graphics_markinput to the present of the frame built from that input */
+static void graphics_measurelatency()
+{
+    uint64_t now;
+
+    if (presentInputTime == 0)
+    {
+        return;
+    }
+
+    now = timer_getnanoseconds();
+    std::lock_guard<std::mutex> lock(resourceMutex);
+    lastFrameStats.inputlatencymicroseconds = (uint32_t)((now - presentInputTime) / 1000);
+}
+
+void graphics_present()
+{
+    VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
+    VkResult res;
+
+    /* Statistics are reported for the last frame that reached present */
+    {
+        std::lock_guard<std::mutex> lock(resourceMutex);
+        lastFrameStats = frameStats;
+        memset(&frameStats, 0, sizeof(frameStats));
+    }
+
+    /* Scratch memory from two frames ago is no longer referenced */
+    memory_resetframe();
+
+    if (!frameAcquired)
+    {
+        return;
+    }
+
+    /* The frame is read back instead, when its fence next comes round */
+    if (headless)
+    {
+        frameAcquired = false;
+        graphics_measurelatency();
+        return;
+    }
+
+    presentInfo.swapchainCount     = 1;
+    presentInfo.pSwapchains        = &swapchain;
+    presentInfo.pImageIndices      = &imageIndex;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores    = &releaseSemaphores[imageIndex];
+
+    res = vkQueuePresentKHR(queue, &presentInfo);
+    frameAcquired = false;
+    graphics_measurelatency();
+
+    if (res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        swapchainOutOfDate = true;
+    }
+}
+
+void graphics_resize()
+{
+    /* Recreation is deferred to the next graphics_predraw */
+    minimized          = false;
+    swapchainOutOfDate = true;
+}
+
+void graphics_getstats(GraphicsStats *stats)
+{
+    std::lock_guard<std::mutex> lock(resourceMutex);
+    *stats = lastFrameStats;
+}
+
+/* Write the resolved GPU timings as CSV, or as JSON when the name ends in .json; returns the frames written */
+int graphics_saveprofile(const char *pathname)
+{
+    const char *extension = strrchr(pathname, '.');
+    bool json = extension != NULL && strcmp(extension, ".json") == 0;
+    size_t capacity;
+    size_t length = 0;
+    char *data;
+    uint32_t i, j;
+    int written;
+
+    /* graphics_waitframe resolves scopes into the history under the same lock */
+    std::lock_guard<std::mutex> lock(resourceMutex);
+
+    capacity = 64 + (size_t)profileCount * (32 + MAX_PROFILE_SCOPES * 96);
+    data     = (char *)memory_alloc(capacity, MEMORY_GRAPHICS);
+    if (!data) {
+        fprintf(stderr, "Failed to allocate memory for GPU profile\n");
+        return 0;
+    }
+
+    memory_appendf(&data, &capacity, &length, MEMORY_GRAPHICS, json ? "{\"frames\":[" : "frame,scope,milliseconds\n");
+    for (i = 0; i < profileCount; i++)
+    {
+        const ProfileFrame *profile = &profileHistory[(profileHead + i) % PROFILE_HISTORY];
+
+        if (json) {
+            memory_appendf(&data, &capacity, &length, MEMORY_GRAPHICS, "%s{\"frame\":%llu,\"scopes\":[", i > 0 ? "," : "",
+                           (unsigned long long)profile->frame);
+        }
+        for (j = 0; j < profile->scopeCount; j++)
+        {
+            if (json) {
+                memory_appendf(&data, &capacity, &length, MEMORY_GRAPHICS, "%s{\"name\":\"%.48s\",\"ms\":%.6f}", j > 0 ? "," : "",
+                               profile->names[j], profile->milliseconds[j]);
+            } else {
+                memory_appendf(&data, &capacity, &length, MEMORY_GRAPHICS, "%llu,%.48s,%.6f\n",
+                               (unsigned long long)profile->frame, profile->names[j], profile->milliseconds[j]);
+            }
+        }
+        if (json) {
+            memory_appendf(&data, &capacity, &length, MEMORY_GRAPHICS, "]}");
+        }
+    }
+    if (json) {
+        memory_appendf(&data, &capacity, &length, MEMORY_GRAPHICS, "]}\n");
+    }
+    if (data == NULL) {
+        fprintf(stderr, "Failed to allocate memory for GPU profile\n");
+        return 0;
+    }
+
+    written = filesystem_filewrite(data, length, pathname) == length ? (int)profileCount : 0;
+
+    memory_free(data, MEMORY_GRAPHICS);
+    data = NULL;
+    return written;
+}
+
+void graphics_setframesinflight(int count)
+{
+    if (count < 1) {
+        count = 1;
+    }
+    if ((uint32_t)count > MAX_FRAMES_IN_FLIGHT) {
+        count = MAX_FRAMES_IN_FLIGHT;
+    }
+    /* graphics_postdraw switches at the next frame boundary, releasing any frames dropped from the ring */
+    std::lock_guard<std::mutex> lock(resourceMutex);
+    pendingFramesInFlight = count;
+}
+
+/* Takes effect when the swapchain is recreated, at the next graphics_predraw */
+void graphics_setpresentmode(PresentMode mode)
+{
+    presentMode        = mode;
+    swapchainOutOfDate = true;
+}
+
+/* Trade throughput for latency: the fewest swapchain images the surface allows and one frame in flight */
+void graphics_setlowlatency(int enabled)
+{
+    lowLatency         = enabled != 0;
+    swapchainOutOfDate = true;
+}
+
+/* Called once the frame's input has been read, before it is simulated and drawn */
+void graphics_markinput()
+{
+    renderPackets[writePacket].inputTime = timer_getnanoseconds();
 }
 
-static void graphics_destroyfences()
+void graphics_setshader(Shader _vertShader, Shader _fragShader)
 {
-    size_t i;
+    PipelineState state = defaultPipelineState;
 
-    if (fences) {
-        for (i = swapchainImageCount; i-- > 0;)
-        {
-            vkDestroyFence(device, fences[i], NULL);
-        }
-        free(fences);
-        fences = NULL;
-    }
+    state.vertShader = (VkShaderModule)_vertShader;
+    state.fragShader = (VkShaderModule)_fragShader;
+
+    /* A miss is compiled in the background; the fallback is drawn meanwhile */
+    std::lock_guard<std::mutex> lock(resourceMutex);
+    currentPipeline = graphics_findpipeline(&state, true);
 }
 
-static void graphics_freecommandbuffers()
+Mesh graphics_createmesh(const GraphicsVertex *vertices, uint32_t vertexcount, const uint32_t *indices, uint32_t indexcount)
 {
-    size_t i;
+    GraphicsMesh *mesh;
+    VmaVirtualAllocationCreateInfo allocInfo = { 0 };
+    VkDeviceSize offset;
+    uint32_t *sequentialIndices = NULL;
+    glm::vec3 minimum, maximum;
+    uint64_t serial;
+    uint32_t i;
+
+    mesh = (GraphicsMesh *)memory_poolalloc(meshPool);
+    if (!mesh) {
+        fprintf(stderr, "Failed to allocate memory for mesh\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(mesh, 0, sizeof(GraphicsMesh));
 
-    if (commandBuffers) {
-        for (i = swapchainImageCount; i-- > 0;)
+    /* Every mesh is indexed, so all draws can share one indirect command layout */
+    if (indices == NULL || indexcount == 0)
+    {
+        sequentialIndices = (uint32_t *)memory_framealloc(sizeof(uint32_t) * vertexcount);
+        if (!sequentialIndices) {
+            fprintf(stderr, "Failed to allocate memory for mesh indices\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < vertexcount; i++)
         {
-            vkFreeCommandBuffers(device, commandPools[i], 1, &commandBuffers[i]);
+            sequentialIndices[i] = i;
         }
-        free(commandBuffers);
-        commandBuffers = NULL;
+        indices    = sequentialIndices;
+        indexcount = vertexcount;
     }
-}
 
-static void graphics_destroycommandpools()
-{
-    size_t i;
+    std::unique_lock<std::mutex> lock(resourceMutex);
 
-    if (commandPools) {
-        for (i = swapchainImageCount; i-- > 0;)
-        {
-            vkDestroyCommandPool(device, commandPools[i], NULL);
-        }
-        free(commandPools);
-        commandPools = NULL;
+    allocInfo.size = vertexcount;
+    if (vmaVirtualAllocate(meshVertexBlock, &allocInfo, &mesh->vertexAllocation, &offset) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to allocate %u vertices from the mesh arena\n", vertexcount);
+        exit(EXIT_FAILURE);
     }
-}
-
-static void graphics_destroysemaphores()
-{
-    vkDestroySemaphore(device, releaseSemaphore, NULL);
-    vkDestroySemaphore(device, acquireSemaphore, NULL);
-}
+    mesh->vertexOffset = (uint32_t)offset;
+    mesh->vertexCount  = vertexcount;
 
-/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html#vkAcquireNextImageKHR */
-static VkResult graphics_acquirenextimage()
-{
-    VkResult res;
+    allocInfo.size = indexcount;
+    if (vmaVirtualAllocate(meshIndexBlock, &allocInfo, &mesh->indexAllocation, &offset) != VK_SUCCESS) {
+        fprintf(stderr, "Failed to allocate %u indices from the mesh arena\n", indexcount);
+        exit(EXIT_FAILURE);
+    }
+    mesh->firstIndex = (uint32_t)offset;
+    mesh->indexCount = indexcount;
 
-    res = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, acquireSemaphore, VK_NULL_HANDLE, &imageIndex);
-    if (res != VK_SUCCESS)
-    {
-        return res;
+    mesh->uploadSerial = graphics_uploadbuffer(meshVertexBuffer, sizeof(GraphicsVertex) * mesh->vertexOffset, vertices, sizeof(GraphicsVertex) * vertexcount);
+    serial = graphics_uploadbuffer(meshIndexBuffer, sizeof(uint32_t) * mesh->firstIndex, indices, sizeof(uint32_t) * indexcount);
+    if (serial > mesh->uploadSerial) {
+        mesh->uploadSerial = serial;
     }
-    if (fences[imageIndex] != VK_NULL_HANDLE)
+
+    lock.unlock();
+
+    /* Bounding sphere around the box, for the cull pass */
+    minimum = maximum = glm::make_vec3(vertices[0].position);
+    for (i = 1; i < vertexcount; i++)
     {
-        vkWaitForFences(device, 1, &fences[imageIndex], VK_TRUE, UINT64_MAX);
-        vkResetFences(device, 1, &fences[imageIndex]);
+        minimum = glm::min(minimum, glm::make_vec3(vertices[i].position));
+        maximum = glm::max(maximum, glm::make_vec3(vertices[i].position));
     }
-    if (commandPools[imageIndex] != VK_NULL_HANDLE)
-    {
-        vkResetCommandPool(device, commandPools[imageIndex], 0);
+    mesh->bounds = glm::vec4((minimum + maximum) * 0.5f, glm::length(maximum - minimum) * 0.5f);
+
+    mesh->id   = ++nextMeshId;
+    mesh->next = liveMeshes;
+    if (liveMeshes != NULL) {
+        liveMeshes->prev = mesh;
     }
-    return VK_SUCCESS;
-}
+    liveMeshes = mesh;
 
-void graphics_init()
-{
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap4.html */
-    graphics_createinstance();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap5.html */
-    graphics_enumeratephysicaldevices();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html */
-    graphics_createsurface();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap5.html */
-    graphics_createdevice();
-    /* https://gpuopen-librariesandsdks.github.io/VulkanMemoryAllocator/html/quick_start.html */
-    graphics_createallocator();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap5.html */
-    graphics_getqueue();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap7.html */
-    graphics_createsemaphores();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap9.html */
-    graphics_createshaders();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap34.html */
-    graphics_createswapchain();
-    graphics_getswapchainimages();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap8.html */
-    graphics_createrenderpass();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html */
-    graphics_creategraphicspipeline();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html */
-    graphics_createvertexbuffer();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html */
-    graphics_createcommandpools();
-    graphics_allocatecommandbuffers();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap7.html */
-    graphics_createfences();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html */
-    graphics_createimageviews();
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap8.html */
-    graphics_createframebuffers();
-    atexit(graphics_shutdown);
+    return mesh;
 }
 
-Shader graphics_createshader(const char *shader, size_t size)
+void graphics_destroymesh(Mesh _mesh)
 {
-    VkShaderModule shaderModule;
-    VkShaderModuleCreateInfo createInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-
-    createInfo.codeSize = size;
-    createInfo.pCode    = (const uint32_t *)shader;
+    GraphicsMesh *mesh = (GraphicsMesh *)_mesh;
 
-    VkResult result = vkCreateShaderModule(device, &createInfo, NULL, &shaderModule);
-    if (result != VK_SUCCESS) {
-        fprintf(stderr, "Failed to create shader module: %d\n", result);
-        exit(EXIT_FAILURE);
+    if (mesh->prev != NULL) {
+        mesh->prev->next = mesh->next;
+    } else {
+        liveMeshes = mesh->next;
+    }
+    if (mesh->next != NULL) {
+        mesh->next->prev = mesh->prev;
     }
 
-    return shaderModule;
+    /* Frames in flight, and packets not yet recorded, may still draw it */
+    mesh->prev                                = NULL;
+    mesh->next                                = renderPackets[writePacket].destroyedMeshes;
+    renderPackets[writePacket].destroyedMeshes = mesh;
 }
 
-void graphics_destroyshader(Shader shader)
+static void graphics_destroymeshes()
 {
-    vkDestroyShaderModule(device, (VkShaderModule)shader, NULL);
+    size_t i;
+
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        graphics_freemeshes(frames[i].destroyedMeshes);
+        frames[i].destroyedMeshes = NULL;
+        graphics_destroyinstancebuffers(&frames[i]);
+        graphics_releasestaginguploads(&frames[i]);
+        memory_free(frames[i].stagingUploads, MEMORY_GRAPHICS);
+        frames[i].stagingUploads        = NULL;
+        frames[i].stagingUploadCapacity = 0;
+    }
+    for (i = 0; i < RENDER_PACKET_COUNT; i++)
+    {
+        graphics_freemeshes(renderPackets[i].destroyedMeshes);
+        renderPackets[i].destroyedMeshes = NULL;
+    }
+    graphics_freemeshes(destroyedMeshes);
+    destroyedMeshes = NULL;
+    graphics_freemeshes(liveMeshes);
+    liveMeshes = NULL;
+    quadMesh   = NULL;
+    graphics_destroymesharenas();
 }
 
-int graphics_isminimized()
+Material graphics_creatematerial(Shader _vertShader, Shader _fragShader, const float color[4])
 {
-    VkSurfaceCapabilitiesKHR surfaceCapabilities;
+    GraphicsMaterial *material;
+    PipelineState state = defaultPipelineState;
 
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevices[0], surface, &surfaceCapabilities);
+    material = (GraphicsMaterial *)memory_poolalloc(materialPool);
+    if (!material) {
+        fprintf(stderr, "Failed to allocate memory for material\n");
+        exit(EXIT_FAILURE);
+    }
 
-    if (surfaceCapabilities.currentExtent.width  == 0 &&
-        surfaceCapabilities.currentExtent.height == 0)
+    if (_vertShader != NULL && _fragShader != NULL)
+    {
+        state.vertShader   = (VkShaderModule)_vertShader;
+        state.fragShader   = (VkShaderModule)_fragShader;
+        std::lock_guard<std::mutex> lock(resourceMutex);
+        material->pipeline = graphics_findpipeline(&state, true);
+    }
+    else
     {
-        return 1;
+        material->pipeline = UINT32_MAX;
     }
 
-    return 0;
+    material->color   = color != NULL ? glm::make_vec4(color) : glm::vec4(1.0f);
+    material->texture = whiteTexture;
+    material->id      = ++nextMaterialId;
+
+    return material;
 }
 
-void graphics_predraw()
+void graphics_destroymaterial(Material material)
 {
-    /* 3.5. Command Syntax and Duration */
-    VkDeviceSize offsets[] = {0};
-
-    /* 6.4. Command Buffer Recording */
-    VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    /* Submissions copy what they need, so the material can go at any time */
+    memory_poolfree(materialPool, material);
+}
 
-    /* 8.4. Render Pass Commands */
-    VkRenderPassBeginInfo renderPassBegin = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+/* Pass NULL to go back to sampling white */
+void graphics_setmaterialtexture(Material _material, Texture texture)
+{
+    GraphicsMaterial *material = (GraphicsMaterial *)_material;
 
-    /* 12.1. Buffers */
-    VkBuffer vertexBuffers[] = {vertexBuffer};
+    material->texture = texture != NULL ? (GraphicsTexture *)texture : whiteTexture;
+}
 
-    /* 19.3. Clear Values */
-    VkClearValue clearValue = {{CLEAR_COLOR[0], CLEAR_COLOR[1], CLEAR_COLOR[2], CLEAR_COLOR[3]}};
+/* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap12.html#resources-images */
+/* The image, its view and descriptor set, and staging for the levels the caller gave */
+static GraphicsTexture *graphics_newtexture(VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels,
+                                            const void *const *levels, uint32_t levelCount, TextureFilter filter, TextureWrap wrap)
+{
+    GraphicsTexture *texture;
+    VkImageCreateInfo imageInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    VkImageViewCreateInfo viewInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    VkDescriptorSetAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    VmaAllocationCreateInfo allocInfo = { 0 };
+    VmaAllocationInfo allocationInfo;
+    VkDescriptorImageInfo imageDescriptor;
+    SamplerState samplerState;
+    VkDeviceSize size = 0;
+    VkDeviceSize levelSize;
+    VkResult result;
+    uint32_t i;
 
-    /* 27.9. Controlling the Viewport */
-    VkViewport viewport = { 0 };
+    texture = (GraphicsTexture *)memory_poolalloc(texturePool);
+    if (!texture) {
+        fprintf(stderr, "Failed to allocate memory for texture\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(texture, 0, sizeof(GraphicsTexture));
+    texture->width        = width;
+    texture->height       = height;
+    texture->mipLevels    = mipLevels;
+    texture->format       = format;
+    texture->uploadLevels = levelCount;
+
+    for (i = 0; i < levelCount; i++)
+    {
+        size += graphics_getlevelsize(format, width, height, i);
+    }
 
-    /* 29.2. Scissor Test */
-    VkRect2D scissor = { 0 };
+    imageInfo.imageType     = VK_IMAGE_TYPE_2D;
+    imageInfo.format        = format;
+    imageInfo.extent.width  = width;
+    imageInfo.extent.height = height;
+    imageInfo.extent.depth  = 1;
+    imageInfo.mipLevels     = texture->mipLevels;
+    imageInfo.arrayLayers   = 1;
+    imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage         = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+    std::lock_guard<std::mutex> lock(resourceMutex);
+
+    /* https://gpuopen-librariesandsdks.github.io/VulkanMemoryAllocator/html/group__group__alloc.html#ga02a94f25679275851a53e82eacbcfc73 */
+    result = vmaCreateImage(allocator, &imageInfo, &allocInfo, &texture->image, &texture->allocation, NULL);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create texture image: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
 
-    /* 34.10. WSI Swapchain */
-    VkResult res;
+    viewInfo.image                           = texture->image;
+    viewInfo.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format                          = format;
+    viewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel   = 0;
+    viewInfo.subresourceRange.levelCount     = texture->mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount     = 1;
 
-    if (graphics_isminimized())
-    {
-        return;
+    result = vkCreateImageView(device, &viewInfo, NULL, &texture->view);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create texture image view: %d\n", result);
+        exit(EXIT_FAILURE);
     }
 
-    res = graphics_acquirenextimage();
+    /* The pixels wait here until the next frame records the copy */
+    bufferInfo.size        = size;
+    bufferInfo.usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    if (res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR)
-    {
-        graphics_resize();
-        res = graphics_acquirenextimage();
-    }
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
-    if (res != VK_SUCCESS)
+    result = vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &texture->stagingBuffer, &texture->stagingAllocation, &allocationInfo);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to create texture staging buffer: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0, size = 0; i < levelCount; i++)
     {
-        vkQueueWaitIdle(queue);
-        return;
+        levelSize = graphics_getlevelsize(format, width, height, i);
+        memcpy((char *)allocationInfo.pMappedData + size, levels[i], levelSize);
+        size += levelSize;
     }
+    vmaFlushAllocation(allocator, texture->stagingAllocation, 0, size);
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#commandbuffers-recording */
-    vkBeginCommandBuffer(commandBuffers[imageIndex], &beginInfo);
+    memset(&samplerState, 0, sizeof(samplerState));
+    samplerState.filter        = filter == TEXTURE_FILTER_NEAREST ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
+    samplerState.mipmapMode    = filter == TEXTURE_FILTER_NEAREST ? VK_SAMPLER_MIPMAP_MODE_NEAREST : VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerState.addressMode   = wrap == TEXTURE_WRAP_CLAMP  ? VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE :
+                                 wrap == TEXTURE_WRAP_MIRROR ? VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT :
+                                                               VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerState.maxAnisotropy = filter == TEXTURE_FILTER_NEAREST ? 1.0f : maxSamplerAnisotropy;
 
-    renderPassBegin.renderPass               = renderPass;
-    renderPassBegin.framebuffer              = framebuffers[imageIndex];
-    renderPassBegin.renderArea.extent.width  = w;
-    renderPassBegin.renderArea.extent.height = h;
-    renderPassBegin.clearValueCount          = 1;
-    renderPassBegin.pClearValues             = &clearValue;
+    allocateInfo.descriptorPool     = textureDescriptorPool;
+    allocateInfo.descriptorSetCount = 1;
+    allocateInfo.pSetLayouts        = &textureDescriptorSetLayout;
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap8.html#renderpass-commands */
-    vkCmdBeginRenderPass(commandBuffers[imageIndex], &renderPassBegin, VK_SUBPASS_CONTENTS_INLINE);
+    result = vkAllocateDescriptorSets(device, &allocateInfo, &texture->descriptorSet);
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "Failed to allocate texture descriptor set: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+
+    imageDescriptor.sampler     = graphics_findsampler(&samplerState);
+    imageDescriptor.imageView   = texture->view;
+    imageDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    write.dstSet          = texture->descriptorSet;
+    write.dstBinding      = 0;
+    write.descriptorCount = 1;
+    write.descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo      = &imageDescriptor;
+    vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+
+    texture->nextUpload = pendingTextures;
+    pendingTextures     = texture;
+    frameStats.bytesuploaded += (uint32_t)size;
+
+    texture->id   = ++nextTextureId;
+    texture->next = liveTextures;
+    if (liveTextures != NULL) {
+        liveTextures->prev = texture;
+    }
+    liveTextures = texture;
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap10.html#pipelines-binding */
-    vkCmdBindPipeline(commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    return texture;
+}
 
-    viewport.width    = w;
-    viewport.height   = h;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+Texture graphics_createtexture(const void *pixels, uint32_t width, uint32_t height, TextureFilter filter, TextureWrap wrap)
+{
+    uint32_t mipLevels = 1;
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap27.html#vertexpostproc-viewport */
-    vkCmdSetViewport(commandBuffers[imageIndex], 0, 1, &viewport);
+    /* A full chain down to 1x1; without linear blits, a single level rather than CPU-built mips */
+    if (graphics_isblittable(TEXTURE_FORMAT))
+    {
+        while (((width > height ? width : height) >> mipLevels) > 0)
+        {
+            mipLevels++;
+        }
+    }
+    return graphics_newtexture(TEXTURE_FORMAT, width, height, mipLevels, &pixels, 1, filter, wrap);
+}
 
-    scissor.extent.width  = w;
-    scissor.extent.height = h;
+/* Whether graphics_createtexturelevels takes the format as-is; safe from any thread */
+int graphics_istextureformatsupported(TextureFormat _format)
+{
+    VkFormat format = (VkFormat)_format;
+    VkFormatProperties formatProperties;
+    uint32_t blockWidth, blockHeight, blockSize;
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap29.html#fragops-scissor */
-    vkCmdSetScissor(commandBuffers[imageIndex], 0, 1, &scissor);
+    if (!graphics_getformatblock(format, &blockWidth, &blockHeight, &blockSize)) {
+        return 0;
+    }
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap22.html#vkCmdBindVertexBuffers */
-    vkCmdBindVertexBuffers(commandBuffers[imageIndex], 0, 1, vertexBuffers, offsets);
+    /* Each family needs its device feature, not just format support */
+    if ((format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK && !textureCompressionBC) ||
+        (format >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK && format <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK && !textureCompressionETC2) ||
+        (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK && !textureCompressionASTC)) {
+        return 0;
+    }
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap21.html#vkCmdDraw */
-    vkCmdDraw(commandBuffers[imageIndex], 3, 1, 0, 0);
+    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap47.html#vkGetPhysicalDeviceFormatProperties */
+    vkGetPhysicalDeviceFormatProperties(physicalDevices[0], format, &formatProperties);
+    return (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
 }
 
-void graphics_postdraw()
+/* Prebuilt levels, tightly packed, level 0 first; a lone uncompressed level still gets GPU-built mips */
+Texture graphics_createtexturelevels(TextureFormat _format, uint32_t width, uint32_t height, const void *const *levels, const size_t *sizes, uint32_t levelcount, TextureFilter filter, TextureWrap wrap)
 {
-    /* 6.5. Command Buffer Submission */
-    VkSubmitInfo submit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-
-    /* 7.1.2. Pipeline Stages */
-    VkPipelineStageFlags waitStage = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-
-    if (graphics_isminimized())
+    VkFormat format = (VkFormat)_format;
+    uint32_t blockWidth, blockHeight, blockSize;
+    uint32_t mipLevels = levelcount;
+    uint32_t i;
+
+    if (!graphics_istextureformatsupported(_format)) {
+        fprintf(stderr, "Texture format %d is not supported\n", (int)format);
+        return NULL;
+    }
+    if (levelcount == 0 || levelcount > MAX_TEXTURE_LEVELS || ((width > height ? width : height) >> (levelcount - 1)) == 0) {
+        fprintf(stderr, "Bad texture level count %u for %ux%u\n", levelcount, width, height);
+        return NULL;
+    }
+    for (i = 0; i < levelcount; i++)
     {
-        return;
+        if (sizes[i] != graphics_getlevelsize(format, width, height, i)) {
+            fprintf(stderr, "Texture level %u is %zu bytes, expected %llu\n", i, sizes[i],
+                    (unsigned long long)graphics_getlevelsize(format, width, height, i));
+            return NULL;
+        }
     }
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap8.html#vkCmdEndRenderPass */
-    vkCmdEndRenderPass(commandBuffers[imageIndex]);
+    graphics_getformatblock(format, &blockWidth, &blockHeight, &blockSize);
+    if (levelcount == 1 && blockWidth == 1 && graphics_isblittable(format))
+    {
+        while (((width > height ? width : height) >> mipLevels) > 0)
+        {
+            mipLevels++;
+        }
+    }
+    return graphics_newtexture(format, width, height, mipLevels, levels, levelcount, filter, wrap);
+}
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#vkEndCommandBuffer */
-    vkEndCommandBuffer(commandBuffers[imageIndex]);
+void graphics_destroytexture(Texture _texture)
+{
+    GraphicsTexture *texture = (GraphicsTexture *)_texture;
 
-    submit.commandBufferCount   = 1;
-    submit.pCommandBuffers      = &commandBuffers[imageIndex];
-    submit.waitSemaphoreCount   = 1;
-    submit.pWaitSemaphores      = &acquireSemaphore;
-    submit.pWaitDstStageMask    = &waitStage;
-    submit.signalSemaphoreCount = 1;
-    submit.pSignalSemaphores    = &releaseSemaphore;
+    if (texture->prev != NULL) {
+        texture->prev->next = texture->next;
+    } else {
+        liveTextures = texture->next;
+    }
+    if (texture->next != NULL) {
+        texture->next->prev = texture->prev;
+    }
 
-    /* https://registry.khronos.org/vulkan/specs/1.3-extensions/html/chap6.html#vkQueueSubmit */
-    vkQueueSubmit(queue, 1, &submit, fences[imageIndex]);
+    /* Frames in flight, and packets not yet recorded, may still sample it */
+    texture->prev                                = NULL;
+    texture->next                                = renderPackets[writePacket].destroyedTextures;
+    renderPackets[writePacket].destroyedTextures = texture;
 }
 
-void graphics_present()
+void graphics_setviewprojection(const float viewprojection[16])
 {
-    VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
-    VkResult res;
+    viewProjection = glm::make_mat4(viewprojection);
+}
 
-    if (graphics_isminimized())
-    {
-        return;
-    }
+void graphics_setgpuculling(int enabled)
+{
+    gpuCulling = enabled != 0;
+}
 
-    presentInfo.swapchainCount     = 1;
-    presentInfo.pSwapchains        = &swapchain;
-    presentInfo.pImageIndices      = &imageIndex;
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores    = &releaseSemaphore;
+/* Watch the shaders directory and rebuild the pipelines of any shader written there */
+void graphics_setshaderhotreload(int enabled)
+{
+    std::lock_guard<std::mutex> lock(resourceMutex);
 
-    res = vkQueuePresentKHR(queue, &presentInfo);
+    if (enabled && !shaderWatching) {
+        shaderWatching = watch_add("shaders") != 0;
+        if (!shaderWatching) {
+            fprintf(stderr, "Shader hot reload is not available\n");
+        }
+    }
+    shaderHotReload = enabled && shaderWatching;
+}
 
-    if (res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR)
-    {
-        graphics_resize();
+/* Render offscreen instead of to a window, writing each frame under outputpath when one is given; call before graphics_init */
+void graphics_setheadless(uint32_t width, uint32_t height, const char *outputpath)
+{
+    if (width == 0 || height == 0) {
+        fprintf(stderr, "Invalid headless size %ux%u\n", width, height);
+        exit(EXIT_FAILURE);
+    }
+    if (outputpath != NULL && strlen(outputpath) >= sizeof(headlessOutput)) {
+        fprintf(stderr, "Headless output path is too long: %s\n", outputpath);
+        exit(EXIT_FAILURE);
     }
+
+    headless       = true;
+    headlessWidth  = width;
+    headlessHeight = height;
+    strcpy(headlessOutput, outputpath != NULL ? outputpath : "");
 }
 
-void graphics_resize()
+void graphics_drawmesh(Mesh mesh, Material material, const float transform[16])
 {
-    VkSurfaceCapabilitiesKHR surfaceCapabilities;
+    glm::mat4 model = transform != NULL ? glm::make_mat4(transform) : glm::mat4(1.0f);
 
-    if (device == VK_NULL_HANDLE)
-    {
-        return;
-    }
+    graphics_submitdraw((GraphicsMesh *)mesh, (GraphicsMaterial *)material, model, DRAW_SPACE_WORLD);
+}
 
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevices[0], surface, &surfaceCapabilities);
+/* Publish everything drawn since the last call, dropping a packet the render thread never took */
+void graphics_submitframe()
+{
+    RenderPacket *packet = &renderPackets[writePacket];
+    RenderPacket *next;
 
-    if (surfaceCapabilities.currentExtent.width  == w &&
-        surfaceCapabilities.currentExtent.height == h)
-    {
-        return;
-    }
+    packet->viewProjection = viewProjection;
+    packet->gpuCulling     = gpuCulling;
 
-    vkDeviceWaitIdle(device);
+    writePacket = readyPacket.exchange(writePacket | RENDER_PACKET_FRESH, std::memory_order_acq_rel) & ~RENDER_PACKET_FRESH;
 
-    graphics_destroyframebuffers();
-    graphics_createswapchain();
-    graphics_getswapchainimages();
-    graphics_createcommandpools();
-    graphics_allocatecommandbuffers();
-    graphics_createfences();
-    graphics_createimageviews();
-    graphics_createframebuffers();
+    /* A dropped packet's destroyed meshes ride along with the next one */
+    next = &renderPackets[writePacket];
+    next->drawCommandCount = 0;
+    next->inputTime        = 0;
 }
 
-void graphics_setshader(Shader _vertShader, Shader _fragShader)
+void graphics_drawquad(Material material, float x, float y, float width, float height)
 {
-    vertShader = _vertShader;
-    fragShader = _fragShader;
-    graphics_creategraphicspipeline();
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(x, y, 0.0f));
+
+    model = glm::scale(model, glm::vec3(width, height, 1.0f));
+    graphics_submitdraw(quadMesh, (GraphicsMaterial *)material, model, DRAW_SPACE_SCREEN);
 }
 
 void graphics_shutdown(void)
 {
+    size_t i;
+
     if (device != VK_NULL_HANDLE) {
         vkDeviceWaitIdle(device);
 
         graphics_destroyframebuffers();
         graphics_destroyimageviews();
+        graphics_destroyreleasesemaphores();
+        graphics_destroyoffscreenimages();
 
         if (swapchain != VK_NULL_HANDLE) {
             vkDestroySwapchainKHR(device, swapchain, NULL);
@@ -1300,11 +5787,17 @@ void graphics_shutdown(void)
         if (surface != VK_NULL_HANDLE) {
             vkDestroySurfaceKHR(instance, surface, NULL);
         }
-        if (graphicsPipeline != VK_NULL_HANDLE) {
-            vkDestroyPipeline(device, graphicsPipeline, NULL);
+        graphics_destroypipelinelibrary();
+        graphics_destroycullpipeline();
+        if (vertShader != VK_NULL_HANDLE) {
+            graphics_destroyshader(vertShader);
         }
-        if (pipelineLayout != VK_NULL_HANDLE) {
-            vkDestroyPipelineLayout(device, pipelineLayout, NULL);
+        if (fragShader != VK_NULL_HANDLE) {
+            graphics_destroyshader(fragShader);
+        }
+        if (pipelineCache != VK_NULL_HANDLE) {
+            graphics_savepipelinecache();
+            vkDestroyPipelineCache(device, pipelineCache, NULL);
         }
         if (renderPass != VK_NULL_HANDLE) {
             vkDestroyRenderPass(device, renderPass, NULL);
@@ -1312,12 +5805,17 @@ void graphics_shutdown(void)
 
         graphics_destroysemaphores();
         graphics_destroyfences();
+        graphics_destroyquerypools();
         graphics_freecommandbuffers();
         graphics_destroycommandpools();
 
-        if (vertexBuffer != VK_NULL_HANDLE && allocator != VK_NULL_HANDLE) {
-            vmaDestroyBuffer(allocator, vertexBuffer, allocation);
+        graphics_destroymeshes();
+        graphics_destroytextures();
+        graphics_destroylayouts();
+        if (stagingBuffer != VK_NULL_HANDLE && allocator != VK_NULL_HANDLE) {
+            vmaDestroyBuffer(allocator, stagingBuffer, stagingAllocation);
         }
+        graphics_destroytransferbatches();
         if (allocator != VK_NULL_HANDLE) {
             vmaDestroyAllocator(allocator);
         }
@@ -1326,12 +5824,18 @@ void graphics_shutdown(void)
     }
 
     if (swapchainImages) {
-        free(swapchainImages);
+        memory_free(swapchainImages, MEMORY_GRAPHICS);
         swapchainImages = NULL;
     }
 
+    for (i = 0; i < RENDER_PACKET_COUNT; i++)
+    {
+        memory_free(renderPackets[i].drawCommands, MEMORY_GRAPHICS);
+        renderPackets[i].drawCommands = NULL;
+    }
+
     if (physicalDevices) {
-        free(physicalDevices);
+        memory_free(physicalDevices, MEMORY_GRAPHICS);
         physicalDevices = NULL;
     }
 
@@ -0,0 +1,26 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Decoded pixels, RGBA with 8 bits per channel and rows tightly packed */
+typedef struct Image {
+    uint32_t width;
+    uint32_t height;
+    uint8_t *pixels;
+} Image;
+
+int    image_load(Image *image, const char *pathname);
+void   image_free(Image *image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IMAGE_H */
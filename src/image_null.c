@@ -0,0 +1,16 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "image.h"
+#include <stddef.h>
+
+int image_load(Image *image, const char *pathname)
+{
+    image->width  = 0;
+    image->height = 0;
+    image->pixels = NULL;
+    return 0;
+}
+
+void image_free(Image *image)
+{
+}
@@ -0,0 +1,65 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "image.h"
+#include "filesystem.h"
+#include "memory.h"
+#include <stdio.h>
+#include <string.h>
+#include "SDL3/SDL.h"
+
+/* Decoded from the mapped file, so the bytes are only read once */
+int image_load(Image *image, const char *pathname)
+{
+    FileMapping mapping;
+    SDL_Surface *surface;
+    SDL_Surface *converted;
+    size_t pitch;
+    int y;
+
+    image->width  = 0;
+    image->height = 0;
+    image->pixels = NULL;
+
+    if (!filesystem_map(&mapping, pathname)) {
+        return 0;
+    }
+
+    /* https://wiki.libsdl.org/SDL3/SDL_LoadBMP_IO */
+    surface = SDL_LoadBMP_IO(SDL_IOFromConstMem(mapping.ptr, mapping.size), true);
+    filesystem_unmap(&mapping);
+    if (surface == NULL) {
+        fprintf(stderr, "image_load: can't decode %s: %s\n", pathname, SDL_GetError());
+        return 0;
+    }
+
+    /* SDL_PIXELFORMAT_RGBA32 is R, G, B, A in memory on either endianness */
+    converted = SDL_ConvertSurface(surface, SDL_PIXELFORMAT_RGBA32);
+    SDL_DestroySurface(surface);
+    if (converted == NULL) {
+        fprintf(stderr, "image_load: can't convert %s: %s\n", pathname, SDL_GetError());
+        return 0;
+    }
+
+    pitch = (size_t)converted->w * 4;
+    image->pixels = (uint8_t *) memory_alloc(pitch * converted->h, MEMORY_FILESYSTEM);
+    if (image->pixels == NULL) {
+        SDL_DestroySurface(converted);
+        return 0;
+    }
+    for (y = 0; y < converted->h; y++)
+    {
+        memcpy(image->pixels + pitch * y, (const uint8_t *)converted->pixels + (size_t)converted->pitch * y, pitch);
+    }
+    image->width  = converted->w;
+    image->height = converted->h;
+    SDL_DestroySurface(converted);
+    return 1;
+}
+
+void image_free(Image *image)
+{
+    memory_free(image->pixels, MEMORY_FILESYSTEM);
+    image->pixels = NULL;
+    image->width  = 0;
+    image->height = 0;
+}
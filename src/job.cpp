@@ -0,0 +1,506 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "job.h"
+#include "memory.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/* Constants */
+static const uint32_t MAX_JOB_WORKERS = 32;
+static const int64_t JOB_DEQUE_SIZE = 4096; /* must be a power of two */
+
+struct JobCounterData;
+
+typedef struct Job {
+    JobFunction            function;
+    void                  *data;
+    struct JobCounterData *counter;
+    bool                   main;
+    struct Job            *next;
+} Job;
+
+/* Outstanding jobs, and the jobs waiting for them all to finish */
+typedef struct JobCounterData {
+    std::atomic<int32_t> value;
+    std::mutex           mutex;
+    Job                 *waiters;
+} JobCounterData;
+
+/* Chase-Lev work-stealing deque: the owner pushes and pops at the bottom, thieves take from the top
+   https://www.di.ens.fr/~zappa/readings/ppopp13.pdf */
+typedef struct JobDeque {
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+    std::atomic<Job *>   jobs[JOB_DEQUE_SIZE];
+} JobDeque;
+
+/* Worker 0 is the main thread; threads without a deque submit through the shared queue */
+static JobDeque *deques[MAX_JOB_WORKERS];
+static std::thread workers[MAX_JOB_WORKERS];
+static uint32_t workerCount;
+static thread_local int32_t workerIndex = -1;
+
+static std::mutex queueMutex;
+static std::deque<Job *> sharedQueue;
+static std::deque<Job *> mainQueue;
+
+/* Idle workers sleep until a job is queued */
+static std::mutex sleepMutex;
+static std::condition_variable sleepCondition;
+static std::atomic<uint32_t> pendingJobs;
+static std::atomic<uint32_t> sleepingWorkers;
+static std::atomic<bool> workersStop;
+
+/* Jobs are recycled, so steady-state scheduling does not touch the heap */
+static MemoryPool jobPool;
+
+static bool job_push(JobDeque *deque, Job *job)
+{
+    int64_t bottom = deque->bottom.load(std::memory_order_relaxed);
+    int64_t top    = deque->top.load(std::memory_order_acquire);
+
+    if (bottom - top >= JOB_DEQUE_SIZE)
+    {
+        return false;
+    }
+
+    deque->jobs[bottom & (JOB_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+static Job *job_pop(JobDeque *deque)
+{
+    int64_t bottom = deque->bottom.load(std::memory_order_relaxed) - 1;
+    int64_t top;
+    Job *job;
+
+    deque->bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    top = deque->top.load(std::memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    job = deque->jobs[bottom & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+    if (top == bottom)
+    {
+        /* The last job, which a thief may be taking too */
+        if (!deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            job = NULL;
+        }
+        deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+static Job *job_steal(JobDeque *deque)
+{
+    int64_t top = deque->top.load(std::memory_order_acquire);
+    int64_t bottom;
+    Job *job;
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bottom = deque->bottom.load(std::memory_order_acquire);
+    if (top >= bottom)
+    {
+        return NULL;
+    }
+
+    job = deque->jobs[top & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+    if (!deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    {
+        return NULL;
+    }
+    return job;
+}
+
+static void job_wake()
+{
+    if (sleepingWorkers.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        sleepCondition.notify_one();
+    }
+}
+
+static void job_execute(Job *job);
+
+/* Queue a job whose dependencies are met */
+static void job_schedule(Job *job)
+{
+    if (job->main)
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        mainQueue.push_back(job);
+        return;
+    }
+
+    /* Run inline rather than fail when the deque is full */
+    if (workerIndex >= 0 && deques[workerIndex] != NULL)
+    {
+        pendingJobs++;
+        if (!job_push(deques[workerIndex], job)) {
+            pendingJobs--;
+            job_execute(job);
+            return;
+        }
+        job_wake();
+        return;
+    }
+
+    /* Counted before it is visible, so a worker that takes it cannot decrement first */
+    pendingJobs++;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        sharedQueue.push_back(job);
+    }
+    job_wake();
+}
+
+static void job_decrement(JobCounterData *counter)
+{
+    int32_t value = counter->value.load(std::memory_order_relaxed);
+    Job *waiters;
+    Job *next;
+
+    /* Decrements that cannot reach zero need no lock */
+    while (value > 1)
+    {
+        if (counter->value.compare_exchange_weak(value, value - 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+
+    /* The last one is made under the mutex, so that a waiter that sees zero
+       can take the mutex to know we are done with the counter */
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        if (counter->value.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        waiters          = counter->waiters;
+        counter->waiters = NULL;
+    }
+
+    /* The counter reached zero, so release the jobs that depend on it */
+    for (; waiters != NULL; waiters = next)
+    {
+        next = waiters->next;
+        job_schedule(waiters);
+    }
+}
+
+static void job_execute(Job *job)
+{
+    job->function(job->data);
+    if (job->counter != NULL) {
+        job_decrement(job->counter);
+    }
+    memory_poolfree(jobPool, job);
+}
+
+/* Find a job: our own deque first, then the shared queue, then other workers' deques */
+static Job *job_find()
+{
+    Job *job = NULL;
+    uint32_t i, victim;
+
+    if (workerIndex >= 0 && deques[workerIndex] != NULL)
+    {
+        job = job_pop(deques[workerIndex]);
+        if (job != NULL) {
+            pendingJobs--;
+            return job;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!sharedQueue.empty()) {
+            job = sharedQueue.front();
+            sharedQueue.pop_front();
+            pendingJobs--;
+            return job;
+        }
+    }
+
+    victim = workerIndex >= 0 ? (uint32_t)workerIndex + 1 : 0;
+    for (i = 0; i < workerCount; i++, victim++)
+    {
+        job = job_steal(deques[victim % workerCount]);
+        if (job != NULL) {
+            pendingJobs--;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void job_worker(int32_t index)
+{
+    Job *job;
+
+    workerIndex = index;
+
+    while (!workersStop.load())
+    {
+        job = job_find();
+        if (job != NULL)
+        {
+            PROFILER_BEGIN("job");
+            job_execute(job);
+            PROFILER_END();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers++;
+        while (pendingJobs.load() == 0 && !workersStop.load())
+        {
+            sleepCondition.wait(lock);
+        }
+        sleepingWorkers--;
+    }
+}
+
+static Job *job_create(JobFunction function, void *data, JobCounter counter, bool main)
+{
+    Job *job = (Job *)memory_poolalloc(jobPool);
+
+    job->function = function;
+    job->data     = data;
+    job->counter  = (JobCounterData *)counter;
+    job->main     = main;
+    job->next     = NULL;
+
+    if (job->counter != NULL) {
+        job->counter->value.fetch_add(1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+void job_init()
+{
+    uint32_t i;
+
+    /* One worker per core, the main thread included */
+    workerCount = std::thread::hardware_concurrency();
+    if (workerCount < 2) {
+        workerCount = 2;
+    }
+    if (workerCount > MAX_JOB_WORKERS) {
+        workerCount = MAX_JOB_WORKERS;
+    }
+
+    for (i = 0; i < workerCount; i++)
+    {
+        deques[i] = new JobDeque();
+        deques[i]->top.store(0, std::memory_order_relaxed);
+        deques[i]->bottom.store(0, std::memory_order_relaxed);
+    }
+
+    jobPool     = memory_createpool(sizeof(Job), 1024, MEMORY_JOB);
+    workerIndex = 0;
+    workersStop = false;
+    for (i = 1; i < workerCount; i++)
+    {
+        workers[i] = std::thread(job_worker, (int32_t)i);
+    }
+
+    atexit(job_shutdown);
+}
+
+uint32_t job_getworkercount()
+{
+    return workerCount;
+}
+
+JobCounter job_createcounter()
+{
+    JobCounterData *counter = new JobCounterData();
+
+    counter->value.store(0, std::memory_order_relaxed);
+    counter->waiters = NULL;
+    return counter;
+}
+
+void job_destroycounter(JobCounter _counter)
+{
+    JobCounterData *counter = (JobCounterData *)_counter;
+
+    /* Wait out a final decrement that may still hold the mutex */
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+    }
+    delete counter;
+}
+
+int job_iscomplete(JobCounter counter)
+{
+    return ((JobCounterData *)counter)->value.load(std::memory_order_acquire) == 0;
+}
+
+void job_run(JobFunction function, void *data, JobCounter counter)
+{
+    job_schedule(job_create(function, data, counter, false));
+}
+
+/* Run once dependency has reached zero; jobs counted against it later do not hold this one back */
+void job_runafter(JobCounter _dependency, JobFunction function, void *data, JobCounter counter)
+{
+    JobCounterData *dependency = (JobCounterData *)_dependency;
+    Job *job = job_create(function, data, counter, false);
+
+    if (dependency != NULL)
+    {
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (dependency->value.load(std::memory_order_acquire) > 0) {
+            job->next           = dependency->waiters;
+            dependency->waiters = job;
+            return;
+        }
+    }
+
+    job_schedule(job);
+}
+
+/* Run on the main thread, from job_pump only; job_wait never runs these, so
+   a main job may take locks that a waiting thread holds */
+void job_runmain(JobFunction function, void *data, JobCounter counter)
+{
+    job_schedule(job_create(function, data, counter, true));
+}
+
+/* Help out with queued jobs until counter reaches zero */
+void job_wait(JobCounter _counter)
+{
+    JobCounterData *counter = (JobCounterData *)_counter;
+    Job *job;
+
+    while (counter->value.load(std::memory_order_acquire) > 0)
+    {
+        job = job_find();
+        if (job != NULL) {
+            job_execute(job);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    /* The last decrement may still hold the mutex; the counter can go out of
+       scope once we return */
+    std::lock_guard<std::mutex> lock(counter->mutex);
+}
+
+typedef struct JobRange {
+    JobRangeFunction function;
+    void            *data;
+    uint32_t         first;
+    uint32_t         last;
+} JobRange;
+
+static void job_runrange(void *data)
+{
+    JobRange *range = (JobRange *)data;
+
+    range->function(range->first, range->last, range->data);
+}
+
+/* Call function over [first, last) ranges of at most grain indices and wait for them all */
+void job_parallelfor(uint32_t count, uint32_t grain, JobRangeFunction function, void *data)
+{
+    JobCounterData counter;
+    JobRange *ranges;
+    uint32_t rangeCount;
+    uint32_t i;
+
+    if (grain == 0) {
+        grain = 1;
+    }
+
+    if (count <= grain || workerCount < 2)
+    {
+        function(0, count, data);
+        return;
+    }
+
+    rangeCount = (count + grain - 1) / grain;
+    ranges     = (JobRange *)memory_framealloc(sizeof(JobRange) * rangeCount);
+
+    counter.value.store(0, std::memory_order_relaxed);
+    counter.waiters = NULL;
+
+    for (i = 0; i < rangeCount; i++)
+    {
+        ranges[i].function = function;
+        ranges[i].data     = data;
+        ranges[i].first    = i * grain;
+        ranges[i].last     = i == rangeCount - 1 ? count : (i + 1) * grain;
+    }
+
+    /* The calling thread takes the first range itself */
+    for (i = 1; i < rangeCount; i++)
+    {
+        job_run(job_runrange, &ranges[i], &counter);
+    }
+    job_runrange(&ranges[0]);
+    job_wait(&counter);
+}
+
+/* Run the jobs queued for the main thread; called once per frame */
+void job_pump()
+{
+    Job *job;
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (mainQueue.empty()) {
+                return;
+            }
+            job = mainQueue.front();
+            mainQueue.pop_front();
+        }
+        job_execute(job);
+    }
+}
+
+void job_shutdown(void)
+{
+    uint32_t i;
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        workersStop = true;
+        sleepCondition.notify_all();
+    }
+
+    for (i = 1; i < workerCount; i++)
+    {
+        if (workers[i].joinable()) {
+            workers[i].join();
+        }
+    }
+
+    for (i = 0; i < workerCount; i++)
+    {
+        delete deques[i];
+        deques[i] = NULL;
+    }
+    workerCount = 0;
+
+    memory_destroypool(jobPool);
+    jobPool = NULL;
+}
@@ -0,0 +1,33 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void *JobCounter;
+typedef void (*JobFunction)(void *data);
+typedef void (*JobRangeFunction)(uint32_t first, uint32_t last, void *data);
+
+void       job_init();
+uint32_t   job_getworkercount();
+JobCounter job_createcounter();
+void       job_destroycounter(JobCounter counter);
+int        job_iscomplete(JobCounter counter);
+void       job_run(JobFunction function, void *data, JobCounter counter);
+void       job_runafter(JobCounter dependency, JobFunction function, void *data, JobCounter counter);
+void       job_runmain(JobFunction function, void *data, JobCounter counter);
+void       job_wait(JobCounter counter);
+void       job_parallelfor(uint32_t count, uint32_t grain, JobRangeFunction function, void *data);
+void       job_pump();
+void       job_shutdown(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JOB_H */
@@ -0,0 +1,88 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "ktx2.h"
+#include <stdio.h>
+#include <string.h>
+
+static const unsigned char ktx2Identifier[12] = {
+    0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'
+};
+
+/* https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html#_file_structure */
+typedef struct Ktx2Header {
+    unsigned char identifier[12];
+    uint32_t      vkformat;
+    uint32_t      typesize;
+    uint32_t      pixelwidth;
+    uint32_t      pixelheight;
+    uint32_t      pixeldepth;
+    uint32_t      layercount;
+    uint32_t      facecount;
+    uint32_t      levelcount;
+    uint32_t      supercompressionscheme;
+    uint32_t      dfdbyteoffset;
+    uint32_t      dfdbytelength;
+    uint32_t      kvdbyteoffset;
+    uint32_t      kvdbytelength;
+    uint64_t      sgdbyteoffset;
+    uint64_t      sgdbytelength;
+} Ktx2Header;
+
+typedef struct Ktx2LevelIndex {
+    uint64_t byteoffset;
+    uint64_t bytelength;
+    uint64_t uncompressedbytelength;
+} Ktx2LevelIndex;
+
+/* Check everything up front, so the levels can be read without further bounds checks */
+int ktx2_parse(Ktx2Texture *texture, const void *ptr, size_t size)
+{
+    const unsigned char *base = (const unsigned char *)ptr;
+    Ktx2Header header;
+    Ktx2LevelIndex level;
+    uint32_t i, levelcount;
+
+    memset(texture, 0, sizeof(Ktx2Texture));
+
+    if (size < sizeof(Ktx2Header) || memcmp(base, ktx2Identifier, sizeof(ktx2Identifier)) != 0) {
+        fprintf(stderr, "ktx2_parse: not a KTX2 file\n");
+        return 0;
+    }
+    memcpy(&header, base, sizeof(Ktx2Header));
+
+    /* VK_FORMAT_UNDEFINED means a Basis Universal payload, which needs its own transcoder */
+    if (header.vkformat == 0 || header.supercompressionscheme != 0) {
+        fprintf(stderr, "ktx2_parse: supercompressed files are not supported\n");
+        return 0;
+    }
+    if (header.pixelwidth == 0 || header.pixelheight == 0 || header.pixeldepth > 1 ||
+        header.layercount > 1 || header.facecount != 1) {
+        fprintf(stderr, "ktx2_parse: only single 2D images are supported\n");
+        return 0;
+    }
+
+    /* Zero asks the loader to generate the mips, which we do for uncompressed formats anyway */
+    levelcount = header.levelcount > 0 ? header.levelcount : 1;
+    if (levelcount > KTX2_MAX_LEVELS ||
+        (size - sizeof(Ktx2Header)) / sizeof(Ktx2LevelIndex) < levelcount) {
+        fprintf(stderr, "ktx2_parse: bad level count %u\n", header.levelcount);
+        return 0;
+    }
+
+    for (i = 0; i < levelcount; i++)
+    {
+        memcpy(&level, base + sizeof(Ktx2Header) + sizeof(Ktx2LevelIndex) * i, sizeof(Ktx2LevelIndex));
+        if (level.byteoffset > size || size - level.byteoffset < level.bytelength || level.bytelength == 0) {
+            fprintf(stderr, "ktx2_parse: level %u out of bounds\n", i);
+            return 0;
+        }
+        texture->levels[i].data = base + level.byteoffset;
+        texture->levels[i].size = (size_t)level.bytelength;
+    }
+
+    texture->format     = header.vkformat;
+    texture->width      = header.pixelwidth;
+    texture->height     = header.pixelheight;
+    texture->levelcount = levelcount;
+    return 1;
+}
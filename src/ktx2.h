@@ -0,0 +1,42 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A KTX2 file is a little-endian header, a level index, then the levels
+ * themselves, smallest first. Only what textures need is read: one 2D
+ * image with its mip levels, without supercompression, in a VkFormat.
+ *
+ * https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+ */
+#define KTX2_MAX_LEVELS 16
+
+typedef struct Ktx2Level {
+    const void *data;
+    size_t      size;
+} Ktx2Level;
+
+/* Views into the bytes given to ktx2_parse, valid as long as they are */
+typedef struct Ktx2Texture {
+    uint32_t  format;        /* a VkFormat */
+    uint32_t  width;
+    uint32_t  height;
+    uint32_t  levelcount;    /* level 0 is the full-size image */
+    Ktx2Level levels[KTX2_MAX_LEVELS];
+} Ktx2Texture;
+
+int    ktx2_parse(Ktx2Texture *texture, const void *ptr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KTX2_H */
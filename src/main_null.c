@@ -2,38 +2,87 @@
 
 #include "framework.h"
 #include "event.h"
+#include "filesystem.h"
 #include "timer.h"
 #include "graphics.h"
+#include "job.h"
+#include "profiler.h"
+
+/* How far between the last two ticks the frame is drawn */
+static float alpha = 1.0f;
 
 static void load(int argc, char *argv[])
 {
-    framework_init(argv[0]);
+    framework_init(argc, argv);
     framework_load(argc, argv);
 }
 
 static void update()
 {
-    uint64_t dt = timer_step();
-    framework_update(dt);
+    alpha = framework_advance(timer_step());
 }
 
-static void draw()
+/* Record and present the newest render packet */
+static void render()
 {
+    PROFILER_BEGIN("graphics_predraw");
     graphics_predraw();
-    framework_draw();
+    PROFILER_END();
+
+    PROFILER_BEGIN("graphics_postdraw");
     graphics_postdraw();
+    PROFILER_END();
+
+    PROFILER_BEGIN("graphics_present");
     graphics_present();
+    PROFILER_END();
+}
+
+/* There are no threads without a platform, so the packet is always rendered inline */
+static void draw()
+{
+    PROFILER_BEGIN("framework_draw");
+    framework_draw(alpha);
+    PROFILER_END();
+
+    graphics_submitframe();
+    render();
 }
 
 int main(int argc, char *argv[])
 {
     load(argc, argv);
 
-    while (event_poll()) {
+    for (;;) {
+        int running;
+
+        PROFILER_BEGIN("frame");
+        PROFILER_BEGIN("event_poll");
+        running = event_poll();
+        PROFILER_END();
+        if (!running) {
+            PROFILER_END();
+            break;
+        }
+        graphics_markinput();
+
+        job_pump();
+        filesystem_update();
         update();
         draw();
+        PROFILER_END();
+
+        /* A run with --frames ends as if asked to quit */
+        if (framework_isfinished() && framework_quit()) {
+            break;
+        }
+
+        timer_pace();
 
-        timer_sleep(1);
+        /* Nothing is presented while minimized, so presentation no longer throttles the loop */
+        if (graphics_isminimized()) {
+            timer_sleep(1);
+        }
     }
 
     return 0;
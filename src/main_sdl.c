@@ -4,39 +4,161 @@
 #include "SDL3/SDL_main.h"
 #include "framework.h"
 #include "event.h"
+#include "filesystem.h"
 #include "timer.h"
 #include "graphics.h"
+#include "job.h"
+#include "profiler.h"
+
+/* How far between the last two ticks the frame is drawn */
+static float alpha = 1.0f;
+
+/* Render thread, when framework_isthreaded is set after load; event_poll stays on the main thread */
+static SDL_Thread *renderthread = NULL;
+static SDL_Semaphore *packetready = NULL;
+static SDL_Semaphore *packettaken = NULL;
+static SDL_AtomicInt renderrunning;
 
 static void load(int argc, char *argv[])
 {
-    framework_init(argv[0]);
+    framework_init(argc, argv);
     framework_load(argc, argv);
 }
 
 static void update()
 {
-    uint64_t dt = timer_step();
-    framework_update(dt);
+    alpha = framework_advance(timer_step());
 }
 
-static void draw()
+/* Record and present the newest render packet */
+static void render()
 {
+    PROFILER_BEGIN("graphics_predraw");
     graphics_predraw();
-    framework_draw();
+    PROFILER_END();
+
+    PROFILER_BEGIN("graphics_postdraw");
     graphics_postdraw();
+    PROFILER_END();
+
+    PROFILER_BEGIN("graphics_present");
     graphics_present();
+    PROFILER_END();
+}
+
+static int SDLCALL renderloop(void *data)
+{
+    (void)data;
+
+    for (;;) {
+        /* Drain extra wakeups; graphics_postdraw always takes the newest packet */
+        SDL_WaitSemaphore(packetready);
+        while (SDL_TryWaitSemaphore(packetready)) {
+        }
+        if (!SDL_GetAtomicInt(&renderrunning)) {
+            break;
+        }
+
+        PROFILER_BEGIN("render");
+        render();
+        PROFILER_END();
+
+        SDL_SignalSemaphore(packettaken);
+    }
+
+    return 0;
+}
+
+static void draw()
+{
+    PROFILER_BEGIN("framework_draw");
+    framework_draw(alpha);
+    PROFILER_END();
+
+    if (renderthread == NULL)
+    {
+        graphics_submitframe();
+        render();
+        return;
+    }
+
+    /* Stay at most one packet ahead, so none is dropped unseen */
+    PROFILER_BEGIN("wait_render");
+    SDL_WaitSemaphore(packettaken);
+    PROFILER_END();
+
+    graphics_submitframe();
+    SDL_SignalSemaphore(packetready);
+}
+
+static void startrenderthread()
+{
+    packetready  = SDL_CreateSemaphore(0);
+    packettaken  = SDL_CreateSemaphore(1);
+    SDL_SetAtomicInt(&renderrunning, 1);
+    renderthread = SDL_CreateThread(renderloop, "render", NULL);
+    if (renderthread == NULL) {
+        SDL_Log("Failed to create render thread: %s", SDL_GetError());
+    }
+}
+
+static void stoprenderthread()
+{
+    if (renderthread == NULL)
+    {
+        return;
+    }
+
+    SDL_SetAtomicInt(&renderrunning, 0);
+    SDL_SignalSemaphore(packetready);
+    SDL_WaitThread(renderthread, NULL);
+    renderthread = NULL;
+
+    SDL_DestroySemaphore(packettaken);
+    SDL_DestroySemaphore(packetready);
 }
 
 int main(int argc, char *argv[])
 {
     load(argc, argv);
 
-    while (event_poll()) {
+    if (framework_isthreaded())
+    {
+        startrenderthread();
+    }
+
+    for (;;) {
+        int running;
+
+        PROFILER_BEGIN("frame");
+        PROFILER_BEGIN("event_poll");
+        running = event_poll();
+        PROFILER_END();
+        if (!running) {
+            PROFILER_END();
+            break;
+        }
+        graphics_markinput();
+
+        job_pump();
+        filesystem_update();
         update();
         draw();
+        PROFILER_END();
+
+        /* A run with --frames ends as if asked to quit */
+        if (framework_isfinished() && framework_quit()) {
+            break;
+        }
+
+        timer_pace();
 
-        timer_sleep(1);
+        /* Nothing is presented while minimized, so presentation no longer throttles the loop */
+        if (graphics_isminimized()) {
+            timer_sleep(1);
+        }
     }
 
+    stoprenderthread();
     return 0;
 }
@@ -0,0 +1,403 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "memory.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+/* Constants */
+static const size_t FRAME_ARENA_SIZE = 4 * 1024 * 1024;
+static const size_t MEMORY_ALIGNMENT = 16;
+
+/* The arena half being allocated from, in the top bit of frameArenaHead */
+static const uint64_t FRAME_ARENA_HALF = (uint64_t)1 << 63;
+
+/* Prepended to heap allocations so frees know their size */
+typedef union MemoryHeader {
+    size_t      size;
+    max_align_t alignment;
+} MemoryHeader;
+
+typedef struct MemoryCounters {
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> frees;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> frameallocations;
+} MemoryCounters;
+
+static MemoryCounters counters[MEMORY_TAG_COUNT];
+
+/* Allocations made with operator new, which is how std containers reach the heap */
+static std::atomic<uint64_t> newFrameAllocations;
+
+/* Allocations that did not fit in an arena half, freed when that half is reused */
+typedef struct FrameOverflow {
+    struct FrameOverflow *next;
+} FrameOverflow;
+
+/* Double-buffered, so an allocation stays valid until the second reset after it */
+static char *frameArena[2];
+static std::atomic<uint64_t> frameArenaHead;
+static FrameOverflow *frameOverflow[2];
+static std::mutex frameOverflowMutex;
+
+typedef struct MemoryBlock {
+    struct MemoryBlock *next;
+} MemoryBlock;
+
+typedef struct MemoryPoolData {
+    size_t       size;
+    uint32_t     count;
+    MemoryTag    tag;
+    std::mutex   mutex;
+    MemoryBlock *blocks;
+    void        *freeList;
+} MemoryPoolData;
+
+static size_t memory_align(size_t size)
+{
+    return (size + MEMORY_ALIGNMENT - 1) & ~(MEMORY_ALIGNMENT - 1);
+}
+
+void memory_init()
+{
+    size_t i;
+
+    for (i = 0; i < 2; i++)
+    {
+        frameArena[i] = (char *)malloc(FRAME_ARENA_SIZE);
+        if (!frameArena[i]) {
+            fprintf(stderr, "Failed to allocate memory for frame arena\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    frameArenaHead.store(0, std::memory_order_relaxed);
+
+    atexit(memory_shutdown);
+}
+
+void *memory_alloc(size_t size, MemoryTag tag)
+{
+    MemoryHeader *header = (MemoryHeader *)malloc(sizeof(MemoryHeader) + size);
+
+    if (header == NULL)
+    {
+        return NULL;
+    }
+
+    header->size = size;
+    counters[tag].allocations.fetch_add(1, std::memory_order_relaxed);
+    counters[tag].frameallocations.fetch_add(1, std::memory_order_relaxed);
+    counters[tag].bytes.fetch_add(size, std::memory_order_relaxed);
+    return header + 1;
+}
+
+void *memory_calloc(size_t count, size_t size, MemoryTag tag)
+{
+    void *ptr = memory_alloc(count * size, tag);
+
+    if (ptr != NULL)
+    {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void *memory_realloc(void *ptr, size_t size, MemoryTag tag)
+{
+    MemoryHeader *header;
+    size_t oldSize;
+
+    if (ptr == NULL)
+    {
+        return memory_alloc(size, tag);
+    }
+
+    header  = (MemoryHeader *)ptr - 1;
+    oldSize = header->size;
+    header  = (MemoryHeader *)realloc(header, sizeof(MemoryHeader) + size);
+    if (header == NULL)
+    {
+        return NULL;
+    }
+
+    header->size = size;
+    counters[tag].allocations.fetch_add(1, std::memory_order_relaxed);
+    counters[tag].frees.fetch_add(1, std::memory_order_relaxed);
+    counters[tag].frameallocations.fetch_add(1, std::memory_order_relaxed);
+    counters[tag].bytes.fetch_add(size - oldSize, std::memory_order_relaxed);
+    return header + 1;
+}
+
+void memory_free(void *ptr, MemoryTag tag)
+{
+    MemoryHeader *header;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    header = (MemoryHeader *)ptr - 1;
+    counters[tag].frees.fetch_add(1, std::memory_order_relaxed);
+    counters[tag].bytes.fetch_sub(header->size, std::memory_order_relaxed);
+    free(header);
+}
+
+/* Append to text built with memory_alloc, doubling the buffer when it does not fit; frees it and leaves NULL on failure */
+void memory_appendf(char **data, size_t *capacity, size_t *length, MemoryTag tag, const char *format, ...)
+{
+    va_list args;
+    char *grown;
+    int written;
+
+    while (*data != NULL)
+    {
+        va_start(args, format);
+        written = vsnprintf(*data + *length, *capacity - *length, format, args);
+        va_end(args);
+        if (written < 0) {
+            return;
+        }
+        if ((size_t)written < *capacity - *length) {
+            *length += written;
+            return;
+        }
+
+        grown = (char *)memory_realloc(*data, *capacity * 2 + written, tag);
+        if (!grown) {
+            memory_free(*data, tag);
+            *data = NULL;
+            return;
+        }
+        *data     = grown;
+        *capacity = *capacity * 2 + written;
+    }
+}
+
+/* Scratch memory for the rest of this frame and the next; never freed individually */
+void *memory_framealloc(size_t size)
+{
+    uint64_t head = frameArenaHead.fetch_add(memory_align(size), std::memory_order_relaxed);
+    uint32_t half = (head & FRAME_ARENA_HALF) ? 1 : 0;
+    uint64_t offset = head & ~FRAME_ARENA_HALF;
+    FrameOverflow *overflow;
+
+    if (frameArena[half] != NULL && offset + size <= FRAME_ARENA_SIZE)
+    {
+        return frameArena[half] + offset;
+    }
+
+    /* Too big for what is left, so fall back to the heap until the half is reused */
+    overflow = (FrameOverflow *)memory_alloc(memory_align(sizeof(FrameOverflow)) + size, MEMORY_FRAMEWORK);
+    if (!overflow) {
+        fprintf(stderr, "Failed to allocate frame memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    std::lock_guard<std::mutex> lock(frameOverflowMutex);
+    overflow->next      = frameOverflow[half];
+    frameOverflow[half] = overflow;
+    return (char *)overflow + memory_align(sizeof(FrameOverflow));
+}
+
+/* Switch arena halves, reclaiming the one used two frames ago; called from graphics_present */
+void memory_resetframe()
+{
+    uint64_t head = frameArenaHead.load(std::memory_order_relaxed);
+    uint32_t half = (head & FRAME_ARENA_HALF) ? 0 : 1;
+    FrameOverflow *overflow;
+    FrameOverflow *next;
+    size_t i;
+
+    {
+        std::lock_guard<std::mutex> lock(frameOverflowMutex);
+        overflow            = frameOverflow[half];
+        frameOverflow[half] = NULL;
+    }
+    for (; overflow != NULL; overflow = next)
+    {
+        next = overflow->next;
+        memory_free(overflow, MEMORY_FRAMEWORK);
+    }
+
+    frameArenaHead.store(half ? FRAME_ARENA_HALF : 0, std::memory_order_relaxed);
+
+    for (i = 0; i < MEMORY_TAG_COUNT; i++)
+    {
+        counters[i].frameallocations.store(0, std::memory_order_relaxed);
+    }
+    newFrameAllocations.store(0, std::memory_order_relaxed);
+}
+
+/* Fixed-size objects, carved count at a time from blocks that are only released with the pool */
+MemoryPool memory_createpool(size_t size, uint32_t count, MemoryTag tag)
+{
+    MemoryPoolData *pool = new MemoryPoolData();
+
+    pool->size     = memory_align(size < sizeof(void *) ? sizeof(void *) : size);
+    pool->count    = count > 0 ? count : 1;
+    pool->tag      = tag;
+    pool->blocks   = NULL;
+    pool->freeList = NULL;
+    return pool;
+}
+
+void memory_destroypool(MemoryPool _pool)
+{
+    MemoryPoolData *pool = (MemoryPoolData *)_pool;
+    MemoryBlock *block;
+    MemoryBlock *next;
+
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    for (block = pool->blocks; block != NULL; block = next)
+    {
+        next = block->next;
+        memory_free(block, pool->tag);
+    }
+    delete pool;
+}
+
+void *memory_poolalloc(MemoryPool _pool)
+{
+    MemoryPoolData *pool = (MemoryPoolData *)_pool;
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    MemoryBlock *block;
+    char *object;
+    uint32_t i;
+    void *ptr;
+
+    if (pool->freeList == NULL)
+    {
+        block = (MemoryBlock *)memory_alloc(memory_align(sizeof(MemoryBlock)) + pool->size * pool->count, pool->tag);
+        if (!block) {
+            fprintf(stderr, "Failed to allocate memory for pool\n");
+            exit(EXIT_FAILURE);
+        }
+        block->next  = pool->blocks;
+        pool->blocks = block;
+
+        object = (char *)block + memory_align(sizeof(MemoryBlock));
+        for (i = 0; i < pool->count; i++, object += pool->size)
+        {
+            *(void **)object = pool->freeList;
+            pool->freeList   = object;
+        }
+    }
+
+    ptr            = pool->freeList;
+    pool->freeList = *(void **)ptr;
+    return ptr;
+}
+
+void memory_poolfree(MemoryPool _pool, void *ptr)
+{
+    MemoryPoolData *pool = (MemoryPoolData *)_pool;
+    std::lock_guard<std::mutex> lock(pool->mutex);
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    *(void **)ptr  = pool->freeList;
+    pool->freeList = ptr;
+}
+
+void memory_getstats(MemoryTag tag, MemoryStats *stats)
+{
+    stats->allocations      = counters[tag].allocations.load(std::memory_order_relaxed);
+    stats->frees            = counters[tag].frees.load(std::memory_order_relaxed);
+    stats->bytes            = counters[tag].bytes.load(std::memory_order_relaxed);
+    stats->frameallocations = counters[tag].frameallocations.load(std::memory_order_relaxed);
+}
+
+/* Heap allocations across every subsystem, and through operator new, since the last memory_resetframe */
+uint64_t memory_getframeallocations()
+{
+    uint64_t total = newFrameAllocations.load(std::memory_order_relaxed);
+    size_t i;
+
+    for (i = 0; i < MEMORY_TAG_COUNT; i++)
+    {
+        total += counters[i].frameallocations.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void memory_shutdown(void)
+{
+    FrameOverflow *overflow;
+    FrameOverflow *next;
+    size_t i;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (overflow = frameOverflow[i]; overflow != NULL; overflow = next)
+        {
+            next = overflow->next;
+            memory_free(overflow, MEMORY_FRAMEWORK);
+        }
+        frameOverflow[i] = NULL;
+
+        free(frameArena[i]);
+        frameArena[i] = NULL;
+    }
+}
+
+/* https://en.cppreference.com/w/cpp/memory/new/operator_new#Global_replacements */
+void *operator new(size_t size)
+{
+    void *ptr = malloc(size > 0 ? size : 1);
+
+    if (ptr == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    newFrameAllocations.fetch_add(1, std::memory_order_relaxed);
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    newFrameAllocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size > 0 ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
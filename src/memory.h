@@ -0,0 +1,51 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum MemoryTag {
+    MEMORY_FRAMEWORK,
+    MEMORY_FILESYSTEM,
+    MEMORY_GRAPHICS,
+    MEMORY_JOB,
+    MEMORY_PROFILER,
+    MEMORY_TAG_COUNT
+} MemoryTag;
+
+typedef struct MemoryStats {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t bytes;
+    uint64_t frameallocations;
+} MemoryStats;
+
+typedef void *MemoryPool;
+
+void       memory_init();
+void      *memory_alloc(size_t size, MemoryTag tag);
+void      *memory_calloc(size_t count, size_t size, MemoryTag tag);
+void      *memory_realloc(void *ptr, size_t size, MemoryTag tag);
+void       memory_free(void *ptr, MemoryTag tag);
+void       memory_appendf(char **data, size_t *capacity, size_t *length, MemoryTag tag, const char *format, ...);
+void      *memory_framealloc(size_t size);
+void       memory_resetframe();
+MemoryPool memory_createpool(size_t size, uint32_t count, MemoryTag tag);
+void       memory_destroypool(MemoryPool pool);
+void      *memory_poolalloc(MemoryPool pool);
+void       memory_poolfree(MemoryPool pool, void *ptr);
+void       memory_getstats(MemoryTag tag, MemoryStats *stats);
+uint64_t   memory_getframeallocations();
+void       memory_shutdown(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMORY_H */
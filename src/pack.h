@@ -0,0 +1,71 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#ifndef PACK_H
+#define PACK_H
+
+#include "filesystem.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A pack is one little-endian file:
+ *
+ *   PackHeader | payloads | path strings | slot table
+ *
+ * The slot table is an open-addressed hash table of PackEntry, probed
+ * linearly from the path's hash, so a lookup touches one or two slots.
+ * Payloads start on PACK_ALIGNMENT, or on PACK_PAGE_ALIGNMENT once they
+ * reach PACK_PAGE_THRESHOLD, so large entries can be mapped on their own.
+ */
+#define PACK_MAGIC          0x4b415047u  /* "GPAK" */
+#define PACK_VERSION        1
+#define PACK_ALIGNMENT      16
+#define PACK_PAGE_ALIGNMENT 4096
+#define PACK_PAGE_THRESHOLD (64 * 1024)
+
+/* Reserved for compressed payloads; the packer only stores */
+#define PACK_ENTRY_COMPRESSED 0x1u
+
+typedef struct PackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotcount;      /* a power of two, at least twice entrycount */
+    uint32_t entrycount;
+    uint64_t slotoffset;
+    uint64_t stringoffset;
+    uint64_t stringsize;
+    uint32_t tablechecksum;  /* CRC-32 of the path strings, then the slots */
+    uint32_t reserved;
+} PackHeader;
+
+typedef struct PackEntry {
+    uint64_t hash;           /* zero marks an empty slot */
+    uint64_t offset;
+    uint64_t size;           /* bytes stored */
+    uint64_t originalsize;   /* bytes once decompressed */
+    uint32_t path;           /* offset into the path strings */
+    uint32_t pathlength;
+    uint32_t checksum;       /* CRC-32 of the stored bytes */
+    uint32_t flags;
+} PackEntry;
+
+uint64_t         pack_hash(const char *pathname);
+uint32_t         pack_checksum(uint32_t crc, const void *ptr, size_t size);
+int              pack_validate(const void *pack, size_t size);
+const PackEntry *pack_findentry(const void *pack, const char *pathname);
+
+/* Searched by the filesystem backends before loose files */
+const PackEntry *filesystem_findpacked(const char *pathname, const void **data);
+int              filesystem_mappacked(FileMapping *mapping, const char *pathname);
+int              filesystem_readpacked(void **ptr, size_t *size, const PackEntry *entry, const void *data);
+int              filesystem_copypacked(void *ptr, size_t size, const PackEntry *entry, const void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACK_H */
@@ -0,0 +1,234 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "profiler.h"
+#include "filesystem.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+
+/* Constants */
+static const uint32_t MAX_PROFILER_THREADS = 64;
+static const uint32_t PROFILER_RING_SIZE = 16384; /* must be a power of two */
+static const uint32_t MAX_ZONE_DEPTH = 64;
+
+/*
+ * A seqlock per slot: sequence is odd while the owner writes event n into it
+ * and 2n + 2 once it is done, so the exporter keeps only events it read whole
+ */
+typedef struct ProfilerZone {
+    std::atomic<uint64_t>    sequence;
+    std::atomic<const char*> name;
+    std::atomic<uint64_t>    start;
+    std::atomic<uint64_t>    duration;
+    std::atomic<uint32_t>    depth;
+} ProfilerZone;
+
+/* Written only by its owning thread; head is published for the exporter */
+typedef struct ProfilerThread {
+    uint32_t              id;
+    uint32_t              depth;
+    const char           *names[MAX_ZONE_DEPTH];
+    uint64_t              starts[MAX_ZONE_DEPTH];
+    std::atomic<uint64_t> head;
+    ProfilerZone          zones[PROFILER_RING_SIZE];
+} ProfilerThread;
+
+static std::atomic<ProfilerThread*> threads[MAX_PROFILER_THREADS];
+static std::atomic<uint32_t> threadCount;
+static std::atomic<bool> enabled(true);
+static std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+static thread_local ProfilerThread *currentThread;
+
+static uint64_t profiler_getnanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+/* Claim a ring the first time a thread opens a zone */
+static ProfilerThread *profiler_getthread()
+{
+    ProfilerThread *thread;
+    uint32_t id;
+
+    if (currentThread != NULL)
+    {
+        return currentThread;
+    }
+
+    id = threadCount.load(std::memory_order_relaxed);
+    do {
+        if (id == MAX_PROFILER_THREADS) {
+            return NULL;
+        }
+    } while (!threadCount.compare_exchange_weak(id, id + 1, std::memory_order_relaxed));
+
+    thread = new ProfilerThread();
+    thread->id = id;
+    thread->head.store(0, std::memory_order_relaxed);
+
+    /* The exporter skips a claimed slot until its pointer is published */
+    threads[id].store(thread, std::memory_order_release);
+    currentThread = thread;
+    return thread;
+}
+
+void profiler_init()
+{
+    epoch = std::chrono::steady_clock::now();
+    atexit(profiler_shutdown);
+}
+
+void profiler_begin(const char *name)
+{
+    ProfilerThread *thread;
+
+    if (!enabled.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    thread = profiler_getthread();
+    if (thread == NULL)
+    {
+        return;
+    }
+
+    /* Zones deeper than the stack are dropped, but still balanced */
+    if (thread->depth < MAX_ZONE_DEPTH)
+    {
+        thread->names[thread->depth]  = name;
+        thread->starts[thread->depth] = profiler_getnanoseconds();
+    }
+    thread->depth++;
+}
+
+void profiler_end()
+{
+    ProfilerThread *thread = currentThread;
+    ProfilerZone *zone;
+    uint64_t head, start;
+
+    /* Zones opened before the profiler was disabled still close */
+    if (thread == NULL || thread->depth == 0)
+    {
+        return;
+    }
+
+    thread->depth--;
+    if (thread->depth >= MAX_ZONE_DEPTH)
+    {
+        return;
+    }
+
+    head  = thread->head.load(std::memory_order_relaxed);
+    zone  = &thread->zones[head & (PROFILER_RING_SIZE - 1)];
+    start = thread->starts[thread->depth];
+
+    zone->sequence.store(head * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    zone->name.store(thread->names[thread->depth], std::memory_order_relaxed);
+    zone->start.store(start, std::memory_order_relaxed);
+    zone->duration.store(profiler_getnanoseconds() - start, std::memory_order_relaxed);
+    zone->depth.store(thread->depth, std::memory_order_relaxed);
+    zone->sequence.store(head * 2 + 2, std::memory_order_release);
+    thread->head.store(head + 1, std::memory_order_release);
+}
+
+void profiler_setenabled(int _enabled)
+{
+    enabled.store(_enabled != 0, std::memory_order_relaxed);
+}
+
+/* https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU */
+void profiler_save(const char *pathname)
+{
+    uint32_t count = threadCount.load(std::memory_order_acquire);
+    size_t capacity = 64;
+    size_t length = 0;
+    bool first = true;
+    char *data;
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        capacity += (size_t)PROFILER_RING_SIZE * 160;
+    }
+
+    data = (char *)memory_alloc(capacity, MEMORY_PROFILER);
+    if (!data) {
+        fprintf(stderr, "Failed to allocate memory for trace\n");
+        return;
+    }
+
+    memory_appendf(&data, &capacity, &length, MEMORY_PROFILER, "{\"traceEvents\":[");
+    for (i = 0; i < count; i++)
+    {
+        ProfilerThread *thread = threads[i].load(std::memory_order_acquire);
+        uint64_t head, tail;
+
+        if (thread == NULL)
+        {
+            continue;
+        }
+
+        head = thread->head.load(std::memory_order_acquire);
+        tail = head > PROFILER_RING_SIZE ? head - PROFILER_RING_SIZE : 0;
+
+        /* Complete ("X") events, with microsecond timestamps */
+        for (; tail < head; tail++)
+        {
+            const ProfilerZone *zone = &thread->zones[tail & (PROFILER_RING_SIZE - 1)];
+            uint64_t sequence = zone->sequence.load(std::memory_order_acquire);
+            const char *name;
+            uint64_t start, duration;
+
+            /* Skip events the owner is overwriting or has already overwritten */
+            if (sequence != tail * 2 + 2)
+            {
+                continue;
+            }
+            name     = zone->name.load(std::memory_order_relaxed);
+            start    = zone->start.load(std::memory_order_relaxed);
+            duration = zone->duration.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (zone->sequence.load(std::memory_order_relaxed) != sequence)
+            {
+                continue;
+            }
+
+            memory_appendf(&data, &capacity, &length, MEMORY_PROFILER,
+                           "%s{\"name\":\"%.64s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%u}",
+                           first ? "" : ",\n", name, start / 1000.0, duration / 1000.0, thread->id);
+            first = false;
+        }
+    }
+    memory_appendf(&data, &capacity, &length, MEMORY_PROFILER, "],\"displayTimeUnit\":\"ms\"}\n");
+    if (data == NULL) {
+        fprintf(stderr, "Failed to allocate memory for trace\n");
+        return;
+    }
+
+    filesystem_filewrite(data, length, pathname);
+
+    memory_free(data, MEMORY_PROFILER);
+    data = NULL;
+}
+
+void profiler_shutdown(void)
+{
+    uint32_t count = threadCount.load(std::memory_order_acquire);
+    uint32_t i;
+
+    /* Called from atexit, once other threads have been joined */
+    enabled.store(false, std::memory_order_relaxed);
+    for (i = 0; i < count; i++)
+    {
+        delete threads[i].exchange(NULL, std::memory_order_acq_rel);
+    }
+    threadCount.store(0, std::memory_order_release);
+    currentThread = NULL;
+}
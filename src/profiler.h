@@ -0,0 +1,32 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void profiler_init();
+void profiler_begin(const char *name);
+void profiler_end();
+void profiler_setenabled(int enabled);
+void profiler_save(const char *pathname);
+void profiler_shutdown(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* Zones nest per thread; name must outlive the profiler, e.g. a string literal */
+#ifdef NO_PROFILER
+#define PROFILER_BEGIN(name)
+#define PROFILER_END()
+#else
+#define PROFILER_BEGIN(name) profiler_begin(name)
+#define PROFILER_END()       profiler_end()
+#endif
+
+#endif /* PROFILER_H */
@@ -0,0 +1,510 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "spirv.h"
+#include "memory.h"
+#include <stdio.h>
+#include <string.h>
+
+/* https://registry.khronos.org/SPIR-V/specs/unified1/SPIRV.html#_instructions_3 */
+enum {
+    SPIRV_OP_ENTRY_POINT       = 15,
+    SPIRV_OP_TYPE_INT          = 21,
+    SPIRV_OP_TYPE_FLOAT        = 22,
+    SPIRV_OP_TYPE_VECTOR       = 23,
+    SPIRV_OP_TYPE_MATRIX       = 24,
+    SPIRV_OP_TYPE_IMAGE        = 25,
+    SPIRV_OP_TYPE_SAMPLER      = 26,
+    SPIRV_OP_TYPE_SAMPLED_IMAGE = 27,
+    SPIRV_OP_TYPE_ARRAY        = 28,
+    SPIRV_OP_TYPE_RUNTIME_ARRAY = 29,
+    SPIRV_OP_TYPE_STRUCT       = 30,
+    SPIRV_OP_TYPE_POINTER      = 32,
+    SPIRV_OP_CONSTANT          = 43,
+    SPIRV_OP_SPEC_CONSTANT     = 50,
+    SPIRV_OP_FUNCTION          = 54,
+    SPIRV_OP_VARIABLE          = 59,
+    SPIRV_OP_DECORATE          = 71,
+    SPIRV_OP_MEMBER_DECORATE   = 72
+};
+
+/* https://registry.khronos.org/SPIR-V/specs/unified1/SPIRV.html#Decoration */
+enum {
+    SPIRV_DECORATION_BUFFER_BLOCK   = 3,
+    SPIRV_DECORATION_ARRAY_STRIDE   = 6,
+    SPIRV_DECORATION_MATRIX_STRIDE  = 7,
+    SPIRV_DECORATION_BUILT_IN       = 11,
+    SPIRV_DECORATION_LOCATION       = 30,
+    SPIRV_DECORATION_BINDING        = 33,
+    SPIRV_DECORATION_DESCRIPTOR_SET = 34,
+    SPIRV_DECORATION_OFFSET         = 35
+};
+
+/* https://registry.khronos.org/SPIR-V/specs/unified1/SPIRV.html#Storage_Class */
+enum {
+    SPIRV_STORAGE_UNIFORM_CONSTANT = 0,
+    SPIRV_STORAGE_INPUT            = 1,
+    SPIRV_STORAGE_UNIFORM          = 2,
+    SPIRV_STORAGE_PUSH_CONSTANT    = 9,
+    SPIRV_STORAGE_STORAGE_BUFFER   = 12
+};
+
+/* The VkDescriptorType and VkFormat values reflection reports */
+enum {
+    SPIRV_DESCRIPTOR_SAMPLER                = 0,
+    SPIRV_DESCRIPTOR_COMBINED_IMAGE_SAMPLER = 1,
+    SPIRV_DESCRIPTOR_SAMPLED_IMAGE          = 2,
+    SPIRV_DESCRIPTOR_STORAGE_IMAGE          = 3,
+    SPIRV_DESCRIPTOR_UNIFORM_TEXEL_BUFFER   = 4,
+    SPIRV_DESCRIPTOR_STORAGE_TEXEL_BUFFER   = 5,
+    SPIRV_DESCRIPTOR_UNIFORM_BUFFER         = 6,
+    SPIRV_DESCRIPTOR_STORAGE_BUFFER         = 7,
+    SPIRV_DESCRIPTOR_INPUT_ATTACHMENT       = 10
+};
+
+enum {
+    SPIRV_FORMAT_R32_UINT   = 98,
+    SPIRV_FORMAT_R32_SINT   = 99,
+    SPIRV_FORMAT_R32_SFLOAT = 100
+};
+
+#define SPIRV_HEADER_WORDS  5
+#define SPIRV_MAX_BOUND     (1u << 22)
+#define SPIRV_MAX_MEMBERS   64
+#define SPIRV_MAX_DEPTH     8
+
+#define SPIRV_HAS_SET       0x01
+#define SPIRV_HAS_BINDING   0x02
+#define SPIRV_HAS_LOCATION  0x04
+#define SPIRV_BUILT_IN      0x08
+#define SPIRV_BUFFER_BLOCK  0x10
+
+/* What is known about one result id */
+typedef struct SpirvId {
+    const uint32_t *insn;     /* defining instruction, if global */
+    uint32_t        set;
+    uint32_t        binding;
+    uint32_t        location;
+    uint32_t        arraystride;
+    uint32_t        flags;
+} SpirvId;
+
+typedef struct SpirvModule {
+    const uint32_t *words;
+    size_t          wordcount;
+    uint32_t        bound;
+    SpirvId        *ids;
+} SpirvModule;
+
+/* VkShaderStageFlagBits by execution model: vertex, tessellation, geometry, fragment, compute */
+static const uint32_t spirvStages[6] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20 };
+
+/* The instruction defining a type or constant, if it is the expected kind */
+static const uint32_t *spirv_getinsn(const SpirvModule *module, uint32_t id, uint32_t opcode)
+{
+    const uint32_t *insn;
+
+    if (id >= module->bound || (insn = module->ids[id].insn) == NULL) {
+        return NULL;
+    }
+    return opcode == 0 || (insn[0] & 0xffff) == opcode ? insn : NULL;
+}
+
+static int spirv_getconstant(const SpirvModule *module, uint32_t id, uint32_t *value)
+{
+    const uint32_t *insn = spirv_getinsn(module, id, 0);
+
+    if (insn == NULL || (insn[0] >> 16) < 4 ||
+        ((insn[0] & 0xffff) != SPIRV_OP_CONSTANT && (insn[0] & 0xffff) != SPIRV_OP_SPEC_CONSTANT)) {
+        return 0;
+    }
+    *value = insn[3];
+    return 1;
+}
+
+static uint32_t spirv_getsize(const SpirvModule *module, uint32_t id, int depth);
+
+/* Offsets come from member decorations, so the end of the furthest member is the size */
+static uint32_t spirv_getstructsize(const SpirvModule *module, const uint32_t *insn, int depth)
+{
+    uint32_t offsets[SPIRV_MAX_MEMBERS] = { 0 };
+    uint32_t strides[SPIRV_MAX_MEMBERS] = { 0 };
+    uint32_t members = (insn[0] >> 16) - 2;
+    uint32_t size = 0, end, i;
+    const uint32_t *column;
+    size_t offset;
+
+    if (members > SPIRV_MAX_MEMBERS) {
+        return 0;
+    }
+
+    for (offset = SPIRV_HEADER_WORDS; offset < module->wordcount; offset += module->words[offset] >> 16)
+    {
+        const uint32_t *decoration = module->words + offset;
+
+        if ((decoration[0] & 0xffff) == SPIRV_OP_FUNCTION) {
+            break;
+        }
+        if ((decoration[0] & 0xffff) != SPIRV_OP_MEMBER_DECORATE || (decoration[0] >> 16) < 5 ||
+            decoration[1] != insn[1] || decoration[2] >= members) {
+            continue;
+        }
+        if (decoration[3] == SPIRV_DECORATION_OFFSET) {
+            offsets[decoration[2]] = decoration[4];
+        } else if (decoration[3] == SPIRV_DECORATION_MATRIX_STRIDE) {
+            strides[decoration[2]] = decoration[4];
+        }
+    }
+
+    for (i = 0; i < members; i++)
+    {
+        column = spirv_getinsn(module, insn[2 + i], SPIRV_OP_TYPE_MATRIX);
+        end    = offsets[i] + (column != NULL && strides[i] > 0 ? column[3] * strides[i] :
+                                                                 spirv_getsize(module, insn[2 + i], depth + 1));
+        size   = end > size ? end : size;
+    }
+    return size;
+}
+
+/* Bytes a type occupies in a block */
+static uint32_t spirv_getsize(const SpirvModule *module, uint32_t id, int depth)
+{
+    const uint32_t *insn = spirv_getinsn(module, id, 0);
+    uint32_t length, stride;
+
+    if (insn == NULL || depth > SPIRV_MAX_DEPTH) {
+        return 0;
+    }
+
+    switch (insn[0] & 0xffff)
+    {
+    case SPIRV_OP_TYPE_INT:
+    case SPIRV_OP_TYPE_FLOAT:
+        return insn[2] / 8;
+    case SPIRV_OP_TYPE_VECTOR:
+    case SPIRV_OP_TYPE_MATRIX:
+        return insn[3] * spirv_getsize(module, insn[2], depth + 1);
+    case SPIRV_OP_TYPE_ARRAY:
+        if (!spirv_getconstant(module, insn[3], &length)) {
+            return 0;
+        }
+        stride = module->ids[id].arraystride;
+        return length * (stride > 0 ? stride : spirv_getsize(module, insn[2], depth + 1));
+    case SPIRV_OP_TYPE_STRUCT:
+        return spirv_getstructsize(module, insn, depth);
+    default:
+        return 0;
+    }
+}
+
+/* The 32-bit VkFormat a scalar or vector input reads, or 0 */
+static uint32_t spirv_getformat(const SpirvModule *module, uint32_t type)
+{
+    const uint32_t *insn = spirv_getinsn(module, type, 0);
+    uint32_t components = 1;
+
+    if (insn != NULL && (insn[0] & 0xffff) == SPIRV_OP_TYPE_VECTOR) {
+        components = insn[3];
+        insn       = spirv_getinsn(module, insn[2], 0);
+    }
+    if (insn == NULL || components < 1 || components > 4 || insn[2] != 32) {
+        return 0;
+    }
+
+    /* R32, R32G32, R32G32B32 and R32G32B32A32 are three formats apart */
+    switch (insn[0] & 0xffff)
+    {
+    case SPIRV_OP_TYPE_FLOAT:
+        return SPIRV_FORMAT_R32_SFLOAT + (components - 1) * 3;
+    case SPIRV_OP_TYPE_INT:
+        return (insn[3] ? SPIRV_FORMAT_R32_SINT : SPIRV_FORMAT_R32_UINT) + (components - 1) * 3;
+    default:
+        return 0;
+    }
+}
+
+static int spirv_addinput(SpirvReflection *reflection, const SpirvModule *module, const SpirvId *variable, const uint32_t *pointer)
+{
+    const uint32_t *type = spirv_getinsn(module, pointer[3], 0);
+    uint32_t elements = 1, columns = 1, format, location, i, j;
+
+    if (type != NULL && (type[0] & 0xffff) == SPIRV_OP_TYPE_ARRAY) {
+        if (!spirv_getconstant(module, type[3], &elements)) {
+            return 0;
+        }
+        type = spirv_getinsn(module, type[2], 0);
+    }
+    if (type != NULL && (type[0] & 0xffff) == SPIRV_OP_TYPE_MATRIX) {
+        columns = type[3];
+        type    = spirv_getinsn(module, type[2], 0);
+    }
+    if (type == NULL || (format = spirv_getformat(module, type[1])) == 0) {
+        fprintf(stderr, "spirv_reflect: unsupported type for input %u\n", variable->location);
+        return 0;
+    }
+
+    for (i = 0; i < elements * columns; i++)
+    {
+        if (reflection->inputcount == SPIRV_MAX_INPUTS) {
+            fprintf(stderr, "spirv_reflect: too many inputs\n");
+            return 0;
+        }
+
+        /* Kept in location order */
+        location = variable->location + i;
+        for (j = reflection->inputcount; j > 0 && reflection->inputs[j - 1].location > location; j--)
+        {
+            reflection->inputs[j] = reflection->inputs[j - 1];
+        }
+        reflection->inputs[j].location = location;
+        reflection->inputs[j].format   = format;
+        reflection->inputcount++;
+    }
+    return 1;
+}
+
+/* https://docs.vulkan.org/spec/latest/chapters/interfaces.html#interfaces-resources-descset */
+static int spirv_adddescriptor(SpirvReflection *reflection, const SpirvModule *module, const SpirvId *variable, const uint32_t *pointer)
+{
+    const uint32_t *type = spirv_getinsn(module, pointer[3], 0);
+    SpirvBinding binding;
+    uint32_t i;
+
+    binding.set            = variable->set;
+    binding.binding        = variable->binding;
+    binding.count          = 1;
+    binding.descriptortype = UINT32_MAX;
+
+    if (type != NULL && (type[0] & 0xffff) == SPIRV_OP_TYPE_ARRAY) {
+        if (!spirv_getconstant(module, type[3], &binding.count)) {
+            return 0;
+        }
+        type = spirv_getinsn(module, type[2], 0);
+    }
+
+    /* Runtime-sized descriptor arrays need descriptor indexing, which layouts don't use */
+    if (type != NULL && pointer[2] == SPIRV_STORAGE_UNIFORM_CONSTANT)
+    {
+        switch (type[0] & 0xffff)
+        {
+        case SPIRV_OP_TYPE_SAMPLED_IMAGE:
+            binding.descriptortype = SPIRV_DESCRIPTOR_COMBINED_IMAGE_SAMPLER;
+            break;
+        case SPIRV_OP_TYPE_SAMPLER:
+            binding.descriptortype = SPIRV_DESCRIPTOR_SAMPLER;
+            break;
+        case SPIRV_OP_TYPE_IMAGE:
+            /* Dim 5 is Buffer, 6 is SubpassData; Sampled 2 means used without a sampler */
+            if (type[3] == 5) {
+                binding.descriptortype = type[7] == 2 ? SPIRV_DESCRIPTOR_STORAGE_TEXEL_BUFFER : SPIRV_DESCRIPTOR_UNIFORM_TEXEL_BUFFER;
+            } else if (type[3] == 6) {
+                binding.descriptortype = SPIRV_DESCRIPTOR_INPUT_ATTACHMENT;
+            } else {
+                binding.descriptortype = type[7] == 2 ? SPIRV_DESCRIPTOR_STORAGE_IMAGE : SPIRV_DESCRIPTOR_SAMPLED_IMAGE;
+            }
+            break;
+        }
+    }
+    else if (type != NULL && (type[0] & 0xffff) == SPIRV_OP_TYPE_STRUCT)
+    {
+        /* Older modules mark storage buffers as Uniform BufferBlocks */
+        if (pointer[2] == SPIRV_STORAGE_STORAGE_BUFFER || (module->ids[type[1]].flags & SPIRV_BUFFER_BLOCK)) {
+            binding.descriptortype = SPIRV_DESCRIPTOR_STORAGE_BUFFER;
+        } else if (pointer[2] == SPIRV_STORAGE_UNIFORM) {
+            binding.descriptortype = SPIRV_DESCRIPTOR_UNIFORM_BUFFER;
+        }
+    }
+
+    if (binding.descriptortype == UINT32_MAX) {
+        fprintf(stderr, "spirv_reflect: unsupported descriptor at set %u binding %u\n", binding.set, binding.binding);
+        return 0;
+    }
+    if (reflection->bindingcount == SPIRV_MAX_BINDINGS) {
+        fprintf(stderr, "spirv_reflect: too many descriptors\n");
+        return 0;
+    }
+
+    /* Kept in set, then binding order */
+    for (i = reflection->bindingcount; i > 0 &&
+         (reflection->bindings[i - 1].set > binding.set ||
+          (reflection->bindings[i - 1].set == binding.set && reflection->bindings[i - 1].binding > binding.binding)); i--)
+    {
+        reflection->bindings[i] = reflection->bindings[i - 1];
+    }
+    reflection->bindings[i] = binding;
+    reflection->bindingcount++;
+    return 1;
+}
+
+static int spirv_addvariable(SpirvReflection *reflection, const SpirvModule *module, const uint32_t *insn)
+{
+    const SpirvId *variable = &module->ids[insn[2]];
+    const uint32_t *pointer = spirv_getinsn(module, insn[1], SPIRV_OP_TYPE_POINTER);
+    uint32_t size;
+
+    if (pointer == NULL || (pointer[0] >> 16) < 4) {
+        return 0;
+    }
+
+    switch (insn[3])
+    {
+    case SPIRV_STORAGE_INPUT:
+        if (!(variable->flags & SPIRV_HAS_LOCATION) || (variable->flags & SPIRV_BUILT_IN)) {
+            return 1;
+        }
+        return spirv_addinput(reflection, module, variable, pointer);
+    case SPIRV_STORAGE_UNIFORM_CONSTANT:
+    case SPIRV_STORAGE_UNIFORM:
+    case SPIRV_STORAGE_STORAGE_BUFFER:
+        if (!(variable->flags & SPIRV_HAS_BINDING)) {
+            return 1;
+        }
+        return spirv_adddescriptor(reflection, module, variable, pointer);
+    case SPIRV_STORAGE_PUSH_CONSTANT:
+        size = spirv_getsize(module, pointer[3], 0);
+        reflection->pushconstantsize = size > reflection->pushconstantsize ? size : reflection->pushconstantsize;
+        return 1;
+    default:
+        return 1;
+    }
+}
+
+static void spirv_decorate(SpirvId *id, uint32_t decoration, uint32_t value)
+{
+    switch (decoration)
+    {
+    case SPIRV_DECORATION_BUFFER_BLOCK:
+        id->flags |= SPIRV_BUFFER_BLOCK;
+        break;
+    case SPIRV_DECORATION_ARRAY_STRIDE:
+        id->arraystride = value;
+        break;
+    case SPIRV_DECORATION_BUILT_IN:
+        id->flags |= SPIRV_BUILT_IN;
+        break;
+    case SPIRV_DECORATION_LOCATION:
+        id->location = value;
+        id->flags   |= SPIRV_HAS_LOCATION;
+        break;
+    case SPIRV_DECORATION_BINDING:
+        id->binding = value;
+        id->flags  |= SPIRV_HAS_BINDING;
+        break;
+    case SPIRV_DECORATION_DESCRIPTOR_SET:
+        id->set    = value;
+        id->flags |= SPIRV_HAS_SET;
+        break;
+    }
+}
+
+/* Globals all precede the first function, so that is as far as reflection reads */
+int spirv_reflect(SpirvReflection *reflection, const void *code, size_t size)
+{
+    SpirvModule module;
+    const uint32_t *insn;
+    uint32_t opcode, length, result;
+    size_t offset;
+    int stage = -1;
+    int ok = 1;
+
+    memset(reflection, 0, sizeof(SpirvReflection));
+
+    module.words     = (const uint32_t *)code;
+    module.wordcount = size / 4;
+    if (size % 4 != 0 || module.wordcount < SPIRV_HEADER_WORDS || module.words[0] != SPIRV_MAGIC) {
+        fprintf(stderr, "spirv_reflect: not a SPIR-V module\n");
+        return 0;
+    }
+    module.bound = module.words[3];
+    if (module.bound == 0 || module.bound > SPIRV_MAX_BOUND) {
+        fprintf(stderr, "spirv_reflect: bad id bound %u\n", module.bound);
+        return 0;
+    }
+    module.ids = (SpirvId *) memory_alloc(sizeof(SpirvId) * module.bound, MEMORY_GRAPHICS);
+    if (module.ids == NULL) {
+        fprintf(stderr, "spirv_reflect: out of memory\n");
+        return 0;
+    }
+    memset(module.ids, 0, sizeof(SpirvId) * module.bound);
+
+    /* Index every global by result id; instructions are validated as they are read */
+    for (offset = SPIRV_HEADER_WORDS; offset < module.wordcount; offset += length)
+    {
+        insn   = module.words + offset;
+        opcode = insn[0] & 0xffff;
+        length = insn[0] >> 16;
+        if (length == 0 || length > module.wordcount - offset) {
+            fprintf(stderr, "spirv_reflect: truncated instruction\n");
+            ok = 0;
+            break;
+        }
+        if (opcode == SPIRV_OP_FUNCTION) {
+            module.wordcount = offset;
+            break;
+        }
+
+        switch (opcode)
+        {
+        case SPIRV_OP_ENTRY_POINT:
+            if (stage < 0 && length >= 3) {
+                stage = (int)insn[1];
+            }
+            continue;
+        case SPIRV_OP_DECORATE:
+            if (length >= 3 && insn[1] < module.bound) {
+                spirv_decorate(&module.ids[insn[1]], insn[2], length >= 4 ? insn[3] : 0);
+            }
+            continue;
+        case SPIRV_OP_TYPE_SAMPLER:
+        case SPIRV_OP_TYPE_STRUCT:
+            result = length >= 2 ? insn[1] : UINT32_MAX;
+            break;
+        case SPIRV_OP_TYPE_FLOAT:
+        case SPIRV_OP_TYPE_RUNTIME_ARRAY:
+        case SPIRV_OP_TYPE_SAMPLED_IMAGE:
+            result = length >= 3 ? insn[1] : UINT32_MAX;
+            break;
+        case SPIRV_OP_TYPE_INT:
+        case SPIRV_OP_TYPE_VECTOR:
+        case SPIRV_OP_TYPE_MATRIX:
+        case SPIRV_OP_TYPE_ARRAY:
+        case SPIRV_OP_TYPE_POINTER:
+            result = length >= 4 ? insn[1] : UINT32_MAX;
+            break;
+        case SPIRV_OP_TYPE_IMAGE:
+            result = length >= 9 ? insn[1] : UINT32_MAX;
+            break;
+        case SPIRV_OP_CONSTANT:
+        case SPIRV_OP_SPEC_CONSTANT:
+        case SPIRV_OP_VARIABLE:
+            result = length >= 4 ? insn[2] : UINT32_MAX;
+            break;
+        default:
+            continue;
+        }
+        if (result >= module.bound) {
+            fprintf(stderr, "spirv_reflect: bad result id\n");
+            ok = 0;
+            break;
+        }
+        module.ids[result].insn = insn;
+    }
+
+    if (ok && (stage < 0 || stage >= (int)(sizeof(spirvStages) / sizeof(spirvStages[0])))) {
+        fprintf(stderr, "spirv_reflect: no supported entry point\n");
+        ok = 0;
+    }
+
+    for (offset = SPIRV_HEADER_WORDS; ok && offset < module.wordcount; offset += module.words[offset] >> 16)
+    {
+        insn = module.words + offset;
+        if ((insn[0] & 0xffff) == SPIRV_OP_VARIABLE && (insn[0] >> 16) >= 4) {
+            ok = spirv_addvariable(reflection, &module, insn);
+        }
+    }
+    if (ok) {
+        reflection->stage = spirvStages[stage];
+    }
+
+    memory_free(module.ids, MEMORY_GRAPHICS);
+    return ok;
+}
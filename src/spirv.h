@@ -0,0 +1,52 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#ifndef SPIRV_H
+#define SPIRV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reflection of the interface a SPIR-V module declares: the vertex inputs
+ * it reads, the descriptors it binds and the size of its push constants.
+ * Only what pipeline layouts need is read, straight from the words.
+ *
+ * https://registry.khronos.org/SPIR-V/specs/unified1/SPIRV.html
+ */
+#define SPIRV_MAGIC        0x07230203
+#define SPIRV_MAX_INPUTS   16
+#define SPIRV_MAX_BINDINGS 16
+
+/* One per location; a matrix input takes a location per column */
+typedef struct SpirvInput {
+    uint32_t location;
+    uint32_t format;          /* a VkFormat */
+} SpirvInput;
+
+typedef struct SpirvBinding {
+    uint32_t set;
+    uint32_t binding;
+    uint32_t descriptortype;  /* a VkDescriptorType */
+    uint32_t count;
+} SpirvBinding;
+
+typedef struct SpirvReflection {
+    uint32_t     stage;             /* a VkShaderStageFlagBits */
+    uint32_t     inputcount;
+    SpirvInput   inputs[SPIRV_MAX_INPUTS];       /* by location */
+    uint32_t     bindingcount;
+    SpirvBinding bindings[SPIRV_MAX_BINDINGS];   /* by set, then binding */
+    uint32_t     pushconstantsize;  /* 0 without a push constant block */
+} SpirvReflection;
+
+int    spirv_reflect(SpirvReflection *reflection, const void *code, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPIRV_H */
@@ -0,0 +1,187 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "texture.h"
+#include "filesystem.h"
+#include "image.h"
+#include "ktx2.h"
+#include "memory.h"
+#include "timer.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Loads timed per path by texture_benchmark */
+#define TEXTURE_BENCHMARK_RUNS 4
+
+/* What one load cost */
+typedef struct TextureLoad {
+    size_t bytes;         /* levels as uploaded */
+    size_t decodedbytes;  /* the same levels as RGBA8 */
+} TextureLoad;
+
+/* Decoded levels keep the colour space they were authored in */
+static TextureFormat texture_getdecodedformat(TextureFormat format)
+{
+    switch (format)
+    {
+    case TEXTURE_FORMAT_BC1_RGB_SRGB:
+    case TEXTURE_FORMAT_BC1_RGBA_SRGB:
+    case TEXTURE_FORMAT_BC2_SRGB:
+    case TEXTURE_FORMAT_BC3_SRGB:
+    case TEXTURE_FORMAT_BC7_SRGB:
+    case TEXTURE_FORMAT_ETC2_RGB8_SRGB:
+    case TEXTURE_FORMAT_ETC2_RGB8A1_SRGB:
+    case TEXTURE_FORMAT_ETC2_RGBA8_SRGB:
+        return TEXTURE_FORMAT_RGBA8_SRGB;
+    default:
+        return TEXTURE_FORMAT_RGBA8_UNORM;
+    }
+}
+
+static size_t texture_getdecodedsize(uint32_t width, uint32_t height, uint32_t level)
+{
+    width  = width >> level > 0 ? width >> level : 1;
+    height = height >> level > 0 ? height >> level : 1;
+    return (size_t)width * height * 4;
+}
+
+/* Upload the levels as stored, or decode every one to RGBA8 first */
+static Texture texture_createktx2(const Ktx2Texture *ktx2, int transcode, TextureFilter filter, TextureWrap wrap, TextureLoad *load)
+{
+    const void *levels[KTX2_MAX_LEVELS];
+    size_t sizes[KTX2_MAX_LEVELS];
+    uint8_t *pixels;
+    Texture texture;
+    size_t offset = 0;
+    uint32_t i;
+
+    load->bytes        = 0;
+    load->decodedbytes = 0;
+    for (i = 0; i < ktx2->levelcount; i++)
+    {
+        load->decodedbytes += texture_getdecodedsize(ktx2->width, ktx2->height, i);
+    }
+
+    if (!transcode) {
+        for (i = 0; i < ktx2->levelcount; i++)
+        {
+            levels[i]    = ktx2->levels[i].data;
+            sizes[i]     = ktx2->levels[i].size;
+            load->bytes += sizes[i];
+        }
+        return graphics_createtexturelevels((TextureFormat)ktx2->format, ktx2->width, ktx2->height,
+                                            levels, sizes, ktx2->levelcount, filter, wrap);
+    }
+
+    if (!texture_isdecodable((TextureFormat)ktx2->format)) {
+        fprintf(stderr, "texture_load: format %u is not supported by the device and has no CPU decoder; "
+                        "ASTC, BC6H and SNORM textures only load natively\n", ktx2->format);
+        return NULL;
+    }
+
+    pixels = (uint8_t *) memory_alloc(load->decodedbytes, MEMORY_GRAPHICS);
+    if (pixels == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < ktx2->levelcount; i++)
+    {
+        levels[i] = pixels + offset;
+        sizes[i]  = texture_getdecodedsize(ktx2->width, ktx2->height, i);
+        if (!texture_decode((TextureFormat)ktx2->format, ktx2->levels[i].data, ktx2->levels[i].size,
+                            ktx2->width >> i > 0 ? ktx2->width >> i : 1,
+                            ktx2->height >> i > 0 ? ktx2->height >> i : 1, pixels + offset)) {
+            fprintf(stderr, "texture_load: can't decode level %u of format %u\n", i, ktx2->format);
+            memory_free(pixels, MEMORY_GRAPHICS);
+            return NULL;
+        }
+        offset += sizes[i];
+    }
+    load->bytes = load->decodedbytes;
+
+    texture = graphics_createtexturelevels(texture_getdecodedformat((TextureFormat)ktx2->format), ktx2->width, ktx2->height,
+                                           levels, sizes, ktx2->levelcount, filter, wrap);
+    memory_free(pixels, MEMORY_GRAPHICS);
+    return texture;
+}
+
+/* KTX2 files stay compressed where the device can sample them; anything else goes through image_load */
+Texture texture_load(const char *pathname, TextureFilter filter, TextureWrap wrap)
+{
+    const char *extension = strrchr(pathname, '.');
+    FileMapping mapping;
+    Ktx2Texture ktx2;
+    TextureLoad load;
+    Image image;
+    Texture texture;
+
+    if (extension == NULL || strcmp(extension, ".ktx2") != 0) {
+        if (!image_load(&image, pathname)) {
+            return NULL;
+        }
+        texture = graphics_createtexture(image.pixels, image.width, image.height, filter, wrap);
+        image_free(&image);
+        return texture;
+    }
+
+    if (!filesystem_map(&mapping, pathname)) {
+        return NULL;
+    }
+    if (!ktx2_parse(&ktx2, mapping.ptr, mapping.size)) {
+        fprintf(stderr, "texture_load: can't load %s\n", pathname);
+        filesystem_unmap(&mapping);
+        return NULL;
+    }
+    texture = texture_createktx2(&ktx2, !graphics_istextureformatsupported((TextureFormat)ktx2.format), filter, wrap, &load);
+    filesystem_unmap(&mapping);
+    return texture;
+}
+
+/* Time loading a KTX2 file natively, where the device allows, and transcoded, with the memory each takes */
+void texture_benchmark(const char *pathname)
+{
+    FileMapping mapping;
+    Ktx2Texture ktx2;
+    TextureLoad load;
+    Texture texture;
+    uint64_t start, elapsed;
+    int transcode, run;
+
+    if (!filesystem_map(&mapping, pathname)) {
+        return;
+    }
+    if (!ktx2_parse(&ktx2, mapping.ptr, mapping.size)) {
+        fprintf(stderr, "texture_benchmark: can't load %s\n", pathname);
+        filesystem_unmap(&mapping);
+        return;
+    }
+    filesystem_unmap(&mapping);
+
+    for (transcode = 0; transcode < 2; transcode++)
+    {
+        if (!transcode && !graphics_istextureformatsupported((TextureFormat)ktx2.format)) {
+            printf("texture_benchmark: %s: format %u is not supported natively\n", pathname, ktx2.format);
+            continue;
+        }
+
+        /* Each run maps and parses again, as texture_load would */
+        elapsed = 0;
+        for (run = 0; run < TEXTURE_BENCHMARK_RUNS; run++)
+        {
+            start = timer_getnanoseconds();
+            if (!filesystem_map(&mapping, pathname)) {
+                return;
+            }
+            texture = ktx2_parse(&ktx2, mapping.ptr, mapping.size) ?
+                      texture_createktx2(&ktx2, transcode, TEXTURE_FILTER_LINEAR, TEXTURE_WRAP_REPEAT, &load) : NULL;
+            filesystem_unmap(&mapping);
+            elapsed += timer_getnanoseconds() - start;
+            if (texture == NULL) {
+                return;
+            }
+            graphics_destroytexture(texture);
+        }
+
+        printf("texture_benchmark: %s %ux%u, %u levels, %s: %.3f ms per load, %.2f MB (%.2f MB as RGBA8)\n",
+               pathname, ktx2.width, ktx2.height, ktx2.levelcount, transcode ? "transcoded" : "native",
+               elapsed / (double)TEXTURE_BENCHMARK_RUNS / 1e6, load.bytes / 1048576.0, load.decodedbytes / 1048576.0);
+    }
+}
@@ -0,0 +1,23 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "graphics.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+Texture texture_load(const char *pathname, TextureFilter filter, TextureWrap wrap);
+void    texture_benchmark(const char *pathname);
+int     texture_isdecodable(TextureFormat format);
+int     texture_decode(TextureFormat format, const void *blocks, size_t size, uint32_t width, uint32_t height, uint8_t *pixels);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEXTURE_H */
@@ -0,0 +1,883 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "texture.h"
+#include "job.h"
+#include <string.h>
+
+/*
+ * CPU decoders for block-compressed textures the device can't sample,
+ * each turning one 4x4 block into 16 RGBA8 texels, row by row.
+ *
+ * https://registry.khronos.org/DataFormat/specs/1.3/dataformat.1.3.html#S3TC
+ * https://registry.khronos.org/DataFormat/specs/1.3/dataformat.1.3.html#RGTC
+ * https://registry.khronos.org/DataFormat/specs/1.3/dataformat.1.3.html#BPTC
+ * https://registry.khronos.org/DataFormat/specs/1.3/dataformat.1.3.html#ETC2
+ */
+
+/* Block rows handed to each job; a row of a 4096-wide texture is 64 KB of output */
+#define TEXTURE_DECODE_GRAIN 8
+
+typedef struct TextureDecode {
+    TextureFormat  format;
+    const uint8_t *blocks;
+    uint32_t       blockSize;
+    uint32_t       blocksWide;
+    uint32_t       width;
+    uint32_t       height;
+    uint8_t       *pixels;
+} TextureDecode;
+
+typedef struct BitReader {
+    uint64_t lo;
+    uint64_t hi;
+    uint32_t position;
+} BitReader;
+
+typedef struct Bc7Mode {
+    uint8_t subsets;
+    uint8_t partitionBits;
+    uint8_t rotationBits;
+    uint8_t selectorBits;
+    uint8_t colorBits;
+    uint8_t alphaBits;
+    uint8_t endpointPBits;
+    uint8_t sharedPBits;
+    uint8_t indexBits;
+    uint8_t index2Bits;
+} Bc7Mode;
+
+static const Bc7Mode bc7Modes[8] = {
+    { 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+    { 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+    { 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+    { 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+    { 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+    { 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+    { 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+    { 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 }
+};
+
+static const uint8_t bc7Weights2[4]  = { 0, 21, 43, 64 };
+static const uint8_t bc7Weights3[8]  = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const uint8_t bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+/* Subset of each texel, by partition */
+static const uint8_t bc7Partitions2[64][16] = {
+    { 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1 },
+    { 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1 },
+    { 0, 1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1 },
+    { 0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 1, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 1, 1 },
+    { 0, 0, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1 },
+    { 0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1 },
+    { 0, 0, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 1, 1, 1, 1, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 1, 1 },
+    { 0, 0, 0, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1 },
+    { 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1 },
+    { 0, 0, 0, 0, 1, 0, 0, 0, 1, 1, 1, 0, 1, 1, 1, 1 },
+    { 0, 1, 1, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 1, 1, 0 },
+    { 0, 1, 1, 1, 0, 0, 1, 1, 0, 0, 0, 1, 0, 0, 0, 0 },
+    { 0, 0, 1, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0, 1, 1, 1, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0 },
+    { 0, 1, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 0, 1 },
+    { 0, 0, 1, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0 },
+    { 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0 },
+    { 0, 0, 1, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0, 0 },
+    { 0, 0, 0, 1, 0, 1, 1, 1, 1, 1, 1, 0, 1, 0, 0, 0 },
+    { 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 0, 0, 0, 1, 1, 0, 0, 0, 1, 1, 1, 0 },
+    { 0, 0, 1, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 1, 0, 0 },
+    { 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1 },
+    { 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1 },
+    { 0, 1, 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0 },
+    { 0, 0, 1, 1, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1, 0, 0 },
+    { 0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0 },
+    { 0, 1, 0, 1, 0, 1, 0, 1, 1, 0, 1, 0, 1, 0, 1, 0 },
+    { 0, 1, 1, 0, 1, 0, 0, 1, 0, 1, 1, 0, 1, 0, 0, 1 },
+    { 0, 1, 0, 1, 1, 0, 1, 0, 1, 0, 1, 0, 0, 1, 0, 1 },
+    { 0, 1, 1, 1, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1, 1, 0 },
+    { 0, 0, 0, 1, 0, 0, 1, 1, 1, 1, 0, 0, 1, 0, 0, 0 },
+    { 0, 0, 1, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 1, 0, 0 },
+    { 0, 0, 1, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1, 1, 0, 0 },
+    { 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0 },
+    { 0, 0, 1, 1, 1, 1, 0, 0, 1, 1, 0, 0, 0, 0, 1, 1 },
+    { 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1 },
+    { 0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0 },
+    { 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 1, 0, 0, 1, 0, 0 },
+    { 0, 1, 1, 0, 1, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 1 },
+    { 0, 0, 1, 1, 0, 1, 1, 0, 1, 1, 0, 0, 1, 0, 0, 1 },
+    { 0, 1, 1, 0, 0, 0, 1, 1, 1, 0, 0, 1, 1, 1, 0, 0 },
+    { 0, 0, 1, 1, 1, 0, 0, 1, 1, 1, 0, 0, 0, 1, 1, 0 },
+    { 0, 1, 1, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 0, 0, 1 },
+    { 0, 1, 1, 0, 0, 0, 1, 1, 0, 0, 1, 1, 1, 0, 0, 1 },
+    { 0, 1, 1, 1, 1, 1, 1, 0, 1, 0, 0, 0, 0, 0, 0, 1 },
+    { 0, 0, 0, 1, 1, 0, 0, 0, 1, 1, 1, 0, 0, 1, 1, 1 },
+    { 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1 },
+    { 0, 0, 1, 1, 0, 0, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0 },
+    { 0, 0, 1, 0, 0, 0, 1, 0, 1, 1, 1, 0, 1, 1, 1, 0 },
+    { 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 1, 1, 0, 1, 1, 1 }
+};
+
+static const uint8_t bc7Partitions3[64][16] = {
+    { 0, 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 1, 2, 2, 2, 2 },
+    { 0, 0, 0, 1, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 2, 1 },
+    { 0, 0, 0, 0, 2, 0, 0, 1, 2, 2, 1, 1, 2, 2, 1, 1 },
+    { 0, 2, 2, 2, 0, 0, 2, 2, 0, 0, 1, 1, 0, 1, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2 },
+    { 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 2, 2, 0, 0, 2, 2 },
+    { 0, 0, 2, 2, 0, 0, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1 },
+    { 0, 0, 1, 1, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2 },
+    { 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2 },
+    { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2 },
+    { 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2 },
+    { 0, 1, 1, 2, 0, 1, 1, 2, 0, 1, 1, 2, 0, 1, 1, 2 },
+    { 0, 1, 2, 2, 0, 1, 2, 2, 0, 1, 2, 2, 0, 1, 2, 2 },
+    { 0, 0, 1, 1, 0, 1, 1, 2, 1, 1, 2, 2, 1, 2, 2, 2 },
+    { 0, 0, 1, 1, 2, 0, 0, 1, 2, 2, 0, 0, 2, 2, 2, 0 },
+    { 0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 1, 2, 1, 1, 2, 2 },
+    { 0, 1, 1, 1, 0, 0, 1, 1, 2, 0, 0, 1, 2, 2, 0, 0 },
+    { 0, 0, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1, 2, 2 },
+    { 0, 0, 2, 2, 0, 0, 2, 2, 0, 0, 2, 2, 1, 1, 1, 1 },
+    { 0, 1, 1, 1, 0, 1, 1, 1, 0, 2, 2, 2, 0, 2, 2, 2 },
+    { 0, 0, 0, 1, 0, 0, 0, 1, 2, 2, 2, 1, 2, 2, 2, 1 },
+    { 0, 0, 0, 0, 0, 0, 1, 1, 0, 1, 2, 2, 0, 1, 2, 2 },
+    { 0, 0, 0, 0, 1, 1, 0, 0, 2, 2, 1, 0, 2, 2, 1, 0 },
+    { 0, 1, 2, 2, 0, 1, 2, 2, 0, 0, 1, 1, 0, 0, 0, 0 },
+    { 0, 0, 1, 2, 0, 0, 1, 2, 1, 1, 2, 2, 2, 2, 2, 2 },
+    { 0, 1, 1, 0, 1, 2, 2, 1, 1, 2, 2, 1, 0, 1, 1, 0 },
+    { 0, 0, 0, 0, 0, 1, 1, 0, 1, 2, 2, 1, 1, 2, 2, 1 },
+    { 0, 0, 2, 2, 1, 1, 0, 2, 1, 1, 0, 2, 0, 0, 2, 2 },
+    { 0, 1, 1, 0, 0, 1, 1, 0, 2, 0, 0, 2, 2, 2, 2, 2 },
+    { 0, 0, 1, 1, 0, 1, 2, 2, 0, 1, 2, 2, 0, 0, 1, 1 },
+    { 0, 0, 0, 0, 2, 0, 0, 0, 2, 2, 1, 1, 2, 2, 2, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 2, 2, 2 },
+    { 0, 2, 2, 2, 0, 0, 2, 2, 0, 0, 1, 2, 0, 0, 1, 1 },
+    { 0, 0, 1, 1, 0, 0, 1, 2, 0, 0, 2, 2, 0, 2, 2, 2 },
+    { 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0 },
+    { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 0, 0, 0, 0 },
+    { 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0 },
+    { 0, 1, 2, 0, 2, 0, 1, 2, 1, 2, 0, 1, 0, 1, 2, 0 },
+    { 0, 0, 1, 1, 2, 2, 0, 0, 1, 1, 2, 2, 0, 0, 1, 1 },
+    { 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 0, 0, 0, 0, 1, 1 },
+    { 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 2, 1, 2, 1, 2, 1 },
+    { 0, 0, 2, 2, 1, 1, 2, 2, 0, 0, 2, 2, 1, 1, 2, 2 },
+    { 0, 0, 2, 2, 0, 0, 1, 1, 0, 0, 2, 2, 0, 0, 1, 1 },
+    { 0, 2, 2, 0, 1, 2, 2, 1, 0, 2, 2, 0, 1, 2, 2, 1 },
+    { 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 0, 1, 0, 1 },
+    { 0, 0, 0, 0, 2, 1, 2, 1, 2, 1, 2, 1, 2, 1, 2, 1 },
+    { 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2 },
+    { 0, 2, 2, 2, 0, 1, 1, 1, 0, 2, 2, 2, 0, 1, 1, 1 },
+    { 0, 0, 0, 2, 1, 1, 1, 2, 0, 0, 0, 2, 1, 1, 1, 2 },
+    { 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1, 2 },
+    { 0, 2, 2, 2, 0, 1, 1, 1, 0, 1, 1, 1, 0, 2, 2, 2 },
+    { 0, 0, 0, 2, 1, 1, 1, 2, 1, 1, 1, 2, 0, 0, 0, 2 },
+    { 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 2, 2 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 1, 2 },
+    { 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 2, 2, 2, 2, 2, 2 },
+    { 0, 0, 2, 2, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 2, 2 },
+    { 0, 0, 2, 2, 1, 1, 2, 2, 1, 1, 2, 2, 0, 0, 2, 2 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2 },
+    { 0, 0, 0, 2, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 1 },
+    { 0, 2, 2, 2, 1, 2, 2, 2, 0, 2, 2, 2, 1, 2, 2, 2 },
+    { 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2 },
+    { 0, 1, 1, 1, 2, 0, 1, 1, 2, 2, 0, 1, 2, 2, 2, 0 }
+};
+
+/* Texels whose index drops its top bit; texel 0 always does for subset 0 */
+static const uint8_t bc7Anchors2[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+     6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15
+};
+
+static const uint8_t bc7Anchors3a[64] = {
+     3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+     3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+     8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+     3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3
+};
+
+static const uint8_t bc7Anchors3b[64] = {
+    15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+    15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+    15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+    15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8
+};
+
+static const int etcModifiers[8][2] = {
+    {  2,   8 }, {  5,  17 }, {  9,  29 }, { 13,  42 },
+    { 18,  60 }, { 24,  80 }, { 33, 106 }, { 47, 183 }
+};
+
+static const int etcDistances[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+static const int eacModifiers[16][8] = {
+    { -3, -6,  -9, -15, 2, 5, 8, 14 },
+    { -3, -7, -10, -13, 2, 6, 9, 12 },
+    { -2, -5,  -8, -13, 1, 4, 7, 12 },
+    { -2, -4,  -6, -13, 1, 3, 5, 12 },
+    { -3, -6,  -8, -12, 2, 5, 7, 11 },
+    { -3, -7,  -9, -11, 2, 6, 8, 10 },
+    { -4, -7,  -8, -11, 3, 6, 7, 10 },
+    { -3, -5,  -8, -11, 2, 4, 7, 10 },
+    { -2, -6,  -8, -10, 1, 5, 7,  9 },
+    { -2, -5,  -8, -10, 1, 4, 7,  9 },
+    { -2, -4,  -8, -10, 1, 3, 7,  9 },
+    { -2, -5,  -7, -10, 1, 4, 6,  9 },
+    { -3, -4,  -7, -10, 2, 3, 6,  9 },
+    { -1, -2,  -3, -10, 0, 1, 2,  9 },
+    { -4, -6,  -8,  -9, 3, 5, 7,  8 },
+    { -3, -5,  -7,  -9, 2, 4, 6,  8 }
+};
+
+static uint8_t texture_clamp(int value, int max)
+{
+    return (uint8_t)(value < 0 ? 0 : value > max ? max : value);
+}
+
+static uint64_t texture_readle64(const uint8_t *p)
+{
+    uint64_t value = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--)
+    {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+/* ETC2 and EAC blocks are big-endian */
+static uint64_t texture_readbe64(const uint8_t *p)
+{
+    uint64_t value = 0;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static uint32_t texture_readbits(BitReader *reader, uint32_t count)
+{
+    uint64_t value;
+
+    if (reader->position >= 64) {
+        value = reader->hi >> (reader->position - 64);
+    } else if (reader->position == 0) {
+        value = reader->lo;
+    } else {
+        value = (reader->lo >> reader->position) | (reader->hi << (64 - reader->position));
+    }
+    reader->position += count;
+    return (uint32_t)(value & ((1u << count) - 1));
+}
+
+static void texture_expand565(uint32_t color, uint8_t *texel)
+{
+    uint32_t r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+
+    texel[0] = (uint8_t)((r << 3) | (r >> 2));
+    texel[1] = (uint8_t)((g << 2) | (g >> 4));
+    texel[2] = (uint8_t)((b << 3) | (b >> 2));
+    texel[3] = 255;
+}
+
+/* BC2 and BC3 colour always takes the four-colour mode; BC1 RGBA makes its fourth colour transparent */
+static void texture_decodebc1(const uint8_t *block, uint8_t *texels, int fourcolor, int alpha)
+{
+    uint32_t c0 = block[0] | (block[1] << 8);
+    uint32_t c1 = block[2] | (block[3] << 8);
+    uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+    uint8_t colors[4][4];
+    int i;
+
+    texture_expand565(c0, colors[0]);
+    texture_expand565(c1, colors[1]);
+    for (i = 0; i < 3; i++)
+    {
+        if (c0 > c1 || fourcolor) {
+            colors[2][i] = (uint8_t)((2 * colors[0][i] + colors[1][i] + 1) / 3);
+            colors[3][i] = (uint8_t)((colors[0][i] + 2 * colors[1][i] + 1) / 3);
+        } else {
+            colors[2][i] = (uint8_t)((colors[0][i] + colors[1][i] + 1) / 2);
+            colors[3][i] = 0;
+        }
+    }
+    colors[2][3] = 255;
+    colors[3][3] = c0 <= c1 && !fourcolor && alpha ? 0 : 255;
+
+    for (i = 0; i < 16; i++)
+    {
+        memcpy(texels + i * 4, colors[(indices >> (2 * i)) & 3], 4);
+    }
+}
+
+static void texture_decodebc2alpha(const uint8_t *block, uint8_t *texels)
+{
+    uint64_t alphas = texture_readle64(block);
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        texels[i * 4 + 3] = (uint8_t)(((alphas >> (4 * i)) & 15) * 17);
+    }
+}
+
+/* One unsigned channel, also BC3 alpha and each half of BC5 */
+static void texture_decodebc4(const uint8_t *block, uint8_t *texels, int channel)
+{
+    uint64_t indices = texture_readle64(block) >> 16;
+    uint32_t v0 = block[0], v1 = block[1];
+    uint8_t values[8];
+    uint32_t i;
+
+    values[0] = (uint8_t)v0;
+    values[1] = (uint8_t)v1;
+    if (v0 > v1) {
+        for (i = 1; i < 7; i++)
+        {
+            values[i + 1] = (uint8_t)(((7 - i) * v0 + i * v1 + 3) / 7);
+        }
+    } else {
+        for (i = 1; i < 5; i++)
+        {
+            values[i + 1] = (uint8_t)(((5 - i) * v0 + i * v1 + 2) / 5);
+        }
+        values[6] = 0;
+        values[7] = 255;
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        texels[i * 4 + channel] = values[(indices >> (3 * i)) & 7];
+    }
+}
+
+static void texture_decodebc7(const uint8_t *block, uint8_t *texels)
+{
+    const Bc7Mode *mode;
+    BitReader reader;
+    uint8_t endpoints[6][4];
+    uint8_t indices[16], indices2[16];
+    uint32_t partition, rotation, selector;
+    uint32_t endpointCount, colorBits, alphaBits;
+    uint32_t i, j, subset, bits, p = 0;
+
+    /* The mode is the position of the lowest set bit; a zero byte is reserved */
+    for (i = 0; i < 8 && !(block[0] & (1u << i)); i++)
+    {
+    }
+    if (i == 8) {
+        memset(texels, 0, 64);
+        return;
+    }
+    mode = &bc7Modes[i];
+
+    reader.lo       = texture_readle64(block);
+    reader.hi       = texture_readle64(block + 8);
+    reader.position = i + 1;
+
+    partition     = texture_readbits(&reader, mode->partitionBits);
+    rotation      = texture_readbits(&reader, mode->rotationBits);
+    selector      = texture_readbits(&reader, mode->selectorBits);
+    endpointCount = mode->subsets * 2u;
+
+    /* All reds, then all greens, blues and alphas, then the p-bits */
+    for (j = 0; j < 3; j++)
+    {
+        for (i = 0; i < endpointCount; i++)
+        {
+            endpoints[i][j] = (uint8_t)texture_readbits(&reader, mode->colorBits);
+        }
+    }
+    for (i = 0; i < endpointCount; i++)
+    {
+        endpoints[i][3] = (uint8_t)texture_readbits(&reader, mode->alphaBits);
+    }
+
+    colorBits = mode->colorBits;
+    alphaBits = mode->alphaBits;
+    if (mode->endpointPBits || mode->sharedPBits) {
+        for (i = 0; i < endpointCount; i++)
+        {
+            if (mode->endpointPBits || (i & 1) == 0) {
+                p = texture_readbits(&reader, 1);
+            }
+            for (j = 0; j < 4; j++)
+            {
+                endpoints[i][j] = (uint8_t)((endpoints[i][j] << 1) | p);
+            }
+        }
+        colorBits++;
+        alphaBits = alphaBits ? alphaBits + 1 : 0;
+    }
+
+    /* Widen to 8 bits by repeating the top bits in the bottom */
+    for (i = 0; i < endpointCount; i++)
+    {
+        for (j = 0; j < 3; j++)
+        {
+            endpoints[i][j] = (uint8_t)(endpoints[i][j] << (8 - colorBits));
+            endpoints[i][j] = (uint8_t)(endpoints[i][j] | (endpoints[i][j] >> colorBits));
+        }
+        if (alphaBits) {
+            endpoints[i][3] = (uint8_t)(endpoints[i][3] << (8 - alphaBits));
+            endpoints[i][3] = (uint8_t)(endpoints[i][3] | (endpoints[i][3] >> alphaBits));
+        } else {
+            endpoints[i][3] = 255;
+        }
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        bits = mode->indexBits;
+        if (i == 0 ||
+            (mode->subsets == 2 && i == bc7Anchors2[partition]) ||
+            (mode->subsets == 3 && (i == bc7Anchors3a[partition] || i == bc7Anchors3b[partition]))) {
+            bits--;
+        }
+        indices[i] = (uint8_t)texture_readbits(&reader, bits);
+    }
+    for (i = 0; i < 16; i++)
+    {
+        indices2[i] = mode->index2Bits ? (uint8_t)texture_readbits(&reader, mode->index2Bits - (i == 0)) : indices[i];
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        const uint8_t *e0, *e1;
+        uint32_t colorWeight, alphaWeight;
+        uint8_t *texel = texels + i * 4;
+        uint8_t swap;
+
+        subset = mode->subsets == 2 ? bc7Partitions2[partition][i] :
+                 mode->subsets == 3 ? bc7Partitions3[partition][i] : 0;
+        e0 = endpoints[subset * 2];
+        e1 = endpoints[subset * 2 + 1];
+
+        /* Mode 4's selector swaps which index set drives colour and which alpha */
+        if (mode->index2Bits) {
+            uint32_t colorIndex = selector ? indices2[i] : indices[i];
+            uint32_t alphaIndex = selector ? indices[i] : indices2[i];
+            uint32_t colorIndexBits = selector ? mode->index2Bits : mode->indexBits;
+            uint32_t alphaIndexBits = selector ? mode->indexBits : mode->index2Bits;
+
+            colorWeight = colorIndexBits == 2 ? bc7Weights2[colorIndex] : bc7Weights3[colorIndex];
+            alphaWeight = alphaIndexBits == 2 ? bc7Weights2[alphaIndex] : bc7Weights3[alphaIndex];
+        } else {
+            colorWeight = mode->indexBits == 2 ? bc7Weights2[indices[i]] :
+                          mode->indexBits == 3 ? bc7Weights3[indices[i]] : bc7Weights4[indices[i]];
+            alphaWeight = colorWeight;
+        }
+
+        for (j = 0; j < 3; j++)
+        {
+            texel[j] = (uint8_t)(((64 - colorWeight) * e0[j] + colorWeight * e1[j] + 32) >> 6);
+        }
+        texel[3] = (uint8_t)(((64 - alphaWeight) * e0[3] + alphaWeight * e1[3] + 32) >> 6);
+
+        if (rotation > 0) {
+            swap               = texel[3];
+            texel[3]            = texel[rotation - 1];
+            texel[rotation - 1] = swap;
+        }
+    }
+}
+
+static void texture_setetccolor(uint8_t *texel, const int *base, int modifier)
+{
+    texel[0] = texture_clamp(base[0] + modifier, 255);
+    texel[1] = texture_clamp(base[1] + modifier, 255);
+    texel[2] = texture_clamp(base[2] + modifier, 255);
+    texel[3] = 255;
+}
+
+/* Texel indices are stored by column, most significant bits in the upper half */
+static uint32_t texture_etcindex(uint64_t bits, uint32_t x, uint32_t y)
+{
+    uint32_t i = x * 4 + y;
+
+    return (uint32_t)((((bits >> (16 + i)) & 1) << 1) | ((bits >> i) & 1));
+}
+
+static int texture_extend4(uint32_t value)
+{
+    return (int)((value << 4) | value);
+}
+
+static int texture_extend5(uint32_t value)
+{
+    return (int)((value << 3) | (value >> 2));
+}
+
+/* T and H pick a paint colour per texel; without opacity, index 2 is transparent */
+static void texture_paintetc(uint64_t bits, int paint[4][3], int opaque, uint8_t *texels)
+{
+    uint32_t x, y, i;
+
+    for (y = 0; y < 4; y++)
+    {
+        for (x = 0; x < 4; x++)
+        {
+            uint8_t *texel = texels + (y * 4 + x) * 4;
+
+            i = texture_etcindex(bits, x, y);
+            if (!opaque && i == 2) {
+                memset(texel, 0, 4);
+                continue;
+            }
+            texture_setetccolor(texel, paint[i], 0);
+        }
+    }
+}
+
+/* ETC1 modes plus ETC2's T, H and planar; punchthrough reads the differential bit as opacity */
+static void texture_decodeetc2(const uint8_t *block, uint8_t *texels, int punchthrough)
+{
+    uint64_t bits = texture_readbe64(block);
+    int differential = (int)((bits >> 33) & 1);
+    int opaque = punchthrough ? differential : 1;
+    int flip = (int)((bits >> 32) & 1);
+    int base[2][3], paint[4][3];
+    int r, g, b, dr, dg, db;
+    uint32_t x, y, i, table[2];
+
+    if (!punchthrough && !differential) {
+        base[0][0] = texture_extend4((uint32_t)(bits >> 60) & 15);
+        base[1][0] = texture_extend4((uint32_t)(bits >> 56) & 15);
+        base[0][1] = texture_extend4((uint32_t)(bits >> 52) & 15);
+        base[1][1] = texture_extend4((uint32_t)(bits >> 48) & 15);
+        base[0][2] = texture_extend4((uint32_t)(bits >> 44) & 15);
+        base[1][2] = texture_extend4((uint32_t)(bits >> 40) & 15);
+    } else {
+        r  = (int)((bits >> 59) & 31);
+        g  = (int)((bits >> 51) & 31);
+        b  = (int)((bits >> 43) & 31);
+        dr = (int)(((bits >> 56) & 7) ^ 4) - 4;
+        dg = (int)(((bits >> 48) & 7) ^ 4) - 4;
+        db = (int)(((bits >> 40) & 7) ^ 4) - 4;
+
+        if (r + dr < 0 || r + dr > 31) {
+            /* T mode: one colour, and a second spread by a distance */
+            int c0[3], c1[3], distance;
+
+            c0[0] = texture_extend4((uint32_t)((((bits >> 59) & 3) << 2) | ((bits >> 56) & 3)));
+            c0[1] = texture_extend4((uint32_t)(bits >> 52) & 15);
+            c0[2] = texture_extend4((uint32_t)(bits >> 48) & 15);
+            c1[0] = texture_extend4((uint32_t)(bits >> 44) & 15);
+            c1[1] = texture_extend4((uint32_t)(bits >> 40) & 15);
+            c1[2] = texture_extend4((uint32_t)(bits >> 36) & 15);
+            distance = etcDistances[(((bits >> 34) & 3) << 1) | ((bits >> 32) & 1)];
+            for (i = 0; i < 3; i++)
+            {
+                paint[0][i] = c0[i];
+                paint[1][i] = c1[i] + distance;
+                paint[2][i] = c1[i];
+                paint[3][i] = c1[i] - distance;
+            }
+            texture_paintetc(bits, paint, opaque, texels);
+            return;
+        } else if (g + dg < 0 || g + dg > 31) {
+            /* H mode: two colours, each spread by the same distance */
+            uint32_t r0 = (uint32_t)(bits >> 59) & 15;
+            uint32_t g0 = (uint32_t)((((bits >> 56) & 7) << 1) | ((bits >> 52) & 1));
+            uint32_t b0 = (uint32_t)((((bits >> 51) & 1) << 3) | ((bits >> 47) & 7));
+            uint32_t r1 = (uint32_t)(bits >> 43) & 15;
+            uint32_t g1 = (uint32_t)(bits >> 39) & 15;
+            uint32_t b1 = (uint32_t)(bits >> 35) & 15;
+            uint32_t order = ((r0 << 8) | (g0 << 4) | b0) >= ((r1 << 8) | (g1 << 4) | b1);
+            int c0[3], c1[3], distance;
+
+            c0[0] = texture_extend4(r0);
+            c0[1] = texture_extend4(g0);
+            c0[2] = texture_extend4(b0);
+            c1[0] = texture_extend4(r1);
+            c1[1] = texture_extend4(g1);
+            c1[2] = texture_extend4(b1);
+            distance = etcDistances[(((bits >> 34) & 1) << 2) | (((bits >> 32) & 1) << 1) | order];
+            for (i = 0; i < 3; i++)
+            {
+                paint[0][i] = c0[i] + distance;
+                paint[1][i] = c0[i] - distance;
+                paint[2][i] = c1[i] + distance;
+                paint[3][i] = c1[i] - distance;
+            }
+            texture_paintetc(bits, paint, opaque, texels);
+            return;
+        } else if (b + db < 0 || b + db > 31) {
+            /* Planar mode: a gradient through three colours, always opaque */
+            int o[3], h[3], v[3];
+            uint32_t ro = (uint32_t)(bits >> 57) & 63;
+            uint32_t go = (uint32_t)((((bits >> 56) & 1) << 6) | ((bits >> 49) & 63));
+            uint32_t bo = (uint32_t)((((bits >> 48) & 1) << 5) | (((bits >> 43) & 3) << 3) | ((bits >> 39) & 7));
+            uint32_t rh = (uint32_t)((((bits >> 34) & 31) << 1) | ((bits >> 32) & 1));
+            uint32_t gh = (uint32_t)(bits >> 25) & 127;
+            uint32_t bh = (uint32_t)(bits >> 19) & 63;
+            uint32_t rv = (uint32_t)(bits >> 13) & 63;
+            uint32_t gv = (uint32_t)(bits >> 6) & 127;
+            uint32_t bv = (uint32_t)bits & 63;
+
+            o[0] = (int)((ro << 2) | (ro >> 4));
+            o[1] = (int)((go << 1) | (go >> 6));
+            o[2] = (int)((bo << 2) | (bo >> 4));
+            h[0] = (int)((rh << 2) | (rh >> 4));
+            h[1] = (int)((gh << 1) | (gh >> 6));
+            h[2] = (int)((bh << 2) | (bh >> 4));
+            v[0] = (int)((rv << 2) | (rv >> 4));
+            v[1] = (int)((gv << 1) | (gv >> 6));
+            v[2] = (int)((bv << 2) | (bv >> 4));
+            for (y = 0; y < 4; y++)
+            {
+                for (x = 0; x < 4; x++)
+                {
+                    uint8_t *texel = texels + (y * 4 + x) * 4;
+
+                    for (i = 0; i < 3; i++)
+                    {
+                        texel[i] = texture_clamp(((int)x * (h[i] - o[i]) + (int)y * (v[i] - o[i]) + 4 * o[i] + 2) >> 2, 255);
+                    }
+                    texel[3] = 255;
+                }
+            }
+            return;
+        }
+
+        base[0][0] = texture_extend5((uint32_t)r);
+        base[0][1] = texture_extend5((uint32_t)g);
+        base[0][2] = texture_extend5((uint32_t)b);
+        base[1][0] = texture_extend5((uint32_t)(r + dr));
+        base[1][1] = texture_extend5((uint32_t)(g + dg));
+        base[1][2] = texture_extend5((uint32_t)(b + db));
+    }
+
+    /* Two subblocks, side by side or stacked, each with a base colour and modifier table */
+    table[0] = (uint32_t)(bits >> 37) & 7;
+    table[1] = (uint32_t)(bits >> 34) & 7;
+    for (y = 0; y < 4; y++)
+    {
+        for (x = 0; x < 4; x++)
+        {
+            uint8_t *texel = texels + (y * 4 + x) * 4;
+            uint32_t subblock = flip ? y >= 2 : x >= 2;
+            int modifier;
+
+            i = texture_etcindex(bits, x, y);
+            if (!opaque && i == 2) {
+                memset(texel, 0, 4);
+                continue;
+            }
+            /* Index 0 keeps its base colour when punchthrough blocks aren't opaque */
+            modifier = etcModifiers[table[subblock]][i & 1];
+            modifier = (i & 2) ? -modifier : (!opaque && i == 0) ? 0 : modifier;
+            texture_setetccolor(texel, base[subblock], modifier);
+        }
+    }
+}
+
+/* EAC alpha for ETC2 RGBA8, or an 11-bit channel narrowed to 8 for R11 and RG11 */
+static void texture_decodeeac(const uint8_t *block, uint8_t *texels, int channel, int eleven)
+{
+    uint64_t bits = texture_readbe64(block);
+    int base = (int)(bits >> 56) & 255;
+    int multiplier = (int)(bits >> 52) & 15;
+    const int *modifiers = eacModifiers[(bits >> 48) & 15];
+    uint32_t i;
+    int value;
+
+    for (i = 0; i < 16; i++)
+    {
+        int modifier = modifiers[(bits >> (45 - 3 * i)) & 7];
+
+        if (eleven) {
+            value = base * 8 + 4 + modifier * (multiplier ? multiplier * 8 : 1);
+            value = value < 0 ? 0 : value > 2047 ? 2047 : value;
+            value = (value * 255 + 1023) / 2047;
+        } else {
+            value = texture_clamp(base + modifier * multiplier, 255);
+        }
+        /* Stored by column */
+        texels[((i & 3) * 4 + (i >> 2)) * 4 + channel] = (uint8_t)value;
+    }
+}
+
+/*
+ * Bytes per 4x4 block, or 0 for formats without a decoder here. ASTC, BC6H
+ * and the SNORM formats are not decoded yet: ASTC needs a decoder of its own
+ * and the others do not fit an RGBA8 UNORM result.
+ */
+static uint32_t texture_getdecodeblocksize(TextureFormat format)
+{
+    switch (format)
+    {
+    case TEXTURE_FORMAT_BC1_RGB_UNORM:
+    case TEXTURE_FORMAT_BC1_RGB_SRGB:
+    case TEXTURE_FORMAT_BC1_RGBA_UNORM:
+    case TEXTURE_FORMAT_BC1_RGBA_SRGB:
+    case TEXTURE_FORMAT_BC4_UNORM:
+    case TEXTURE_FORMAT_ETC2_RGB8_UNORM:
+    case TEXTURE_FORMAT_ETC2_RGB8_SRGB:
+    case TEXTURE_FORMAT_ETC2_RGB8A1_UNORM:
+    case TEXTURE_FORMAT_ETC2_RGB8A1_SRGB:
+    case TEXTURE_FORMAT_EAC_R11_UNORM:
+        return 8;
+    case TEXTURE_FORMAT_BC2_UNORM:
+    case TEXTURE_FORMAT_BC2_SRGB:
+    case TEXTURE_FORMAT_BC3_UNORM:
+    case TEXTURE_FORMAT_BC3_SRGB:
+    case TEXTURE_FORMAT_BC5_UNORM:
+    case TEXTURE_FORMAT_BC7_UNORM:
+    case TEXTURE_FORMAT_BC7_SRGB:
+    case TEXTURE_FORMAT_ETC2_RGBA8_UNORM:
+    case TEXTURE_FORMAT_ETC2_RGBA8_SRGB:
+    case TEXTURE_FORMAT_EAC_RG11_UNORM:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+static void texture_decodeblock(TextureFormat format, const uint8_t *block, uint8_t *texels)
+{
+    switch (format)
+    {
+    case TEXTURE_FORMAT_BC1_RGB_UNORM:
+    case TEXTURE_FORMAT_BC1_RGB_SRGB:
+        texture_decodebc1(block, texels, 0, 0);
+        break;
+    case TEXTURE_FORMAT_BC1_RGBA_UNORM:
+    case TEXTURE_FORMAT_BC1_RGBA_SRGB:
+        texture_decodebc1(block, texels, 0, 1);
+        break;
+    case TEXTURE_FORMAT_BC2_UNORM:
+    case TEXTURE_FORMAT_BC2_SRGB:
+        texture_decodebc1(block + 8, texels, 1, 0);
+        texture_decodebc2alpha(block, texels);
+        break;
+    case TEXTURE_FORMAT_BC3_UNORM:
+    case TEXTURE_FORMAT_BC3_SRGB:
+        texture_decodebc1(block + 8, texels, 1, 0);
+        texture_decodebc4(block, texels, 3);
+        break;
+    case TEXTURE_FORMAT_BC4_UNORM:
+        memset(texels, 0, 64);
+        texture_decodebc4(block, texels, 0);
+        break;
+    case TEXTURE_FORMAT_BC5_UNORM:
+        memset(texels, 0, 64);
+        texture_decodebc4(block, texels, 0);
+        texture_decodebc4(block + 8, texels, 1);
+        break;
+    case TEXTURE_FORMAT_BC7_UNORM:
+    case TEXTURE_FORMAT_BC7_SRGB:
+        texture_decodebc7(block, texels);
+        return;
+    case TEXTURE_FORMAT_ETC2_RGB8_UNORM:
+    case TEXTURE_FORMAT_ETC2_RGB8_SRGB:
+        texture_decodeetc2(block, texels, 0);
+        return;
+    case TEXTURE_FORMAT_ETC2_RGB8A1_UNORM:
+    case TEXTURE_FORMAT_ETC2_RGB8A1_SRGB:
+        texture_decodeetc2(block, texels, 1);
+        return;
+    case TEXTURE_FORMAT_ETC2_RGBA8_UNORM:
+    case TEXTURE_FORMAT_ETC2_RGBA8_SRGB:
+        texture_decodeetc2(block + 8, texels, 0);
+        texture_decodeeac(block, texels, 3, 0);
+        return;
+    case TEXTURE_FORMAT_EAC_R11_UNORM:
+        memset(texels, 0, 64);
+        texture_decodeeac(block, texels, 0, 1);
+        break;
+    case TEXTURE_FORMAT_EAC_RG11_UNORM:
+        memset(texels, 0, 64);
+        texture_decodeeac(block, texels, 0, 1);
+        texture_decodeeac(block + 8, texels, 1, 1);
+        break;
+    default:
+        return;
+    }
+
+    /* One- and two-channel formats read as opaque */
+    if (format == TEXTURE_FORMAT_BC4_UNORM || format == TEXTURE_FORMAT_BC5_UNORM ||
+        format == TEXTURE_FORMAT_EAC_R11_UNORM || format == TEXTURE_FORMAT_EAC_RG11_UNORM) {
+        uint32_t i;
+
+        for (i = 0; i < 16; i++)
+        {
+            texels[i * 4 + 3] = 255;
+        }
+    }
+}
+
+static void texture_decoderows(uint32_t first, uint32_t last, void *data)
+{
+    const TextureDecode *decode = (const TextureDecode *)data;
+    uint8_t texels[64];
+    uint32_t bx, by, y, w, h;
+    size_t offset;
+
+    for (by = first; by < last; by++)
+    {
+        const uint8_t *block = decode->blocks + (size_t)by * decode->blocksWide * decode->blockSize;
+
+        h = decode->height - by * 4 < 4 ? decode->height - by * 4 : 4;
+        for (bx = 0; bx < decode->blocksWide; bx++, block += decode->blockSize)
+        {
+            texture_decodeblock(decode->format, block, texels);
+
+            /* Edge blocks overhang the image */
+            w = decode->width - bx * 4 < 4 ? decode->width - bx * 4 : 4;
+            for (y = 0; y < h; y++)
+            {
+                offset = ((size_t)(by * 4 + y) * decode->width + bx * 4) * 4;
+                memcpy(decode->pixels + offset, texels + y * 16, w * 4);
+            }
+        }
+    }
+}
+
+/* Whether texture_decode has a CPU fallback for format */
+int texture_isdecodable(TextureFormat format)
+{
+    return texture_getdecodeblocksize(format) != 0;
+}
+
+/* Decode one level to RGBA8 across the job workers; 0 when the format has no decoder or the size is off */
+int texture_decode(TextureFormat format, const void *blocks, size_t size, uint32_t width, uint32_t height, uint8_t *pixels)
+{
+    TextureDecode decode;
+    uint32_t blocksHigh;
+
+    decode.format     = format;
+    decode.blocks     = (const uint8_t *)blocks;
+    decode.blockSize  = texture_getdecodeblocksize(format);
+    decode.blocksWide = (width + 3) / 4;
+    decode.width      = width;
+    decode.height     = height;
+    decode.pixels     = pixels;
+    blocksHigh        = (height + 3) / 4;
+
+    if (decode.blockSize == 0 || size != (size_t)decode.blocksWide * blocksHigh * decode.blockSize) {
+        return 0;
+    }
+
+    job_parallelfor(blocksHigh, TEXTURE_DECODE_GRAIN, texture_decoderows, &decode);
+    return 1;
+}
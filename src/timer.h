@@ -9,8 +9,21 @@
 extern "C" {
 #endif
 
+/* Frame pacing over recent frames, in nanoseconds */
+typedef struct TimerStats {
+    uint64_t frametime;
+    uint64_t meanframetime;
+    uint64_t jitter;
+    uint64_t maxframetime;
+    uint32_t missedframes;
+} TimerStats;
+
 uint64_t timer_step();
+uint64_t timer_getnanoseconds();
 void     timer_sleep(uint32_t ms);
+void     timer_settargetframetime(uint64_t ns);
+void     timer_pace();
+void     timer_getstats(TimerStats *stats);
 
 #ifdef __cplusplus
 }
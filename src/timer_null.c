@@ -1,23 +1,62 @@
 /* Copyright Planimeter. All Rights Reserved. */
 
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 199309L
+#endif
+
 #include "timer.h"
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 static uint64_t dt = 0;
 static uint64_t prevtime = 0;
 
-uint64_t timer_gettime()
-{
-    return 0;
-}
-
 uint64_t timer_step()
 {
-    uint64_t time = timer_gettime();
-    dt = time - prevtime;
+    uint64_t time = timer_getnanoseconds();
+    dt = prevtime != 0 ? time - prevtime : 0;
     prevtime = time;
     return dt;
 }
 
+/* A monotonic clock, so pacing and the profiler still work without a platform layer */
+uint64_t timer_getnanoseconds()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000ull +
+           (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000ull / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
 void timer_sleep(uint32_t ms)
 {
 }
+
+void timer_settargetframetime(uint64_t ns)
+{
+}
+
+void timer_pace()
+{
+}
+
+void timer_getstats(TimerStats *stats)
+{
+    memset(stats, 0, sizeof(TimerStats));
+}
@@ -3,23 +3,130 @@
 #include "timer.h"
 #include "SDL3/SDL.h"
 
+/* Frames kept for pacing statistics */
+#define TIMER_STATS_FRAMES 128
+
+/* The pacer spins instead of sleeping for the last stretch before a deadline */
+#define TIMER_SPIN_NS 2000000
+
 static uint64_t dt = 0;
 static uint64_t prevtime = 0;
 
-uint64_t timer_gettime()
-{
-    return SDL_GetTicks();
-}
+static uint64_t frequency = 0;
+static uint64_t targetframetime = 0;
+static uint64_t deadline = 0;
+static uint64_t prevframe = 0;
 
+static uint64_t frametimes[TIMER_STATS_FRAMES];
+static uint32_t frametimehead = 0;
+static uint32_t frametimecount = 0;
+static uint32_t missedframes = 0;
+
+/* Nanoseconds since the last call, from the same clock as timer_getnanoseconds */
 uint64_t timer_step()
 {
-    uint64_t time = timer_gettime();
-    dt = time - prevtime;
+    uint64_t time = timer_getnanoseconds();
+    dt = prevtime != 0 ? time - prevtime : 0;
     prevtime = time;
     return dt;
 }
 
+uint64_t timer_getnanoseconds()
+{
+    uint64_t counter = SDL_GetPerformanceCounter();
+
+    if (frequency == 0)
+    {
+        frequency = SDL_GetPerformanceFrequency();
+    }
+
+    /* Split the conversion so counter * SDL_NS_PER_SECOND cannot overflow */
+    return (counter / frequency) * SDL_NS_PER_SECOND +
+           (counter % frequency) * SDL_NS_PER_SECOND / frequency;
+}
+
 void timer_sleep(uint32_t ms)
 {
     SDL_Delay(ms);
 }
+
+/* 0 paces nothing and leaves the rate to presentation */
+void timer_settargetframetime(uint64_t ns)
+{
+    targetframetime = ns;
+    deadline        = 0;
+}
+
+/* Sleep coarsely, then spin, until the next frame deadline */
+void timer_pace()
+{
+    uint64_t now = timer_getnanoseconds();
+
+    if (targetframetime > 0)
+    {
+        deadline = deadline ? deadline + targetframetime : now + targetframetime;
+
+        /* Missed the deadline, so start a new cadence rather than racing to catch up */
+        if (now >= deadline)
+        {
+            if (prevframe != 0) {
+                missedframes++;
+            }
+            deadline = now;
+        }
+        else
+        {
+            if (deadline - now > TIMER_SPIN_NS) {
+                SDL_DelayNS(deadline - now - TIMER_SPIN_NS);
+            }
+            do {
+                now = timer_getnanoseconds();
+            } while (now < deadline);
+        }
+    }
+
+    if (prevframe != 0)
+    {
+        frametimes[frametimehead] = now - prevframe;
+        frametimehead = (frametimehead + 1) % TIMER_STATS_FRAMES;
+        if (frametimecount < TIMER_STATS_FRAMES) {
+            frametimecount++;
+        }
+    }
+    prevframe = now;
+}
+
+void timer_getstats(TimerStats *stats)
+{
+    double mean = 0.0;
+    double variance = 0.0;
+    uint32_t i;
+
+    SDL_zerop(stats);
+    stats->missedframes = missedframes;
+    if (frametimecount == 0)
+    {
+        return;
+    }
+
+    stats->frametime = frametimes[(frametimehead + TIMER_STATS_FRAMES - 1) % TIMER_STATS_FRAMES];
+    for (i = 0; i < frametimecount; i++)
+    {
+        mean += (double)frametimes[i];
+        if (frametimes[i] > stats->maxframetime) {
+            stats->maxframetime = frametimes[i];
+        }
+    }
+    mean /= frametimecount;
+
+    /* Jitter is the standard deviation of the frame time */
+    for (i = 0; i < frametimecount; i++)
+    {
+        double deviation = (double)frametimes[i] - mean;
+        variance += deviation * deviation;
+    }
+    variance /= frametimecount;
+
+    stats->meanframetime = (uint64_t)mean;
+    stats->jitter        = (uint64_t)SDL_sqrt(variance);
+}
@@ -0,0 +1,25 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Notification of files written in watched directories, for reloading
+ * assets during development. Only files directly inside a directory are
+ * reported, once each time a writer closes them or renames them in.
+ */
+int    watch_add(const char *directory);
+int    watch_poll(char *pathname, size_t size);
+void   watch_shutdown(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WATCH_H */
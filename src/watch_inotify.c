@@ -0,0 +1,98 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+/* read and close under strict C99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include "watch.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define MAX_WATCHES 16
+
+/* Directories by watch descriptor, as events only carry the descriptor */
+static char directories[MAX_WATCHES][256];
+static int descriptors[MAX_WATCHES];
+static int watchCount = 0;
+static int fd = -1;
+
+/* Events read but not yet returned; a read always yields whole events */
+static char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+static size_t eventLength = 0;
+static size_t eventOffset = 0;
+
+/* https://man7.org/linux/man-pages/man7/inotify.7.html */
+int watch_add(const char *directory)
+{
+    int wd;
+
+    if (watchCount == MAX_WATCHES || strlen(directory) >= sizeof(directories[0])) {
+        fprintf(stderr, "watch_add: can't watch %s\n", directory);
+        return 0;
+    }
+    if (fd == -1) {
+        if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+            perror("watch_add");
+            return 0;
+        }
+        atexit(watch_shutdown);
+    }
+
+    /* Compilers write in place or rename a finished file over the old one */
+    if ((wd = inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO)) == -1) {
+        fprintf(stderr, "watch_add: can't watch %s\n", directory);
+        return 0;
+    }
+    strcpy(directories[watchCount], directory);
+    descriptors[watchCount++] = wd;
+    return 1;
+}
+
+/* Copy the next changed file as "directory/name"; 0 once there are none left, without blocking */
+int watch_poll(char *pathname, size_t size)
+{
+    const struct inotify_event *event;
+    ssize_t length;
+    int i;
+
+    if (fd == -1) {
+        return 0;
+    }
+
+    for (;;)
+    {
+        if (eventOffset >= eventLength) {
+            if ((length = read(fd, events, sizeof(events))) <= 0) {
+                return 0;
+            }
+            eventLength = (size_t)length;
+            eventOffset = 0;
+        }
+
+        event        = (const struct inotify_event *)(events + eventOffset);
+        eventOffset += sizeof(struct inotify_event) + event->len;
+        if (event->len == 0 || (event->mask & IN_ISDIR)) {
+            continue;
+        }
+
+        for (i = 0; i < watchCount && descriptors[i] != event->wd; i++)
+        {
+        }
+        if (i < watchCount && (size_t)snprintf(pathname, size, "%s/%s", directories[i], event->name) < size) {
+            return 1;
+        }
+    }
+}
+
+void watch_shutdown(void)
+{
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    watchCount  = 0;
+    eventLength = 0;
+    eventOffset = 0;
+}
@@ -0,0 +1,17 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "watch.h"
+
+int watch_add(const char *directory)
+{
+    return 0;
+}
+
+int watch_poll(char *pathname, size_t size)
+{
+    return 0;
+}
+
+void watch_shutdown(void)
+{
+}
@@ -0,0 +1,52 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+#include "framework.h"
+#include "event.h"
+#include "filesystem.h"
+#include "graphics.h"
+#include "job.h"
+#include "memory.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Frames allowed to allocate while caches and pools fill up */
+#define WARMUP_FRAMES 8
+
+/* Frames that must then run without touching the heap */
+#define TEST_FRAMES 120
+
+/* Run the frame loop of main_null.c, failing on any heap allocation once warmed up */
+int main(int argc, char *argv[])
+{
+    uint64_t allocations;
+    uint32_t frame;
+    int failed = 0;
+
+    framework_init(argc, argv);
+    framework_load(argc, argv);
+
+    for (frame = 0; frame < WARMUP_FRAMES + TEST_FRAMES; frame++)
+    {
+        event_poll();
+        job_pump();
+        filesystem_update();
+        framework_advance(timer_step());
+        framework_draw(1.0f);
+        graphics_submitframe();
+        graphics_predraw();
+        graphics_postdraw();
+
+        /* graphics_present resets the counts for the next frame */
+        allocations = memory_getframeallocations();
+        if (frame >= WARMUP_FRAMES && allocations > 0) {
+            fprintf(stderr, "frame_allocations: frame %u made %llu heap allocations\n",
+                    frame, (unsigned long long)allocations);
+            failed = 1;
+        }
+        graphics_present();
+    }
+
+    framework_quit();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
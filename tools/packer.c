@@ -0,0 +1,193 @@
+/* Copyright Planimeter. All Rights Reserved. */
+
+/*
+ * packer: build a pack from loose files
+ *
+ *   packer <output> <file>...
+ *
+ * Each file is stored under the path it was given, with '/' separators.
+ */
+
+#include "pack.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct PackerFile {
+    char     *pathname;
+    PackEntry entry;
+} PackerFile;
+
+static void *readfile(const char *pathname, size_t *size)
+{
+    FILE *fp;
+    long length;
+    char *p;
+
+    if ((fp = fopen(pathname, "rb")) == NULL) {
+        fprintf(stderr, "packer: can't open %s\n", pathname);
+        exit(EXIT_FAILURE);
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (length = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "packer: can't access %s\n", pathname);
+        exit(EXIT_FAILURE);
+    }
+    p = (char *) malloc(length > 0 ? length : 1);
+    if (p == NULL) {
+        fprintf(stderr, "packer: out of memory reading %s\n", pathname);
+        exit(EXIT_FAILURE);
+    }
+    if (length > 0 && fread(p, length, 1, fp) != 1) {
+        fprintf(stderr, "packer: can't read %s\n", pathname);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+    *size = (size_t)length;
+    return p;
+}
+
+static void writebytes(FILE *fp, const void *ptr, size_t size, uint64_t *offset)
+{
+    if (size > 0 && fwrite(ptr, size, 1, fp) != 1) {
+        fprintf(stderr, "packer: write failed\n");
+        exit(EXIT_FAILURE);
+    }
+    *offset += size;
+}
+
+static void writepadding(FILE *fp, uint64_t alignment, uint64_t *offset)
+{
+    static const char zeros[PACK_PAGE_ALIGNMENT] = { 0 };
+
+    writebytes(fp, zeros, (size_t)((alignment - *offset % alignment) % alignment), offset);
+}
+
+/* Stored paths use '/' and never start with "./" */
+static char *normalizepath(const char *pathname)
+{
+    size_t length, i;
+    char *p;
+
+    while (pathname[0] == '.' && (pathname[1] == '/' || pathname[1] == '\\'))
+    {
+        pathname += 2;
+    }
+    length = strlen(pathname);
+    p = (char *) malloc(length + 1);
+    if (p == NULL) {
+        fprintf(stderr, "packer: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i <= length; i++)
+    {
+        p[i] = pathname[i] == '\\' ? '/' : pathname[i];
+    }
+    return p;
+}
+
+int main(int argc, char *argv[])
+{
+    PackHeader header = { 0 };
+    PackerFile *files;
+    PackEntry *slots;
+    uint32_t *slotfiles;
+    FILE *fp;
+    uint64_t offset = 0;
+    uint32_t count, slotcount, path = 0;
+    uint32_t i, slot;
+    void *data;
+    size_t size;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: packer <output> <file>...\n");
+        return EXIT_FAILURE;
+    }
+
+    count     = (uint32_t)(argc - 2);
+    slotcount = 2;
+    while (slotcount < count * 2)
+    {
+        slotcount *= 2;
+    }
+
+    files = (PackerFile *) calloc(count, sizeof(PackerFile));
+    slots = (PackEntry *) calloc(slotcount, sizeof(PackEntry));
+    slotfiles = (uint32_t *) calloc(slotcount, sizeof(uint32_t));
+    if (files == NULL || slots == NULL || slotfiles == NULL) {
+        fprintf(stderr, "packer: out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((fp = fopen(argv[1], "wb")) == NULL) {
+        fprintf(stderr, "packer: can't open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    /* Rewritten once the table is known */
+    writebytes(fp, &header, sizeof(header), &offset);
+
+    for (i = 0; i < count; i++)
+    {
+        PackEntry *entry = &files[i].entry;
+
+        files[i].pathname = normalizepath(argv[i + 2]);
+        data = readfile(argv[i + 2], &size);
+
+        writepadding(fp, size >= PACK_PAGE_THRESHOLD ? PACK_PAGE_ALIGNMENT : PACK_ALIGNMENT, &offset);
+        entry->hash         = pack_hash(files[i].pathname);
+        entry->offset       = offset;
+        entry->size         = size;
+        entry->originalsize = size;
+        entry->path         = path;
+        entry->pathlength   = (uint32_t)strlen(files[i].pathname);
+        entry->checksum     = pack_checksum(0, data, size);
+        entry->flags        = 0;
+        writebytes(fp, data, size, &offset);
+        path += entry->pathlength;
+
+        free(data);
+        data = NULL;
+    }
+
+    /* Path strings, in entry order */
+    header.stringoffset  = offset;
+    header.stringsize    = path;
+    header.tablechecksum = 0;
+    for (i = 0; i < count; i++)
+    {
+        writebytes(fp, files[i].pathname, files[i].entry.pathlength, &offset);
+        header.tablechecksum = pack_checksum(header.tablechecksum, files[i].pathname, files[i].entry.pathlength);
+    }
+
+    /* Linear probing, matching pack_findentry; slotfiles remembers who owns each slot */
+    for (i = 0; i < count; i++)
+    {
+        for (slot = (uint32_t)files[i].entry.hash & (slotcount - 1); slots[slot].hash != 0; slot = (slot + 1) & (slotcount - 1))
+        {
+            if (slots[slot].hash == files[i].entry.hash && strcmp(files[slotfiles[slot]].pathname, files[i].pathname) == 0) {
+                fprintf(stderr, "packer: %s given twice\n", files[i].pathname);
+                return EXIT_FAILURE;
+            }
+        }
+        slots[slot]     = files[i].entry;
+        slotfiles[slot] = i;
+    }
+
+    writepadding(fp, PACK_ALIGNMENT, &offset);
+    header.magic         = PACK_MAGIC;
+    header.version       = PACK_VERSION;
+    header.slotcount     = slotcount;
+    header.entrycount    = count;
+    header.slotoffset    = offset;
+    header.tablechecksum = pack_checksum(header.tablechecksum, slots, sizeof(PackEntry) * slotcount);
+    writebytes(fp, slots, sizeof(PackEntry) * slotcount, &offset);
+
+    if (fseek(fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, fp) != 1) {
+        fprintf(stderr, "packer: can't write header\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("packer: %u files, %llu bytes\n", count, (unsigned long long)offset);
+    fclose(fp);
+    return EXIT_SUCCESS;
+}